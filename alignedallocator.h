@@ -0,0 +1,38 @@
+#pragma once
+
+#include <new>
+#include <vector>
+#include <cstddef>
+
+// Allocator handing out memory aligned to Alignment bytes, e.g. for arrays that are loaded with SIMD instructions.
+template<class T, size_t Alignment>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    template<class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t count) {
+        return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *memory, size_t) {
+        ::operator delete(memory, std::align_val_t(Alignment));
+    }
+
+    template<class U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template<class U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+// 32 byte alignment, so whole AVX registers can be loaded from the start of the array.
+template<class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, 32>>;
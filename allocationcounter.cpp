@@ -0,0 +1,29 @@
+#include "allocationcounter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    thread_local uint64_t allocations = 0;
+}
+
+uint64_t allocationcounter::threadAllocations() {
+    return allocations;
+}
+
+// The array and nothrow versions forward to these.
+void *operator new(std::size_t size) {
+    allocations++;
+    if (auto memory = std::malloc(size > 0 ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts heap allocations by replacing the global operator new, so tests can prove that a code path does not allocate.
+namespace allocationcounter {
+    // Heap allocations made by the calling thread since it started.
+    uint64_t threadAllocations();
+}
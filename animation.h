@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "transform.h"
+
+struct Keyframe {
+public:
+    // Seconds.
+    float time = 0.0f;
+    Transform transform = {};
+};
+
+// Where an object is over time. Linear between keyframes, held before the first and after the last one.
+class Animation {
+    std::vector<Keyframe> _keyframes = {};
+
+public:
+    Animation() = default;
+    // Sorted by time, at least one.
+    explicit Animation(std::vector<Keyframe> keyframes)
+        : _keyframes(std::move(keyframes)) {}
+
+    Transform at(float time) const {
+        auto next = std::upper_bound(_keyframes.begin(), _keyframes.end(), time,
+            [](float time, const Keyframe &keyframe) { return time < keyframe.time; });
+        if (next == _keyframes.begin()) {
+            return next->transform;
+        }
+        if (next == _keyframes.end()) {
+            return _keyframes.back().transform;
+        }
+        auto previous = next - 1;
+        auto t = (time - previous->time) / (next->time - previous->time);
+        return Transform::interpolate(previous->transform, next->transform, t);
+    }
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+// Read-only view of a contiguous array someone else owns, a vector or a mapped file.
+template<class T>
+class ArrayView {
+    const T *_data = nullptr;
+    size_t _size = 0;
+
+public:
+    ArrayView() = default;
+    ArrayView(const T *data, size_t size)
+        : _data(data), _size(size) {}
+    template<class Container>
+    ArrayView(const Container &container)
+        : _data(container.data()), _size(container.size()) {}
+
+    const T &operator[](size_t i) const { return _data[i]; }
+    const T *data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    const T *begin() const { return _data; }
+    const T *end() const { return _data + _size; }
+};
@@ -0,0 +1,426 @@
+// Micro and end-to-end benchmarks. Prints a table and writes the results as JSON, so runs of
+// different versions can be compared by a script.
+//
+//   PathTracerBenchmark [--output <path.json>] [--quick] [--filter <text>] [--threads <n>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+
+#include "scene.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "renderer.h"
+#include "framebuffer.h"
+#include "tilescheduler.h"
+#include "options.h"
+#include "pcg32.h"
+#include "vec3.h"
+
+namespace {
+    // Results go here, so the compiler cannot drop the work that produced them.
+    volatile float sink = 0.0f;
+
+    const int INPUT_COUNT = 1024;
+    const int REPETITIONS = 5;
+    // Every benchmark uses the same inputs in every run.
+    const uint64_t SEED = 1;
+
+    struct BenchmarkOptions {
+    public:
+        std::string outputPath = "benchmark.json";
+        std::string filter = {};
+        bool quick = false;
+        int threads = 0;
+    };
+
+    struct MicroResult {
+    public:
+        std::string name = {};
+        double nanosecondsPerOperation = 0.0;
+        uint64_t operations = 0;
+    };
+
+    struct RenderResult {
+    public:
+        std::string name = {};
+        int width = 0;
+        int height = 0;
+        int samplesPerPixel = 0;
+        // Differ from samplesPerPixel and the pixel count only with adaptive sampling.
+        double averageSamples = 0.0;
+        size_t activePixels = 0;
+        double seconds = 0.0;
+        long long rays = 0;
+        // Mean radiance of the image. Renders are deterministic, so a change means the image changed.
+        double meanRadiance = 0.0;
+    };
+
+    double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Runs batch() (which does operationsPerBatch operations) often enough to take minSeconds,
+    // REPETITIONS times, and reports the median.
+    MicroResult measure(const std::string &name, uint64_t operationsPerBatch, double minSeconds, const std::function<void()> &batch) {
+        // Find a batch count that takes long enough to time reliably.
+        uint64_t batches = 1;
+        while (true) {
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < batches; i++) {
+                batch();
+            }
+            if (secondsSince(start) >= minSeconds / REPETITIONS || batches >= (1ull << 30)) {
+                break;
+            }
+            batches *= 2;
+        }
+
+        auto timings = std::vector<double>();
+        for (auto repetition = 0; repetition < REPETITIONS; repetition++) {
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < batches; i++) {
+                batch();
+            }
+            timings.push_back(secondsSince(start));
+        }
+        std::sort(timings.begin(), timings.end());
+
+        auto result = MicroResult();
+        result.name = name;
+        result.operations = batches * operationsPerBatch;
+        result.nanosecondsPerOperation = timings[timings.size() / 2] * 1e9 / double(result.operations);
+        return result;
+    }
+
+    std::vector<Vec3> randomDirections(Pcg32 &random) {
+        auto directions = std::vector<Vec3>();
+        for (auto i = 0; i < INPUT_COUNT; i++) {
+            auto direction = Vec3(random.nextFloat() * 2.0f - 1.0f, random.nextFloat() * 2.0f - 1.0f, random.nextFloat() * 2.0f - 1.0f);
+            directions.push_back(direction.normalize());
+        }
+        return directions;
+    }
+
+    // Rays from the camera through the image plane, roughly what the renderer shoots first.
+    std::vector<Ray> cameraRays(const Scene &scene, Pcg32 &random) {
+        auto rays = std::vector<Ray>();
+        for (auto i = 0; i < INPUT_COUNT; i++) {
+            auto x = random.nextFloat() - 0.5f;
+            auto y = random.nextFloat() - 0.5f;
+            rays.push_back(Ray(scene.camera().origin(), Vec3(x, y, 1.0f)));
+        }
+        return rays;
+    }
+
+    std::vector<MicroResult> runMicroBenchmarks(const BenchmarkOptions &options) {
+        auto minSeconds = options.quick ? 0.05 : 0.5;
+        auto results = std::vector<MicroResult>();
+        auto run = [&](const std::string &name, uint64_t operationsPerBatch, const std::function<void()> &batch) {
+            if (name.find(options.filter) == std::string::npos) {
+                return;
+            }
+            results.push_back(measure(name, operationsPerBatch, minSeconds, batch));
+            fmt::print("{:<40} {:>10.2f} ns/op\n", name, results.back().nanosecondsPerOperation);
+        };
+
+        auto random = Pcg32(SEED);
+
+        // About half of the rays hit.
+        auto sphere = Sphere(Vec3(0.0f, 0.0f, 50.0f), 20.0f, Material::red());
+        auto sphereRays = std::vector<Ray>();
+        for (auto i = 0; i < INPUT_COUNT; i++) {
+            auto target = Vec3(random.nextFloat() * 80.0f - 40.0f, random.nextFloat() * 80.0f - 40.0f, 50.0f);
+            sphereRays.push_back(Ray(Vec3(0.0f, 0.0f, 0.0f), target));
+        }
+        run("Sphere::intersect", INPUT_COUNT, [&]() {
+            auto hits = 0.0f;
+            for (const auto &ray : sphereRays) {
+                auto intersection = sphere.intersect(ray, std::numeric_limits<float>::infinity());
+                hits += intersection ? intersection->distance() : 0.0f;
+            }
+            sink = sink + hits;
+        });
+
+        auto triangle = Triangle(Vec3(-20.0f, -20.0f, 50.0f), Vec3(20.0f, -20.0f, 50.0f), Vec3(0.0f, 20.0f, 50.0f), Material::red());
+        run("Triangle::intersect", INPUT_COUNT, [&]() {
+            auto hits = 0.0f;
+            for (const auto &ray : sphereRays) {
+                auto intersection = triangle.intersect(ray, std::numeric_limits<float>::infinity());
+                hits += intersection ? intersection->distance() : 0.0f;
+            }
+            sink = sink + hits;
+        });
+
+        // The same arithmetic on both vector types: a cross product, a dot product and a normalization.
+        auto simdVectors = randomDirections(random);
+        auto scalarVectors = std::vector<Vec3T<float>>();
+        for (const auto &vector : simdVectors) {
+            scalarVectors.push_back(Vec3T<float>(vector.x, vector.y, vector.z));
+        }
+        run("Vec3T<float> cross+dot+normalize", INPUT_COUNT, [&]() {
+            auto sum = 0.0f;
+            for (size_t i = 0; i + 1 < scalarVectors.size(); i++) {
+                auto cross = scalarVectors[i].cross(scalarVectors[i + 1]) + scalarVectors[i];
+                sum += cross.normalize().dot(scalarVectors[i + 1]);
+            }
+            sink = sink + sum;
+        });
+        run("SimdVector3 cross+dot+normalize", INPUT_COUNT, [&]() {
+            auto sum = 0.0f;
+            for (size_t i = 0; i + 1 < simdVectors.size(); i++) {
+                auto cross = simdVectors[i].cross(simdVectors[i + 1]) + simdVectors[i];
+                sum += cross.normalize().dot(simdVectors[i + 1]);
+            }
+            sink = sink + sum;
+        });
+
+        auto uniforms = std::vector<float>();
+        for (auto i = 0; i < 2 * INPUT_COUNT; i++) {
+            uniforms.push_back(random.nextFloat());
+        }
+        run("createCosineWeightedVectorInHemisphere", INPUT_COUNT, [&]() {
+            auto sum = 0.0f;
+            for (auto i = 0; i < INPUT_COUNT; i++) {
+                auto direction = vectorutils::createCosineWeightedVectorInHemisphere(simdVectors[i],
+                    uniforms[2 * i], uniforms[2 * i + 1]);
+                sum += direction.x;
+            }
+            sink = sink + sum;
+        });
+
+        for (auto type : { SceneType::CornellBox, SceneType::HighPolygon }) {
+            auto sceneName = type == SceneType::CornellBox ? std::string("cornell") : std::string("highpoly");
+            auto intersectionName = "Scene::firstIntersection " + sceneName;
+            auto hitsLightName = "Scene::hitsLight " + sceneName;
+            // Building the high polygon scene takes a while, skip it if nothing would use it.
+            if (intersectionName.find(options.filter) == std::string::npos && hitsLightName.find(options.filter) == std::string::npos) {
+                continue;
+            }
+
+            auto scene = Scene();
+            scene.initialize(type);
+            auto rays = cameraRays(scene, random);
+            run(intersectionName, INPUT_COUNT, [&]() {
+                auto sum = 0.0f;
+                for (const auto &ray : rays) {
+                    auto intersection = scene.firstIntersection(ray);
+                    sum += intersection ? intersection->distance() : 0.0f;
+                }
+                sink = sink + sum;
+            });
+
+            // Rays from the first hits towards the light, like the shadow rays of direct lighting.
+            auto lightRays = std::vector<Ray>();
+            for (const auto &ray : rays) {
+                auto intersection = scene.firstIntersection(ray);
+                if (intersection) {
+                    auto origin = intersection->position() + intersection->surfaceNormal() * 0.5f;
+                    lightRays.push_back(Ray(origin, scene.light() - origin));
+                }
+            }
+            run(hitsLightName, lightRays.size(), [&]() {
+                auto count = 0;
+                for (const auto &ray : lightRays) {
+                    count += scene.hitsLight(ray);
+                }
+                sink = sink + float(count);
+            });
+        }
+        return results;
+    }
+
+    std::vector<RenderResult> runRenderBenchmarks(const BenchmarkOptions &options) {
+        struct RenderCase {
+            const char *name;
+            SceneType sceneType;
+            Engine engine;
+            // 0 for uniform sampling.
+            float adaptiveThreshold;
+            // Per pixel on average, 0 for the default of the run.
+            int samplesPerPixel;
+        };
+        const RenderCase cases[] = {
+            { "render cornell recursive", SceneType::CornellBox, Engine::Recursive, 0.0f, 0 },
+            { "render cornell wavefront", SceneType::CornellBox, Engine::Wavefront, 0.0f, 0 },
+            // Pixels are only masked after a few passes and only converge with enough samples, a smaller
+            // budget would be used up before adaptive sampling does anything.
+            { "render cornell adaptive", SceneType::CornellBox, Engine::Recursive, 0.2f, 128 },
+            { "render highpoly recursive", SceneType::HighPolygon, Engine::Recursive, 0.0f, 0 },
+            { "render highpoly wavefront", SceneType::HighPolygon, Engine::Wavefront, 0.0f, 0 },
+        };
+
+        auto results = std::vector<RenderResult>();
+        for (const auto &renderCase : cases) {
+            if (std::string(renderCase.name).find(options.filter) == std::string::npos) {
+                continue;
+            }
+
+            auto renderOptions = RenderOptions();
+            renderOptions.width = options.quick ? 64 : 256;
+            renderOptions.height = renderOptions.width;
+            renderOptions.samplesPerPixel = renderCase.samplesPerPixel > 0 ? renderCase.samplesPerPixel : options.quick ? 4 : 16;
+            // Adaptive sampling decides between passes, uniform sampling does best in one.
+            renderOptions.samplesPerPass = renderCase.adaptiveThreshold > 0.0f ? 4 : renderOptions.samplesPerPixel;
+            renderOptions.adaptiveThreshold = renderCase.adaptiveThreshold;
+            renderOptions.threads = options.threads;
+            renderOptions.seed = int(SEED);
+            renderOptions.sceneType = renderCase.sceneType;
+            renderOptions.engine = renderCase.engine;
+
+            auto scene = Scene();
+            scene.initialize(renderOptions.sceneType);
+            auto framebuffer = Framebuffer(renderOptions.width, renderOptions.height);
+            TileScheduler scheduler(renderOptions.threads);
+
+            auto render = ProgressiveRender(renderOptions, scene, scheduler, framebuffer);
+            while (render.update([](const Tile &) {})) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            auto result = RenderResult();
+            result.name = renderCase.name;
+            result.width = renderOptions.width;
+            result.height = renderOptions.height;
+            result.samplesPerPixel = render.samplesDone();
+            result.averageSamples = render.averageSamples();
+            result.activePixels = render.activePixelCount();
+            result.seconds = render.secondsElapsed();
+            result.rays = (long long)render.stats().totalRays();
+            for (auto y = 0; y < framebuffer.height(); y++) {
+                for (auto x = 0; x < framebuffer.width(); x++) {
+                    auto average = framebuffer.average(x, y);
+                    result.meanRadiance += (average[0] + average[1] + average[2]) / 3.0;
+                }
+            }
+            result.meanRadiance /= double(framebuffer.width()) * framebuffer.height();
+            results.push_back(result);
+
+            fmt::print("{:<40} {:>10.3f} MRays/s, {:.3f} s, {:.1f} samples per pixel, {} pixels still active, mean radiance {:.6f}\n",
+                result.name, result.rays / result.seconds / 1'000'000.0, result.seconds, result.averageSamples,
+                result.activePixels, result.meanRadiance);
+        }
+        return results;
+    }
+
+    std::string compilerName() {
+#if defined(__clang__)
+        return fmt::format("clang {}.{}.{}", __clang_major__, __clang_minor__, __clang_patchlevel__);
+#elif defined(__GNUC__)
+        return fmt::format("gcc {}.{}.{}", __GNUC__, __GNUC_MINOR__, __GNUC_PATCHLEVEL__);
+#elif defined(_MSC_VER)
+        return fmt::format("msvc {}", _MSC_VER);
+#else
+        return "unknown";
+#endif
+    }
+
+    // Names are plain ASCII, only quotes and backslashes need escaping.
+    std::string jsonString(const std::string &text) {
+        auto escaped = std::string("\"");
+        for (auto c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped + "\"";
+    }
+
+    bool writeJson(const std::string &path, const BenchmarkOptions &options,
+        const std::vector<MicroResult> &micro, const std::vector<RenderResult> &renders) {
+        auto json = std::string("{\n");
+        json += "  \"schemaVersion\": 1,\n";
+        json += fmt::format("  \"timestamp\": {},\n", (long long)std::time(nullptr));
+        json += fmt::format("  \"compiler\": {},\n", jsonString(compilerName()));
+        json += fmt::format("  \"hardwareThreads\": {},\n", std::thread::hardware_concurrency());
+        json += fmt::format("  \"quick\": {},\n", options.quick ? "true" : "false");
+
+        json += "  \"micro\": [\n";
+        for (size_t i = 0; i < micro.size(); i++) {
+            json += fmt::format("    {{ \"name\": {}, \"nsPerOperation\": {:.4f}, \"operations\": {} }}{}\n",
+                jsonString(micro[i].name), micro[i].nanosecondsPerOperation, micro[i].operations, i + 1 < micro.size() ? "," : "");
+        }
+        json += "  ],\n";
+
+        json += "  \"render\": [\n";
+        for (size_t i = 0; i < renders.size(); i++) {
+            const auto &render = renders[i];
+            json += fmt::format(
+                "    {{ \"name\": {}, \"width\": {}, \"height\": {}, \"samplesPerPixel\": {}, \"averageSamples\": {:.4f}, "
+                "\"activePixels\": {}, \"seconds\": {:.4f}, \"rays\": {}, \"mraysPerSecond\": {:.4f}, \"meanRadiance\": {:.6f} }}{}\n",
+                jsonString(render.name), render.width, render.height, render.samplesPerPixel, render.averageSamples,
+                render.activePixels, render.seconds,
+                render.rays, render.rays / render.seconds / 1'000'000.0, render.meanRadiance, i + 1 < renders.size() ? "," : "");
+        }
+        json += "  ]\n}\n";
+
+        auto file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            fmt::print(stderr, "Could not open {} for writing\n", path);
+            return false;
+        }
+        auto ok = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok) {
+            fmt::print(stderr, "Could not write {}\n", path);
+        }
+        return ok;
+    }
+
+    std::optional<BenchmarkOptions> parseOptions(int argc, char **argv) {
+        auto options = BenchmarkOptions();
+        for (auto i = 1; i < argc; i++) {
+            auto argument = std::string(argv[i]);
+            auto hasValue = i + 1 < argc;
+            if (argument == "--quick") {
+                options.quick = true;
+            }
+            else if (argument == "--output" && hasValue) {
+                options.outputPath = argv[++i];
+            }
+            else if (argument == "--filter" && hasValue) {
+                options.filter = argv[++i];
+            }
+            else if (argument == "--threads" && hasValue) {
+                options.threads = std::max(0, std::atoi(argv[++i]));
+            }
+            else {
+                fmt::print(
+                    "Usage: {} [options]\n"
+                    "  --output <path>  Where to write the JSON results (default benchmark.json)\n"
+                    "  --quick          Shorter runs and smaller renders, for a smoke test\n"
+                    "  --filter <text>  Only run benchmarks whose name contains text\n"
+                    "  --threads <n>    Render threads, 0 for all cores (default 0)\n",
+                    argv[0]
+                );
+                return std::optional<BenchmarkOptions>();
+            }
+        }
+        return options;
+    }
+}
+
+int main(int argc, char **argv) {
+    auto options = parseOptions(argc, argv);
+    if (!options) {
+        return EXIT_FAILURE;
+    }
+
+    auto micro = runMicroBenchmarks(*options);
+    auto renders = runRenderBenchmarks(*options);
+    if (!writeJson(options->outputPath, *options, micro, renders)) {
+        return EXIT_FAILURE;
+    }
+    fmt::print("Wrote {}\n", options->outputPath);
+    return EXIT_SUCCESS;
+}
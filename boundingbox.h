@@ -0,0 +1,57 @@
+#pragma once
+
+#include <limits>
+#include <algorithm>
+
+#include "vec3.h"
+
+class BoundingBox {
+    Vec3 _min = Vec3(
+        std::numeric_limits<float>::infinity(),
+        std::numeric_limits<float>::infinity(),
+        std::numeric_limits<float>::infinity()
+    );
+    Vec3 _max = Vec3(
+        -std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity()
+    );
+
+public:
+    // A default constructed box is empty, expanding it by anything yields the other thing.
+    BoundingBox() = default;
+    BoundingBox(Vec3 min, Vec3 max)
+        : _min(min), _max(max) {}
+
+    Vec3 min() const { return _min; }
+    Vec3 max() const { return _max; }
+
+    bool empty() const {
+        return _min.x > _max.x || _min.y > _max.y || _min.z > _max.z;
+    }
+
+    BoundingBox expand(const BoundingBox &other) const {
+        return BoundingBox(
+            _mm_min_ps(_min.mmvalue, other._min.mmvalue),
+            _mm_max_ps(_max.mmvalue, other._max.mmvalue)
+        );
+    }
+
+    BoundingBox expand(Vec3 point) const {
+        return BoundingBox(
+            _mm_min_ps(_min.mmvalue, point.mmvalue),
+            _mm_max_ps(_max.mmvalue, point.mmvalue)
+        );
+    }
+
+    Vec3 centroid() const { return (_min + _max) * 0.5f; }
+    Vec3 extent() const { return _max - _min; }
+
+    float surfaceArea() const {
+        if (empty()) {
+            return 0.0f;
+        }
+        auto e = extent();
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
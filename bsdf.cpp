@@ -0,0 +1,96 @@
+#include "bsdf.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "renderer.h"
+
+namespace {
+    // Rougher than this would make the Phong exponent drop below 1.
+    const float MIN_ROUGHNESS = 0.02f;
+
+    // Around axis with density (exponent + 1) / (2 pi) * cos^exponent of the angle to it.
+    Vec3 createPhongVector(Vec3 axis, float exponent, float u1, float u2) {
+        auto tangent = Vec3();
+        auto bitangent = Vec3();
+        vectorutils::createOrthonormalBasis(axis, tangent, bitangent);
+
+        auto cosAlpha = std::pow(u1, 1.0f / (exponent + 1.0f));
+        auto sinAlpha = std::sqrt(std::max(0.0f, 1.0f - cosAlpha * cosAlpha));
+        auto phi = 2.0f * vectorutils::PI * u2;
+        return (tangent * (sinAlpha * std::cos(phi)) + bitangent * (sinAlpha * std::sin(phi)) + axis * cosAlpha).normalize();
+    }
+}
+
+Bsdf::Bsdf(const Material &material, Vec3 normal)
+    : _normal(normal) {
+    auto reflection = std::clamp(material.reflectionPercent().value_or(0.0f), 0.0f, 1.0f);
+    _diffuse = material.color() * ((1.0f - reflection) * renderconstants::BOUNCE_ATTENUATION);
+    _specular = reflection * renderconstants::BOUNCE_ATTENUATION;
+    _specularProbability = reflection;
+
+    auto roughness = material.roughness();
+    if (roughness > 0.0f) {
+        // The Phong exponent with about the lobe width of a Beckmann distribution of that roughness (Walter et al. 2007).
+        roughness = std::clamp(roughness, MIN_ROUGHNESS, 1.0f);
+        _exponent = std::max(2.0f / (roughness * roughness) - 2.0f, 1.0f);
+    }
+}
+
+Radiance Bsdf::evaluate(Vec3 outgoing, Vec3 incoming) const {
+    auto cosine = _normal.dot(incoming);
+    if (cosine <= 0.0f) {
+        return Radiance();
+    }
+
+    auto value = _diffuse * (cosine / vectorutils::PI);
+    if (_exponent > 0.0f && _specular > 0.0f) {
+        auto cosAlpha = std::max(mirror(outgoing).dot(incoming), 0.0f);
+        auto glossy = _specular * (_exponent + 2.0f) / (2.0f * vectorutils::PI) * std::pow(cosAlpha, _exponent);
+        value += Radiance(1.0f, 1.0f, 1.0f) * (glossy * cosine);
+    }
+    return value;
+}
+
+float Bsdf::pdf(Vec3 outgoing, Vec3 incoming) const {
+    auto cosine = _normal.dot(incoming);
+    if (cosine <= 0.0f) {
+        return 0.0f;
+    }
+
+    auto pdf = (1.0f - _specularProbability) * cosine / vectorutils::PI;
+    if (_exponent > 0.0f) {
+        auto cosAlpha = std::max(mirror(outgoing).dot(incoming), 0.0f);
+        pdf += _specularProbability * (_exponent + 1.0f) / (2.0f * vectorutils::PI) * std::pow(cosAlpha, _exponent);
+    }
+    return pdf;
+}
+
+std::optional<BsdfSample> Bsdf::sample(Vec3 outgoing, Sampler &sampler) const {
+    auto lobe = sampler.next1D();
+    auto [u1, u2] = sampler.next2D();
+
+    auto result = BsdfSample();
+    if (lobe < _specularProbability) {
+        if (_exponent == 0.0f) {
+            result.direction = mirror(outgoing);
+            if (_normal.dot(result.direction) <= 0.0f) {
+                return std::optional<BsdfSample>();
+            }
+            result.weight = Radiance(1.0f, 1.0f, 1.0f) * (_specular / _specularProbability);
+            return result;
+        }
+        result.direction = createPhongVector(mirror(outgoing), _exponent, u1, u2);
+    }
+    else {
+        result.direction = vectorutils::createCosineWeightedVectorInHemisphere(_normal, u1, u2);
+    }
+
+    // Weighted by both lobes, as if either could have picked the direction, which they could.
+    result.pdf = pdf(outgoing, result.direction);
+    if (result.pdf <= 0.0f) {
+        return std::optional<BsdfSample>();
+    }
+    result.weight = evaluate(outgoing, result.direction) / result.pdf;
+    return result;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <optional>
+
+#include "vec3.h"
+#include "material.h"
+#include "sampler.h"
+
+// A direction picked by Bsdf::sample.
+struct BsdfSample {
+public:
+    Vec3 direction = {};
+    // BSDF times the cosine over the density, what the throughput of the path gets multiplied by.
+    Radiance weight = {};
+    // Density per solid angle. 0 for the perfect mirror, which no other technique can pick, so light
+    // found through it needs no MIS weight.
+    float pdf = 0.0f;
+};
+
+// How light scatters at one surface point, made from its material. A mix of two lobes:
+//  - diffuse (Lambertian) with the material color,
+//  - specular with the reflection percent of the material, a perfect mirror at roughness 0 and a
+//    glossy, normalized Phong lobe around the mirror direction otherwise.
+// Both get the bounce attenuation of the renderer on top. Directions point away from the surface.
+class Bsdf {
+    Vec3 _normal = {};
+    Radiance _diffuse = {};
+    float _specular = 0.0f;
+    // The reflection percent, lobes are sampled in proportion to their share.
+    float _specularProbability = 0.0f;
+    // Phong exponent of the glossy lobe, 0 for the perfect mirror.
+    float _exponent = 0.0f;
+
+public:
+    // normal is the unit normal on the side the light comes from.
+    Bsdf(const Material &material, Vec3 normal);
+
+    // Fraction of light reflected in all directions together, for light coming in along the normal.
+    Radiance albedo() const { return _diffuse + Radiance(1.0f, 1.0f, 1.0f) * _specular; }
+    // False for the perfect mirror, the only surface lights cannot be sampled for.
+    bool hasSmoothLobe() const { return _specularProbability < 1.0f || _exponent > 0.0f; }
+
+    // BSDF times the cosine of incoming, without the perfect mirror.
+    Radiance evaluate(Vec3 outgoing, Vec3 incoming) const;
+    // Density of sample() picking incoming, without the perfect mirror.
+    float pdf(Vec3 outgoing, Vec3 incoming) const;
+    // Picks a lobe and a direction from it. Takes a 1D and a 2D sample. Nothing if the direction
+    // ends up below the surface, the path ends there.
+    std::optional<BsdfSample> sample(Vec3 outgoing, Sampler &sampler) const;
+
+private:
+    Vec3 mirror(Vec3 outgoing) const { return _normal * (2.0f * _normal.dot(outgoing)) - outgoing; }
+};
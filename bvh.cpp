@@ -0,0 +1,327 @@
+#include "bvh.h"
+
+#include <array>
+#include <functional>
+#include <limits>
+
+namespace {
+    const int SAH_BINS = 12;
+    const uint32_t MAX_LEAF_SIZE = 4;
+    // What BvhNode::count holds, bigger leaves have to be split whatever the cost.
+    const uint32_t MAX_LEAF_COUNT = std::numeric_limits<uint16_t>::max();
+    // Cost of visiting an inner node, relative to one primitive intersection.
+    const float TRAVERSAL_COST = 1.0f;
+
+    struct BuildContext {
+    public:
+        const std::vector<BoundingBox> &bounds;
+        const std::vector<uint16_t> &types;
+        std::vector<Vec3> centroids;
+        std::vector<BvhNode> &nodes;
+        std::vector<uint32_t> &indices;
+    };
+
+    struct Bin {
+    public:
+        BoundingBox bounds = {};
+        uint32_t count = 0;
+    };
+
+    void setNodeBounds(BvhNode &node, const BoundingBox &box) {
+        node.boundsMin[0] = box.min().x;
+        node.boundsMin[1] = box.min().y;
+        node.boundsMin[2] = box.min().z;
+        node.boundsMax[0] = box.max().x;
+        node.boundsMax[1] = box.max().y;
+        node.boundsMax[2] = box.max().z;
+    }
+
+    double nodeCost(const BvhNode &node) {
+        auto area = BoundingBox(Vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]),
+            Vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2])).surfaceArea();
+        return double(area) * (node.isLeaf() ? float(node.count) : TRAVERSAL_COST);
+    }
+
+    int binIndex(float centroid, float low, float scale) {
+        auto index = int((centroid - low) * scale);
+        return std::clamp(index, 0, SAH_BINS - 1);
+    }
+
+    // Halvings it takes until count primitives fit into a leaf.
+    int halvingsToFit(uint32_t count) {
+        auto halvings = 0;
+        for (; count > MAX_LEAF_COUNT; count -= count / 2) {
+            halvings++;
+        }
+        return halvings;
+    }
+
+    void subdivide(BuildContext &context, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth);
+
+    void splitAt(BuildContext &context, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t leftCount, int depth) {
+        auto leftIndex = uint32_t(context.nodes.size());
+        context.nodes.emplace_back();
+        context.nodes.emplace_back();
+        context.nodes[nodeIndex].leftFirst = leftIndex;
+        context.nodes[nodeIndex].count = 0;
+
+        subdivide(context, leftIndex, first, leftCount, depth + 1);
+        subdivide(context, leftIndex + 1, first + leftCount, count - leftCount, depth + 1);
+    }
+
+    // Leaves must not mix primitive types, mixed ones get one more level that separates them.
+    void makeLeaf(BuildContext &context, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth) {
+        auto begin = context.indices.begin() + first;
+        auto end = begin + count;
+        auto type = context.types.empty() ? uint16_t(0) : context.types[*begin];
+
+        if (!context.types.empty()) {
+            auto middle = std::partition(begin, end, [&](uint32_t index) { return context.types[index] == type; });
+            if (middle != end) {
+                splitAt(context, nodeIndex, first, count, uint32_t(middle - begin), depth);
+                return;
+            }
+        }
+
+        context.nodes[nodeIndex].leftFirst = first;
+        context.nodes[nodeIndex].count = uint16_t(count);
+        context.nodes[nodeIndex].primitiveType = type;
+    }
+
+    void subdivide(BuildContext &context, uint32_t nodeIndex, uint32_t first, uint32_t count, int depth) {
+        auto nodeBounds = BoundingBox();
+        auto centroidBounds = BoundingBox();
+        for (auto i = first; i < first + count; i++) {
+            auto index = context.indices[i];
+            nodeBounds = nodeBounds.expand(context.bounds[index]);
+            centroidBounds = centroidBounds.expand(context.centroids[index]);
+        }
+
+        setNodeBounds(context.nodes[nodeIndex], nodeBounds);
+
+        // Keep a few levels in reserve for separating primitive types, and enough to halve what is
+        // left into leaves that can count their primitives.
+        if (count == 1 || depth + 4 + halvingsToFit(count) >= Bvh::MAX_DEPTH) {
+            if (count > MAX_LEAF_COUNT) {
+                splitAt(context, nodeIndex, first, count, count / 2, depth);
+            }
+            else {
+                makeLeaf(context, nodeIndex, first, count, depth);
+            }
+            return;
+        }
+
+        // Find the cheapest split plane over all axes.
+        auto bestAxis = -1;
+        auto bestSplit = 0;
+        auto bestCost = std::numeric_limits<float>::infinity();
+        for (auto axis = 0; axis < 3; axis++) {
+            auto low = centroidBounds.min()[axis];
+            auto high = centroidBounds.max()[axis];
+            if (high <= low) {
+                continue;
+            }
+
+            auto scale = SAH_BINS / (high - low);
+            std::array<Bin, SAH_BINS> bins = {};
+            for (auto i = first; i < first + count; i++) {
+                auto index = context.indices[i];
+                auto &bin = bins[binIndex(context.centroids[index][axis], low, scale)];
+                bin.bounds = bin.bounds.expand(context.bounds[index]);
+                bin.count++;
+            }
+
+            // Sweep from the right to get the cost of every right side, then from the left.
+            std::array<float, SAH_BINS - 1> rightCosts = {};
+            auto rightBounds = BoundingBox();
+            uint32_t rightCount = 0;
+            for (auto split = SAH_BINS - 1; split > 0; split--) {
+                rightBounds = rightBounds.expand(bins[split].bounds);
+                rightCount += bins[split].count;
+                rightCosts[split - 1] = rightCount * rightBounds.surfaceArea();
+            }
+
+            auto leftBounds = BoundingBox();
+            uint32_t leftCount = 0;
+            for (auto split = 0; split < SAH_BINS - 1; split++) {
+                leftBounds = leftBounds.expand(bins[split].bounds);
+                leftCount += bins[split].count;
+                auto cost = leftCount * leftBounds.surfaceArea() + rightCosts[split];
+                if (leftCount > 0 && leftCount < count && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        if (bestAxis < 0) {
+            // All centroids are in the same spot, there is no good plane. Just halve big ones.
+            if (count > MAX_LEAF_SIZE) {
+                splitAt(context, nodeIndex, first, count, count / 2, depth);
+            }
+            else {
+                makeLeaf(context, nodeIndex, first, count, depth);
+            }
+            return;
+        }
+
+        auto splitCost = TRAVERSAL_COST + bestCost / nodeBounds.surfaceArea();
+        auto leafCost = float(count);
+        if (count <= MAX_LEAF_SIZE && splitCost >= leafCost) {
+            makeLeaf(context, nodeIndex, first, count, depth);
+            return;
+        }
+
+        auto low = centroidBounds.min()[bestAxis];
+        auto scale = SAH_BINS / (centroidBounds.max()[bestAxis] - low);
+        auto middle = std::partition(
+            context.indices.begin() + first,
+            context.indices.begin() + first + count,
+            [&](uint32_t index) {
+                return binIndex(context.centroids[index][bestAxis], low, scale) <= bestSplit;
+            }
+        );
+        auto leftCount = uint32_t(middle - (context.indices.begin() + first));
+        splitAt(context, nodeIndex, first, count, leftCount, depth);
+    }
+}
+
+void Bvh::build(const std::vector<BoundingBox> &primitiveBounds, const std::vector<uint16_t> &primitiveTypes) {
+    assert(primitiveTypes.empty() || primitiveTypes.size() == primitiveBounds.size());
+
+    _nodes.clear();
+    _nodeView = {};
+    _primitiveIndices.clear();
+    _typeOffsets.clear();
+    _parents.clear();
+    _cost = 0.0;
+    _builtCost = 0.0;
+
+    uint16_t typeCount = 1;
+    for (auto type : primitiveTypes) {
+        typeCount = std::max(typeCount, uint16_t(type + 1));
+    }
+    _typeOffsets.resize(typeCount);
+
+    if (primitiveBounds.empty()) {
+        return;
+    }
+
+    _primitiveIndices.resize(primitiveBounds.size());
+    for (uint32_t i = 0; i < _primitiveIndices.size(); i++) {
+        _primitiveIndices[i] = i;
+    }
+
+    auto context = BuildContext{ primitiveBounds, primitiveTypes, {}, _nodes, _primitiveIndices };
+    context.centroids.reserve(primitiveBounds.size());
+    for (const auto &bounds : primitiveBounds) {
+        context.centroids.push_back(bounds.centroid());
+    }
+
+    // A binary tree with n leaves has 2n - 1 nodes.
+    _nodes.reserve(2 * primitiveBounds.size());
+    _nodes.emplace_back();
+    subdivide(context, 0, 0, uint32_t(primitiveBounds.size()), 0);
+    _nodes.shrink_to_fit();
+
+    groupByType(typeCount);
+    _nodeView = _nodes;
+
+    for (const auto &node : _nodes) {
+        _cost += nodeCost(node);
+    }
+    _builtCost = _cost / std::max(double(boundsOf(_nodes[0]).surfaceArea()), 1e-12);
+}
+
+void Bvh::attach(ArrayView<BvhNode> nodes) {
+    _nodes = {};
+    _primitiveIndices = {};
+    _typeOffsets = {};
+    _parents = {};
+    _cost = 0.0;
+    _builtCost = 0.0;
+    _nodeView = nodes;
+}
+
+float Bvh::costGrowth() const {
+    if (_nodes.empty() || _builtCost <= 0.0) {
+        return 1.0f;
+    }
+    auto rootArea = std::max(double(boundsOf(_nodes[0]).surfaceArea()), 1e-12);
+    return float(_cost / rootArea / _builtCost);
+}
+
+void Bvh::collectRefitNodes(const std::vector<uint32_t> &leaves) {
+    if (_parents.size() != _nodes.size()) {
+        _parents.assign(_nodes.size(), 0);
+        _refitMarks.assign(_nodes.size(), 0);
+        for (uint32_t i = 0; i < _nodes.size(); i++) {
+            if (!_nodes[i].isLeaf()) {
+                _parents[_nodes[i].leftFirst] = i;
+                _parents[_nodes[i].leftFirst + 1] = i;
+            }
+        }
+    }
+
+    // Walks up from every leaf until it meets a path that was already taken.
+    _refitNodes.clear();
+    for (auto leaf : leaves) {
+        for (auto nodeIndex = leaf; !_refitMarks[nodeIndex]; nodeIndex = _parents[nodeIndex]) {
+            _refitMarks[nodeIndex] = 1;
+            _refitNodes.push_back(nodeIndex);
+            if (nodeIndex == 0) {
+                break;
+            }
+        }
+    }
+    for (auto nodeIndex : _refitNodes) {
+        _refitMarks[nodeIndex] = 0;
+    }
+
+    // Children are always stored after their parent.
+    std::sort(_refitNodes.begin(), _refitNodes.end(), std::greater<uint32_t>());
+}
+
+void Bvh::setBounds(uint32_t nodeIndex, const BoundingBox &bounds) {
+    auto &node = _nodes[nodeIndex];
+    _cost -= nodeCost(node);
+    setNodeBounds(node, bounds);
+    _cost += nodeCost(node);
+}
+
+void Bvh::groupByType(uint16_t typeCount) {
+    auto typeCounts = std::vector<uint32_t>(typeCount);
+    for (const auto &node : _nodes) {
+        if (node.isLeaf()) {
+            typeCounts[node.primitiveType] += node.count;
+        }
+    }
+
+    uint32_t offset = 0;
+    for (uint16_t type = 0; type < typeCount; type++) {
+        _typeOffsets[type] = offset;
+        offset += typeCounts[type];
+    }
+
+    // Depth first, so primitives of leaves that are close in the tree are close in memory.
+    auto cursors = _typeOffsets;
+    auto grouped = std::vector<uint32_t>(_primitiveIndices.size());
+    auto stack = std::vector<uint32_t>{ 0 };
+    while (!stack.empty()) {
+        auto &node = _nodes[stack.back()];
+        stack.pop_back();
+
+        if (!node.isLeaf()) {
+            stack.push_back(node.leftFirst + 1);
+            stack.push_back(node.leftFirst);
+            continue;
+        }
+
+        auto &cursor = cursors[node.primitiveType];
+        std::copy_n(_primitiveIndices.begin() + node.leftFirst, node.count, grouped.begin() + cursor);
+        node.leftFirst = cursor - _typeOffsets[node.primitiveType];
+        cursor += node.count;
+    }
+    _primitiveIndices = std::move(grouped);
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+#include "boundingbox.h"
+#include "arrayview.h"
+#include "ray.h"
+
+// 32 byte node, so two siblings share one cache line.
+struct BvhNode {
+public:
+    float boundsMin[3] = {};
+    // Index of the left child for inner nodes (the right one follows it),
+    // index of the first primitive for leaves, counted from the start of the leaf's primitive type.
+    uint32_t leftFirst = 0;
+    float boundsMax[3] = {};
+    // Number of primitives in a leaf, 0 for inner nodes.
+    uint16_t count = 0;
+    // All primitives of a leaf have the same type.
+    uint16_t primitiveType = 0;
+
+    bool isLeaf() const { return count > 0; }
+};
+
+class Bvh {
+    std::vector<BvhNode> _nodes = {};
+    // What traversal reads, _nodes or nodes owned by someone else, see attach().
+    ArrayView<BvhNode> _nodeView = {};
+    std::vector<uint32_t> _primitiveIndices = {};
+    std::vector<uint32_t> _typeOffsets = {};
+    // For refitting, the parent of every node is only worked out once it is needed.
+    std::vector<uint32_t> _parents = {};
+    std::vector<uint32_t> _refitNodes = {};
+    std::vector<uint8_t> _refitMarks = {};
+    // Sum over all nodes of their surface area times the cost of visiting them, and that over the area of
+    // the root right after the build.
+    double _cost = 0.0;
+    double _builtCost = 0.0;
+
+public:
+    static const int MAX_DEPTH = 64;
+
+    // Builds the hierarchy over the given primitive bounds using a binned surface area heuristic.
+    // primitiveTypes is either empty or holds a small integer per primitive; leaves never mix types then,
+    // so whoever intersects a leaf knows what it is looking at without asking every primitive.
+    void build(const std::vector<BoundingBox> &primitiveBounds, const std::vector<uint16_t> &primitiveTypes = {});
+
+    Bvh() = default;
+    // The node view would point into the other hierarchy. Moving keeps the nodes where they are.
+    Bvh(const Bvh &) = delete;
+    Bvh &operator=(const Bvh &) = delete;
+    Bvh(Bvh &&) = default;
+    Bvh &operator=(Bvh &&) = default;
+
+    // Traverses nodes stored elsewhere, like in a mapped scene cache, which have to outlive the Bvh.
+    // There are no primitive indices or type offsets then, leaves already refer to the final layout.
+    void attach(ArrayView<BvhNode> nodes);
+
+    size_t nodeCount() const { return _nodeView.size(); }
+    bool empty() const { return _nodeView.empty(); }
+    ArrayView<BvhNode> nodes() const { return _nodeView; }
+    // Of everything in the hierarchy, empty if there is nothing.
+    BoundingBox bounds() const { return _nodeView.empty() ? BoundingBox() : boundsOf(_nodeView[0]); }
+
+    // The primitives in leaf order, grouped by type. Leaves refer to
+    // primitiveIndices()[typeOffset(leaf.primitiveType) + leaf.leftFirst + i], so primitive data that is
+    // stored per type in this order can be indexed with leaf.leftFirst + i directly.
+    const std::vector<uint32_t> &primitiveIndices() const { return _primitiveIndices; }
+    uint32_t typeOffset(uint16_t primitiveType) const { return _typeOffsets[primitiveType]; }
+
+    // Walks all leaves the ray can reach closer than tMax, front to back.
+    // intersectLeaf(const BvhNode &leaf, float &tMax) may shrink tMax to cull farther nodes,
+    // and returns true to stop the traversal (e.g. for shadow rays).
+    // Returns true if the traversal was stopped.
+    template<class IntersectLeaf>
+    bool traverse(const Ray &ray, float tMax, IntersectLeaf &&intersectLeaf) const;
+
+    // Fits the nodes above the given leaves around their primitives again, after those moved.
+    // leafBounds(const BvhNode &leaf) returns the bounds of a leaf's primitives. Only the nodes on the way
+    // from these leaves to the root are touched, returns how many. Not for attached nodes.
+    template<class LeafBounds>
+    size_t refit(const std::vector<uint32_t> &leaves, LeafBounds &&leafBounds);
+    // Expected cost of tracing a ray by the surface area heuristic, relative to right after the build.
+    // Refitting drives it up when moving primitives stretch the boxes above them.
+    float costGrowth() const;
+
+private:
+    void groupByType(uint16_t typeCount);
+    // Fills _refitNodes with the leaves and all nodes above them, children before their parents.
+    void collectRefitNodes(const std::vector<uint32_t> &leaves);
+    void setBounds(uint32_t nodeIndex, const BoundingBox &bounds);
+
+    static BoundingBox boundsOf(const BvhNode &node) {
+        return BoundingBox(Vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]),
+            Vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]));
+    }
+
+    static bool intersectNode(const BvhNode &node, __m128 origin, __m128 inverseDirection, float tMax, float &tEntry) {
+        alignas(16) float t0[4];
+        alignas(16) float t1[4];
+        auto tLow = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMin), origin), inverseDirection);
+        auto tHigh = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.boundsMax), origin), inverseDirection);
+        _mm_store_ps(t0, _mm_min_ps(tLow, tHigh));
+        _mm_store_ps(t1, _mm_max_ps(tLow, tHigh));
+
+        // The fourth lane holds leftFirst/count and is ignored.
+        auto tNear = std::max(std::max(t0[0], t0[1]), std::max(t0[2], 0.0f));
+        auto tFar = std::min(std::min(t1[0], t1[1]), std::min(t1[2], tMax));
+        tEntry = tNear;
+        return tNear <= tFar;
+    }
+};
+
+template<class IntersectLeaf>
+bool Bvh::traverse(const Ray &ray, float tMax, IntersectLeaf &&intersectLeaf) const {
+    if (_nodeView.empty()) {
+        return false;
+    }
+
+    auto origin = ray.origin().mmvalue;
+    auto inverseDirection = _mm_div_ps(_mm_set1_ps(1.0f), ray.direction().mmvalue);
+
+    float tEntry = 0.0f;
+    if (!intersectNode(_nodeView[0], origin, inverseDirection, tMax, tEntry)) {
+        return false;
+    }
+
+    // Far children are pushed with their entry distance, so they can be skipped
+    // once a closer hit has been found.
+    uint32_t stack[MAX_DEPTH];
+    float stackEntry[MAX_DEPTH];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    while (true) {
+        const auto &node = _nodeView[nodeIndex];
+
+        if (node.isLeaf()) {
+            if (intersectLeaf(node, tMax)) {
+                return true;
+            }
+        }
+        else {
+            auto nearIndex = node.leftFirst;
+            auto farIndex = node.leftFirst + 1;
+            float tNear = 0.0f;
+            float tFar = 0.0f;
+            auto hitNear = intersectNode(_nodeView[nearIndex], origin, inverseDirection, tMax, tNear);
+            auto hitFar = intersectNode(_nodeView[farIndex], origin, inverseDirection, tMax, tFar);
+
+            if (hitNear && hitFar) {
+                if (tFar < tNear) {
+                    std::swap(nearIndex, farIndex);
+                }
+                assert(stackSize < MAX_DEPTH);
+                stack[stackSize] = farIndex;
+                stackEntry[stackSize] = std::max(tNear, tFar);
+                stackSize++;
+                nodeIndex = nearIndex;
+                continue;
+            }
+            if (hitNear || hitFar) {
+                nodeIndex = hitNear ? nearIndex : farIndex;
+                continue;
+            }
+        }
+
+        do {
+            if (stackSize == 0) {
+                return false;
+            }
+            stackSize--;
+        } while (stackEntry[stackSize] > tMax);
+        nodeIndex = stack[stackSize];
+    }
+}
+
+template<class LeafBounds>
+size_t Bvh::refit(const std::vector<uint32_t> &leaves, LeafBounds &&leafBounds) {
+    collectRefitNodes(leaves);
+    for (auto nodeIndex : _refitNodes) {
+        const auto &node = _nodes[nodeIndex];
+        auto bounds = node.isLeaf() ? leafBounds(node)
+            : boundsOf(_nodes[node.leftFirst]).expand(boundsOf(_nodes[node.leftFirst + 1]));
+        setBounds(nodeIndex, bounds);
+    }
+    return _refitNodes.size();
+}
@@ -0,0 +1,36 @@
+#include "camera.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // How far up or down turned() lets the camera look, in radians.
+    const float MAX_PITCH = 1.55f;
+}
+
+Camera::Camera(Vec3 position, Vec3 target, float fieldOfView, float aspect)
+    : _position(position), _target(target),
+      _fieldOfView(std::clamp(fieldOfView, MIN_FIELD_OF_VIEW, MAX_FIELD_OF_VIEW)), _aspect(aspect) {
+    auto forward = target - position;
+    _forward = forward.length() > 0.0f ? forward.normalize() : Vec3(0.0f, 0.0f, 1.0f);
+
+    // Looking straight up or down, the world's y axis cannot tell where up is in the image.
+    auto worldUp = std::abs(_forward.y) < 0.9999f ? Vec3(0.0f, 1.0f, 0.0f) : Vec3(0.0f, 0.0f, 1.0f);
+    _right = worldUp.cross(_forward).normalize();
+    _up = _forward.cross(_right);
+    _halfHeight = std::tan(_fieldOfView * vectorutils::PI / 360.0f);
+}
+
+Camera Camera::moved(float right, float up, float forward) const {
+    auto offset = _right * right + _up * up + _forward * forward;
+    return Camera(_position + offset, _target + offset, _fieldOfView, _aspect);
+}
+
+Camera Camera::turned(float yaw, float pitch) const {
+    // Azimuth from +z towards +x, which is to the right when looking along +z.
+    auto azimuth = std::atan2(_forward.x, _forward.z) + yaw;
+    auto elevation = std::clamp(std::asin(std::clamp(_forward.y, -1.0f, 1.0f)) + pitch, -MAX_PITCH, MAX_PITCH);
+    auto direction = Vec3(std::cos(elevation) * std::sin(azimuth), std::sin(elevation), std::cos(elevation) * std::cos(azimuth));
+    auto distance = std::max((_target - _position).length(), 1.0f);
+    return Camera(_position, _position + direction * distance, _fieldOfView, _aspect);
+}
@@ -2,16 +2,49 @@
 
 #include "vec3.h"
 
+// A pinhole camera at a position, looking at a target with the world's y axis up. The field of view is
+// vertical, the horizontal one follows from the aspect ratio (width over height) of the image.
 class Camera {
+public:
+    // Puts the image plane of a square image as far away as the image is wide.
+    static constexpr float DEFAULT_FIELD_OF_VIEW = 53.130102f;
+    static constexpr float MIN_FIELD_OF_VIEW = 5.0f;
+    static constexpr float MAX_FIELD_OF_VIEW = 150.0f;
+
+private:
     Vec3 _position = {};
-    Vec3 _direction = {};
+    Vec3 _target = Vec3(0.0f, 0.0f, 1.0f);
+    float _fieldOfView = DEFAULT_FIELD_OF_VIEW;
+    float _aspect = 1.0f;
+    // Worked out from the above once, every camera ray needs them.
+    Vec3 _forward = Vec3(0.0f, 0.0f, 1.0f);
+    Vec3 _right = Vec3(1.0f, 0.0f, 0.0f);
+    Vec3 _up = Vec3(0.0f, 1.0f, 0.0f);
+    float _halfHeight = 0.5f;
 
 public:
     Camera() = default;
-    Camera(Vec3 position, Vec3 direction)
-        : _position(position), _direction(direction) {}
+    // fieldOfView in degrees, clamped to [MIN_FIELD_OF_VIEW, MAX_FIELD_OF_VIEW]. A target on the position
+    // looks along +z.
+    Camera(Vec3 position, Vec3 target, float fieldOfView = DEFAULT_FIELD_OF_VIEW, float aspect = 1.0f);
 
     Vec3 origin() const { return _position; }
-    Vec3 direction() const { return _direction; }
-};
+    Vec3 target() const { return _target; }
+    // Unit length.
+    Vec3 direction() const { return _forward; }
+    float fieldOfView() const { return _fieldOfView; }
+    float aspect() const { return _aspect; }
 
+    // Through a point of the image, x from -1 on the left to 1 on the right, y from -1 at the bottom to 1
+    // at the top. Unit length.
+    Vec3 rayDirection(float x, float y) const {
+        return (_forward + _right * (x * _halfHeight * _aspect) + _up * (y * _halfHeight)).normalize();
+    }
+
+    // For navigating. Moved along its own right, up and forward directions, looking the same way.
+    Camera moved(float right, float up, float forward) const;
+    // Turned right by yaw about the world's y axis and up by pitch, in radians. Stops short of looking
+    // straight up or down.
+    Camera turned(float yaw, float pitch) const;
+    Camera withFieldOfView(float fieldOfView) const { return Camera(_position, _target, fieldOfView, _aspect); }
+};
@@ -0,0 +1,195 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+
+#include "scenecache.h"
+#include "renderer.h"
+
+namespace {
+    // Bump whenever the layout of the file changes.
+    const uint32_t VERSION = 2;
+    const char MAGIC[8] = { 'P', 'T', 'C', 'H', 'E', 'C', 'K', '\0' };
+
+    // Followed by a PixelRecord per pixel, the active pixels, the tile times and the pixel times,
+    // each with as many entries as the header says.
+    struct Header {
+    public:
+        char magic[8] = {};
+        uint32_t version = 0;
+        uint32_t headerSize = 0;
+        uint64_t renderHash = 0;
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t samplesDone = 0;
+        int32_t passesDone = 0;
+        uint64_t totalSamples = 0;
+        double secondsElapsed = 0.0;
+        uint64_t activePixelCount = 0;
+        uint64_t tileCount = 0;
+        uint64_t pixelSecondsCount = 0;
+        renderstats::Totals stats = {};
+    };
+
+    template<class T>
+    bool readArray(std::FILE *file, std::vector<T> &values, uint64_t count, uint64_t maxCount) {
+        if (count > maxCount) {
+            return false;
+        }
+        values.resize(size_t(count));
+        return count == 0 || std::fread(values.data(), sizeof(T), values.size(), file) == values.size();
+    }
+}
+
+uint64_t checkpoint::renderHash(const RenderOptions &options, const Scene &scene) {
+    auto hash = scenecache::SourceHash();
+    hash.add(VERSION).add(scene.sourceHash());
+    hash.add(options.width).add(options.height).add(options.samplesPerPixel).add(options.samplesPerPass);
+    hash.add(options.adaptiveThreshold).add(options.maxDepth).add(options.seed);
+    hash.add(uint32_t(options.samplerType)).add(uint32_t(options.engine));
+    auto camera = renderCamera(options, scene);
+    auto addVector = [&](Vec3 vector) { hash.add(vector.x).add(vector.y).add(vector.z); };
+    addVector(camera.origin());
+    addVector(camera.target());
+    hash.add(camera.fieldOfView());
+    hash.add(!options.heatmapPath.empty());
+    return hash.value();
+}
+
+std::optional<Checkpoint> checkpoint::load(const std::string &path, uint64_t renderHash) {
+    auto file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return std::optional<Checkpoint>();
+    }
+
+    auto header = Header();
+    auto checkpoint = Checkpoint();
+    auto ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+        std::memcmp(header.magic, MAGIC, sizeof(header.magic)) == 0 && header.version == VERSION &&
+        header.headerSize == sizeof(header) && header.renderHash == renderHash &&
+        header.width > 0 && header.height > 0 && header.samplesDone >= 0;
+    auto pixelCount = ok ? uint64_t(header.width) * uint64_t(header.height) : 0;
+    ok = ok && (header.activePixelCount == 0 || header.activePixelCount == pixelCount);
+    auto records = std::vector<PixelRecord>();
+    ok = ok && readArray(file, records, pixelCount, pixelCount) &&
+        readArray(file, checkpoint.activePixels, header.activePixelCount, pixelCount) &&
+        readArray(file, checkpoint.tileSeconds, header.tileCount, pixelCount) &&
+        readArray(file, checkpoint.pixelSeconds, header.pixelSecondsCount, pixelCount);
+    std::fclose(file);
+    if (!ok) {
+        fmt::print(stderr, "{} is damaged or of another render\n", path);
+        return std::optional<Checkpoint>();
+    }
+
+    checkpoint.renderHash = header.renderHash;
+    checkpoint.samplesDone = header.samplesDone;
+    checkpoint.passesDone = header.passesDone;
+    checkpoint.totalSamples = header.totalSamples;
+    checkpoint.secondsElapsed = header.secondsElapsed;
+    checkpoint.stats = header.stats;
+    checkpoint.framebuffer = Framebuffer(header.width, header.height);
+    for (auto y = 0; y < header.height; y++) {
+        for (auto x = 0; x < header.width; x++) {
+            checkpoint.framebuffer.add(x, y, records[size_t(y) * header.width + x]);
+        }
+    }
+    return checkpoint;
+}
+
+bool checkpoint::save(const std::string &path, const Checkpoint &checkpoint) {
+    const auto &framebuffer = checkpoint.framebuffer;
+    auto header = Header();
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.headerSize = uint32_t(sizeof(header));
+    header.renderHash = checkpoint.renderHash;
+    header.width = framebuffer.width();
+    header.height = framebuffer.height();
+    header.samplesDone = checkpoint.samplesDone;
+    header.passesDone = checkpoint.passesDone;
+    header.totalSamples = checkpoint.totalSamples;
+    header.secondsElapsed = checkpoint.secondsElapsed;
+    header.stats = checkpoint.stats;
+    header.activePixelCount = checkpoint.activePixels.size();
+    header.tileCount = checkpoint.tileSeconds.size();
+    header.pixelSecondsCount = checkpoint.pixelSeconds.size();
+
+    auto temporaryPath = path + ".tmp";
+    auto file = std::fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        fmt::print(stderr, "Could not open {} for writing\n", temporaryPath);
+        return false;
+    }
+    auto write = [&](const void *data, size_t size, size_t count) {
+        return count == 0 || std::fwrite(data, size, count, file) == count;
+    };
+    auto ok = write(&header, sizeof(header), 1);
+    for (auto y = 0; y < framebuffer.height() && ok; y++) {
+        for (auto x = 0; x < framebuffer.width() && ok; x++) {
+            auto record = framebuffer.record(x, y);
+            ok = write(&record, sizeof(record), 1);
+        }
+    }
+    ok = ok && write(checkpoint.activePixels.data(), sizeof(uint8_t), checkpoint.activePixels.size()) &&
+        write(checkpoint.tileSeconds.data(), sizeof(double), checkpoint.tileSeconds.size()) &&
+        write(checkpoint.pixelSeconds.data(), sizeof(float), checkpoint.pixelSeconds.size());
+    ok = std::fclose(file) == 0 && ok;
+
+    auto error = std::error_code();
+    if (ok) {
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+    if (!ok || error) {
+        std::filesystem::remove(temporaryPath, error);
+        fmt::print(stderr, "Could not write {}\n", path);
+        return false;
+    }
+    return true;
+}
+
+CheckpointWriter::CheckpointWriter(std::string path)
+    : _path(std::move(path)) {
+    _thread = std::thread([this]() { writerLoop(); });
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    _thread.join();
+}
+
+Checkpoint *CheckpointWriter::beginSnapshot(bool wait) {
+    auto lock = std::unique_lock<std::mutex>(_mutex);
+    if (wait) {
+        _wake.wait(lock, [this]() { return !_saving; });
+    }
+    return _saving ? nullptr : &_snapshot;
+}
+
+void CheckpointWriter::commitSnapshot() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _saving = true;
+    }
+    _wake.notify_all();
+}
+
+void CheckpointWriter::writerLoop() {
+    auto lock = std::unique_lock<std::mutex>(_mutex);
+    while (true) {
+        _wake.wait(lock, [this]() { return _saving || _stop; });
+        if (!_saving) {
+            return;
+        }
+        lock.unlock();
+        checkpoint::save(_path, _snapshot);
+        lock.lock();
+        _saving = false;
+        _wake.notify_all();
+    }
+}
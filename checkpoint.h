@@ -0,0 +1,72 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.h"
+#include "options.h"
+#include "renderstats.h"
+#include "scene.h"
+
+// What a progressive render needs to go on where it stopped, taken between two passes. Samples only depend
+// on the seed, the pixel and the sample index, so where every sampler is comes down to samplesDone.
+struct Checkpoint {
+public:
+    // See checkpoint::renderHash, a checkpoint only continues the render it was taken of.
+    uint64_t renderHash = 0;
+    int samplesDone = 0;
+    int passesDone = 0;
+    uint64_t totalSamples = 0;
+    double secondsElapsed = 0.0;
+    // Counted by the render up to the checkpoint, over all the runs that took it there.
+    renderstats::Totals stats = {};
+    Framebuffer framebuffer = {};
+    // Row by row, empty while every pixel is active.
+    std::vector<uint8_t> activePixels = {};
+    std::vector<double> tileSeconds = {};
+    // Empty without a heatmap.
+    std::vector<float> pixelSeconds = {};
+};
+
+namespace checkpoint {
+    // Of the scene and of every option that changes which samples are taken or what they add up to.
+    uint64_t renderHash(const RenderOptions &options, const Scene &scene);
+    // Nothing if there is no checkpoint at path, it is damaged or it is of another render.
+    std::optional<Checkpoint> load(const std::string &path, uint64_t renderHash);
+    // Through a temporary file, so a render that is stopped while saving still has the previous checkpoint.
+    bool save(const std::string &path, const Checkpoint &checkpoint);
+}
+
+// Saves checkpoints on a thread of its own, the render goes on while they are written.
+class CheckpointWriter {
+    std::string _path = {};
+    // Only touched by the render while no save is running, and only by the writer thread while one is.
+    Checkpoint _snapshot = {};
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _saving = false;
+    bool _stop = false;
+    std::thread _thread;
+
+public:
+    explicit CheckpointWriter(std::string path);
+    // Finishes the save in progress.
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter &) = delete;
+    CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+    // The snapshot to fill in, nothing while the previous one is still being saved unless wait is set.
+    // It keeps its buffers, so filling it again does not allocate.
+    Checkpoint *beginSnapshot(bool wait = false);
+    // Starts saving the snapshot handed out by beginSnapshot.
+    void commitSnapshot();
+
+private:
+    void writerLoop();
+};
@@ -0,0 +1,957 @@
+#include "compiledscene.h"
+
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+
+#include "scenecache.h"
+#include "renderstats.h"
+
+namespace {
+    const float MISS = std::numeric_limits<float>::infinity();
+    // Refitting stops once it made tracing this much more expensive than right after the build.
+    const float REBUILD_COST_GROWTH = 1.5f;
+
+    uint64_t alignUp(uint64_t offset) {
+        return (offset + scenecache::SECTION_ALIGNMENT - 1) / scenecache::SECTION_ALIGNMENT * scenecache::SECTION_ALIGNMENT;
+    }
+
+    // A damaged cache must not send the traversal out of bounds or into a loop: children come after
+    // their parent, leaves stay inside their primitive arrays and the tree is not deeper than the traversal stack.
+    bool validNodes(ArrayView<BvhNode> nodes, size_t sphereCount, size_t triangleCount, size_t instanceCount) {
+        auto depths = std::vector<uint8_t>(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++) {
+            const auto &node = nodes[i];
+            if (node.isLeaf()) {
+                auto primitiveCount = node.primitiveType == uint16_t(PrimitiveType::Sphere) ? sphereCount
+                    : node.primitiveType == uint16_t(PrimitiveType::Triangle) ? triangleCount
+                    : node.primitiveType == uint16_t(PrimitiveType::Instance) ? instanceCount : 0;
+                if (uint64_t(node.leftFirst) + node.count > primitiveCount) {
+                    return false;
+                }
+                continue;
+            }
+            if (node.leftFirst <= i || uint64_t(node.leftFirst) + 1 >= nodes.size() || depths[i] + 1 >= Bvh::MAX_DEPTH) {
+                return false;
+            }
+            depths[node.leftFirst] = depths[node.leftFirst + 1] = uint8_t(depths[i] + 1);
+        }
+        return true;
+    }
+
+    // The ray split into scalars once, the primitive tests below work on single floats.
+    struct RayComponents {
+    public:
+        float originX, originY, originZ;
+        float directionX, directionY, directionZ;
+
+        explicit RayComponents(const Ray &ray)
+            : originX(ray.origin().x), originY(ray.origin().y), originZ(ray.origin().z),
+              directionX(ray.direction().x), directionY(ray.direction().y), directionZ(ray.direction().z) {}
+    };
+
+    template<class Arrays>
+    float intersectSphere(const Arrays &spheres, uint32_t i, const RayComponents &ray) {
+        auto ocX = ray.originX - spheres.centerX[i];
+        auto ocY = ray.originY - spheres.centerY[i];
+        auto ocZ = ray.originZ - spheres.centerZ[i];
+
+        // The direction is normalized, so the quadratic has a = 1.
+        auto b = ocX * ray.directionX + ocY * ray.directionY + ocZ * ray.directionZ;
+        auto c = ocX * ocX + ocY * ocY + ocZ * ocZ - spheres.radius[i] * spheres.radius[i];
+        auto discriminant = b * b - c;
+        if (discriminant < 0.0f) {
+            return MISS;
+        }
+
+        // We do not go backwards along the ray.
+        auto distance = -b - std::sqrt(discriminant);
+        return distance < 0.0f ? MISS : distance;
+    }
+
+    // Moeller-Trumbore, like Triangle::intersect but with the edges precomputed.
+    // u and v are only written for a hit.
+    template<class Arrays>
+    float intersectTriangle(const Arrays &triangles, uint32_t i, const RayComponents &ray, float &u, float &v) {
+        const float EPSILON = std::numeric_limits<float>::epsilon();
+
+        auto edge1X = triangles.edge1X[i];
+        auto edge1Y = triangles.edge1Y[i];
+        auto edge1Z = triangles.edge1Z[i];
+        auto edge2X = triangles.edge2X[i];
+        auto edge2Y = triangles.edge2Y[i];
+        auto edge2Z = triangles.edge2Z[i];
+
+        auto hX = ray.directionY * edge2Z - ray.directionZ * edge2Y;
+        auto hY = ray.directionZ * edge2X - ray.directionX * edge2Z;
+        auto hZ = ray.directionX * edge2Y - ray.directionY * edge2X;
+        auto a = edge1X * hX + edge1Y * hY + edge1Z * hZ;
+        if (a > -EPSILON && a < EPSILON) {
+            return MISS;    // This ray is parallel to this triangle.
+        }
+
+        auto f = 1.0f / a;
+        auto sX = ray.originX - triangles.vertex0X[i];
+        auto sY = ray.originY - triangles.vertex0Y[i];
+        auto sZ = ray.originZ - triangles.vertex0Z[i];
+        auto hitU = f * (sX * hX + sY * hY + sZ * hZ);
+        if (hitU < 0.0f || hitU > 1.0f) {
+            return MISS;
+        }
+
+        auto qX = sY * edge1Z - sZ * edge1Y;
+        auto qY = sZ * edge1X - sX * edge1Z;
+        auto qZ = sX * edge1Y - sY * edge1X;
+        auto hitV = f * (ray.directionX * qX + ray.directionY * qY + ray.directionZ * qZ);
+        if (hitV < 0.0f || hitU + hitV > 1.0f) {
+            return MISS;
+        }
+
+        auto t = f * (edge2X * qX + edge2Y * qY + edge2Z * qZ);
+        if (t > EPSILON && t < 1 / EPSILON) {
+            u = hitU;
+            v = hitV;
+            return t;
+        }
+        return MISS;
+    }
+
+    // Hits closer than tMax among the spheres or triangles of a leaf go to closest and shrink tMax.
+    // The leaf counts from firstSphere or firstTriangle in the arrays.
+    template<class Spheres, class Triangles>
+    void intersectLeaf(const BvhNode &leaf, uint32_t firstSphere, uint32_t firstTriangle, const Spheres &spheres,
+        const Triangles &triangles, const RayComponents &ray, float &tMax, HitRecord &closest) {
+        if (leaf.primitiveType == uint16_t(PrimitiveType::Sphere)) {
+            auto end = firstSphere + leaf.leftFirst + leaf.count;
+            for (auto i = firstSphere + leaf.leftFirst; i < end; i++) {
+                auto t = intersectSphere(spheres, i, ray);
+                if (t < tMax) {
+                    tMax = t;
+                    closest.distance = t;
+                    closest.primitiveType = PrimitiveType::Sphere;
+                    closest.primitiveIndex = i;
+                    closest.instance = HitRecord::NO_INSTANCE;
+                }
+            }
+            return;
+        }
+
+        auto end = firstTriangle + leaf.leftFirst + leaf.count;
+        for (auto i = firstTriangle + leaf.leftFirst; i < end; i++) {
+            auto u = 0.0f;
+            auto v = 0.0f;
+            auto t = intersectTriangle(triangles, i, ray, u, v);
+            if (t < tMax) {
+                tMax = t;
+                closest.distance = t;
+                closest.primitiveType = PrimitiveType::Triangle;
+                closest.primitiveIndex = i;
+                closest.u = u;
+                closest.v = v;
+                closest.instance = HitRecord::NO_INSTANCE;
+            }
+        }
+    }
+
+    // Is any sphere or triangle of the leaf closer than tMax?
+    template<class Spheres, class Triangles>
+    bool occludedInLeaf(const BvhNode &leaf, uint32_t firstSphere, uint32_t firstTriangle, const Spheres &spheres,
+        const Triangles &triangles, const RayComponents &ray, float tMax) {
+        if (leaf.primitiveType == uint16_t(PrimitiveType::Sphere)) {
+            auto end = firstSphere + leaf.leftFirst + leaf.count;
+            for (auto i = firstSphere + leaf.leftFirst; i < end; i++) {
+                if (intersectSphere(spheres, i, ray) < tMax) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        auto end = firstTriangle + leaf.leftFirst + leaf.count;
+        for (auto i = firstTriangle + leaf.leftFirst; i < end; i++) {
+            auto u = 0.0f;
+            auto v = 0.0f;
+            if (intersectTriangle(triangles, i, ray, u, v) < tMax) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    BoundingBox sphereBox(const SpherePrimitive &sphere) {
+        auto radius = Vec3(sphere.radius, sphere.radius, sphere.radius);
+        return BoundingBox(sphere.center - radius, sphere.center + radius);
+    }
+
+    BoundingBox triangleBox(const TrianglePrimitive &triangle) {
+        return BoundingBox().expand(triangle.vertex0).expand(triangle.vertex1).expand(triangle.vertex2);
+    }
+
+    template<class Arrays>
+    void appendSphere(Arrays &spheres, const SpherePrimitive &sphere) {
+        spheres.centerX.push_back(sphere.center.x);
+        spheres.centerY.push_back(sphere.center.y);
+        spheres.centerZ.push_back(sphere.center.z);
+        spheres.radius.push_back(sphere.radius);
+        spheres.materialIndex.push_back(sphere.materialIndex);
+    }
+
+    template<class Arrays>
+    void appendTriangle(Arrays &triangles, const TrianglePrimitive &triangle) {
+        auto edge1 = triangle.vertex1 - triangle.vertex0;
+        auto edge2 = triangle.vertex2 - triangle.vertex0;
+        triangles.vertex0X.push_back(triangle.vertex0.x);
+        triangles.vertex0Y.push_back(triangle.vertex0.y);
+        triangles.vertex0Z.push_back(triangle.vertex0.z);
+        triangles.edge1X.push_back(edge1.x);
+        triangles.edge1Y.push_back(edge1.y);
+        triangles.edge1Z.push_back(edge1.z);
+        triangles.edge2X.push_back(edge2.x);
+        triangles.edge2Y.push_back(edge2.y);
+        triangles.edge2Z.push_back(edge2.z);
+        triangles.materialIndex.push_back(triangle.materialIndex);
+    }
+}
+
+CompiledScene::SphereArrays<ArrayView> CompiledScene::viewOf(const SphereArrays<AlignedVector> &spheres) {
+    return SphereArrays<ArrayView>{ spheres.centerX, spheres.centerY, spheres.centerZ, spheres.radius, spheres.materialIndex };
+}
+
+CompiledScene::TriangleArrays<ArrayView> CompiledScene::viewOf(const TriangleArrays<AlignedVector> &triangles) {
+    return TriangleArrays<ArrayView>{
+        triangles.vertex0X, triangles.vertex0Y, triangles.vertex0Z,
+        triangles.edge1X, triangles.edge1Y, triangles.edge1Z,
+        triangles.edge2X, triangles.edge2Y, triangles.edge2Z,
+        triangles.materialIndex
+    };
+}
+
+void CompiledScene::build(const PrimitiveList &primitives) {
+    // Loose triangles first, then the triangles of every mesh, all in one index space.
+    auto meshFirstTriangle = std::vector<size_t>();
+    auto triangleCount = primitives.triangles.size();
+    for (const auto &mesh : primitives.meshes) {
+        meshFirstTriangle.push_back(triangleCount);
+        triangleCount += mesh.mesh->triangleCount();
+    }
+    auto triangleAt = [&](size_t index) {
+        if (index < primitives.triangles.size()) {
+            return primitives.triangles[index];
+        }
+        auto meshIndex = size_t(std::upper_bound(meshFirstTriangle.begin(), meshFirstTriangle.end(), index) - meshFirstTriangle.begin()) - 1;
+        const auto &mesh = primitives.meshes[meshIndex];
+        const auto *indices = &mesh.mesh->indices[3 * (index - meshFirstTriangle[meshIndex])];
+        return TrianglePrimitive{ mesh.vertex(indices[0]), mesh.vertex(indices[1]), mesh.vertex(indices[2]), mesh.materialIndex };
+    };
+
+    auto bounds = std::vector<BoundingBox>();
+    auto types = std::vector<uint16_t>();
+
+    // The geometries first, the instances need their bounds.
+    _geometries.clear();
+    auto geometryTriangleCount = size_t(0);
+    for (const auto &source : primitives.geometries) {
+        for (const auto &sphere : source.spheres) {
+            bounds.push_back(sphereBox(sphere));
+            types.push_back(uint16_t(PrimitiveType::Sphere));
+        }
+        for (const auto &triangle : source.triangles) {
+            bounds.push_back(triangleBox(triangle));
+            types.push_back(uint16_t(PrimitiveType::Triangle));
+        }
+        auto geometry = Geometry();
+        geometry.bvh.build(bounds, types);
+        geometry.sphereCount = uint32_t(source.spheres.size());
+        geometry.triangleCount = uint32_t(source.triangles.size());
+        geometryTriangleCount += source.triangles.size();
+        _geometries.push_back(std::move(geometry));
+        bounds.clear();
+        types.clear();
+    }
+
+    bounds.reserve(primitives.spheres.size() + triangleCount + primitives.instances.size());
+    types.reserve(bounds.capacity());
+
+    for (const auto &sphere : primitives.spheres) {
+        bounds.push_back(sphereBox(sphere));
+        types.push_back(uint16_t(PrimitiveType::Sphere));
+    }
+    for (size_t i = 0; i < triangleCount; i++) {
+        bounds.push_back(triangleBox(triangleAt(i)));
+        types.push_back(uint16_t(PrimitiveType::Triangle));
+    }
+    for (const auto &instance : primitives.instances) {
+        bounds.push_back(instance.transform.applyToBox(_geometries[instance.geometry].bvh.bounds()));
+        types.push_back(uint16_t(PrimitiveType::Instance));
+    }
+
+    _bvh.build(bounds, types);
+    bounds = {};
+    types = {};
+
+    // Lay the primitives out in leaf order, every leaf indexes its own type's arrays.
+    _sphereStorage = {};
+    _triangleStorage = {};
+    _materials = primitives.materials;
+
+    const auto &order = _bvh.primitiveIndices();
+    auto sphereCount = primitives.spheres.size();
+    for (auto i = 0u; i < sphereCount; i++) {
+        appendSphere(_sphereStorage, primitives.spheres[order[_bvh.typeOffset(uint16_t(PrimitiveType::Sphere)) + i]]);
+    }
+
+    for (auto *values : { &_triangleStorage.vertex0X, &_triangleStorage.vertex0Y, &_triangleStorage.vertex0Z,
+                          &_triangleStorage.edge1X, &_triangleStorage.edge1Y, &_triangleStorage.edge1Z,
+                          &_triangleStorage.edge2X, &_triangleStorage.edge2Y, &_triangleStorage.edge2Z }) {
+        values->reserve(triangleCount + geometryTriangleCount);
+    }
+    _triangleStorage.materialIndex.reserve(triangleCount + geometryTriangleCount);
+
+    for (size_t i = 0; i < triangleCount; i++) {
+        // Triangles come after the spheres in the combined index space.
+        appendTriangle(_triangleStorage, triangleAt(order[_bvh.typeOffset(uint16_t(PrimitiveType::Triangle)) + i] - sphereCount));
+    }
+    _ownSphereCount = uint32_t(sphereCount);
+    _ownTriangleCount = uint32_t(triangleCount);
+
+    // Every geometry after them, in the leaf order of its own BVH.
+    for (size_t g = 0; g < _geometries.size(); g++) {
+        const auto &source = primitives.geometries[g];
+        auto &geometry = _geometries[g];
+        const auto &geometryOrder = geometry.bvh.primitiveIndices();
+        geometry.firstSphere = uint32_t(_sphereStorage.radius.size());
+        geometry.firstTriangle = uint32_t(_triangleStorage.edge1X.size());
+        for (uint32_t i = 0; i < geometry.sphereCount; i++) {
+            appendSphere(_sphereStorage, source.spheres[geometryOrder[geometry.bvh.typeOffset(uint16_t(PrimitiveType::Sphere)) + i]]);
+        }
+        for (uint32_t i = 0; i < geometry.triangleCount; i++) {
+            auto index = geometryOrder[geometry.bvh.typeOffset(uint16_t(PrimitiveType::Triangle)) + i] - geometry.sphereCount;
+            appendTriangle(_triangleStorage, source.triangles[index]);
+        }
+    }
+
+    // Instances come after the spheres and triangles.
+    _instances.clear();
+    _instances.reserve(primitives.instances.size());
+    for (size_t i = 0; i < primitives.instances.size(); i++) {
+        const auto &source = primitives.instances[order[_bvh.typeOffset(uint16_t(PrimitiveType::Instance)) + i] - sphereCount - triangleCount];
+        auto instance = Instance();
+        instance.geometry = source.geometry;
+        instance.materialIndex = source.materialIndex;
+        instance.setTransform(source.transform);
+        _instances.push_back(instance);
+    }
+
+    _spheres = viewOf(_sphereStorage);
+    _triangles = viewOf(_triangleStorage);
+    _cacheFile = {};
+    clearMotion();
+}
+
+HitRecord CompiledScene::intersect(const Ray &ray, float tMax) const {
+    auto components = RayComponents(ray);
+    auto closest = HitRecord();
+    uint32_t leafVisits = 0;
+    uint32_t primitiveTests = 0;
+
+    _bvh.traverse(ray, tMax, [&](const BvhNode &leaf, float &tMax) {
+        leafVisits++;
+        primitiveTests += leaf.count;
+        if (leaf.primitiveType != uint16_t(PrimitiveType::Instance)) {
+            intersectLeaf(leaf, 0, 0, _spheres, _triangles, components, tMax, closest);
+            return false;
+        }
+
+        for (auto i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++) {
+            const auto &instance = _instances[i];
+            const auto &geometry = _geometries[instance.geometry];
+            auto geometryRay = instance.toGeometry(ray);
+            auto geometryComponents = RayComponents(geometryRay);
+            auto geometryHit = HitRecord();
+            geometry.bvh.traverse(geometryRay, tMax * instance.inverseScale, [&](const BvhNode &geometryLeaf, float &geometryTMax) {
+                leafVisits++;
+                primitiveTests += geometryLeaf.count;
+                intersectLeaf(geometryLeaf, geometry.firstSphere, geometry.firstTriangle, _spheres, _triangles,
+                    geometryComponents, geometryTMax, geometryHit);
+                return false;
+            });
+            if (geometryHit.hit()) {
+                closest = geometryHit;
+                closest.distance = geometryHit.distance * instance.transform.scale;
+                closest.instance = i;
+                tMax = closest.distance;
+            }
+        }
+        return false;
+    });
+
+    renderstats::countTraversal(leafVisits, primitiveTests);
+    return closest;
+}
+
+Intersection CompiledScene::resolve(const Ray &ray, const HitRecord &hit) const {
+    assert(hit.hit());
+
+    auto i = hit.primitiveIndex;
+    auto position = ray.origin() + ray.direction() * hit.distance;
+    auto materialIndex = hit.primitiveType == PrimitiveType::Sphere ? _spheres.materialIndex[i] : _triangles.materialIndex[i];
+    if (hit.instance == HitRecord::NO_INSTANCE) {
+        if (hit.primitiveType == PrimitiveType::Sphere) {
+            auto center = Vec3(_spheres.centerX[i], _spheres.centerY[i], _spheres.centerZ[i]);
+            return Intersection(position, position - center, hit.distance, _materials[materialIndex]);
+        }
+        auto edge1 = Vec3(_triangles.edge1X[i], _triangles.edge1Y[i], _triangles.edge1Z[i]);
+        auto edge2 = Vec3(_triangles.edge2X[i], _triangles.edge2Y[i], _triangles.edge2Z[i]);
+        return Intersection(position, edge1.cross(edge2), hit.distance, _materials[materialIndex]);
+    }
+
+    // The normal is worked out in the geometry and turned the way the instance is.
+    const auto &instance = _instances[hit.instance];
+    if (instance.materialIndex != InstancePrimitive::NO_MATERIAL) {
+        materialIndex = instance.materialIndex;
+    }
+    if (hit.primitiveType == PrimitiveType::Sphere) {
+        auto center = Vec3(_spheres.centerX[i], _spheres.centerY[i], _spheres.centerZ[i]);
+        auto normal = instance.directionToScene(instance.pointToGeometry(position) - center);
+        return Intersection(position, normal, hit.distance, _materials[materialIndex]);
+    }
+    auto edge1 = Vec3(_triangles.edge1X[i], _triangles.edge1Y[i], _triangles.edge1Z[i]);
+    auto edge2 = Vec3(_triangles.edge2X[i], _triangles.edge2Y[i], _triangles.edge2Z[i]);
+    return Intersection(position, instance.directionToScene(edge1.cross(edge2)), hit.distance, _materials[materialIndex]);
+}
+
+std::optional<Intersection> CompiledScene::closestHit(const Ray &ray, float tMax) const {
+    auto hit = intersect(ray, tMax);
+    if (!hit.hit()) {
+        return std::optional<Intersection>();
+    }
+    return resolve(ray, hit);
+}
+
+bool CompiledScene::occluded(const Ray &ray, float tMax) const {
+    auto components = RayComponents(ray);
+    uint32_t leafVisits = 0;
+    uint32_t primitiveTests = 0;
+
+    auto occluded = _bvh.traverse(ray, tMax, [&](const BvhNode &leaf, float &tMax) {
+        leafVisits++;
+        primitiveTests += leaf.count;
+        if (leaf.primitiveType != uint16_t(PrimitiveType::Instance)) {
+            return occludedInLeaf(leaf, 0, 0, _spheres, _triangles, components, tMax);
+        }
+
+        for (auto i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++) {
+            const auto &instance = _instances[i];
+            const auto &geometry = _geometries[instance.geometry];
+            auto geometryRay = instance.toGeometry(ray);
+            auto geometryComponents = RayComponents(geometryRay);
+            auto blocked = geometry.bvh.traverse(geometryRay, tMax * instance.inverseScale, [&](const BvhNode &geometryLeaf, float &geometryTMax) {
+                leafVisits++;
+                primitiveTests += geometryLeaf.count;
+                return occludedInLeaf(geometryLeaf, geometry.firstSphere, geometry.firstTriangle, _spheres, _triangles,
+                    geometryComponents, geometryTMax);
+            });
+            if (blocked) {
+                return true;
+            }
+        }
+        return false;
+    });
+
+    // Counts the whole leaf the blocker was found in, the few tests it skipped do not matter.
+    renderstats::countTraversal(leafVisits, primitiveTests);
+    return occluded;
+}
+
+size_t CompiledScene::placedTriangleCount() const {
+    auto count = size_t(_ownTriangleCount);
+    for (const auto &instance : _instances) {
+        count += _geometries[instance.geometry].triangleCount;
+    }
+    return count;
+}
+
+std::optional<size_t> CompiledScene::addMovingGroup(const PrimitiveGroup &group, Vec3 pivot) {
+    if (_cacheFile.data()) {
+        return std::optional<size_t>();
+    }
+    if (_movingGroups.empty()) {
+        updateLeaves();
+    }
+
+    // Where the primitives of the PrimitiveList ended up, spheres first, then triangles and instances.
+    const auto &order = _bvh.primitiveIndices();
+    auto sphereCount = _ownSphereCount;
+    auto triangleCount = _ownTriangleCount;
+    auto compiledIndex = std::vector<uint32_t>(order.size());
+    for (uint32_t i = 0; i < sphereCount; i++) {
+        compiledIndex[order[_bvh.typeOffset(uint16_t(PrimitiveType::Sphere)) + i]] = i;
+    }
+    for (uint32_t i = 0; i < triangleCount; i++) {
+        compiledIndex[order[_bvh.typeOffset(uint16_t(PrimitiveType::Triangle)) + i]] = i;
+    }
+    for (uint32_t i = 0; i < _instances.size(); i++) {
+        compiledIndex[order[_bvh.typeOffset(uint16_t(PrimitiveType::Instance)) + i]] = i;
+    }
+
+    auto moving = MovingGroup();
+    moving.transform = Transform{ pivot };
+    moving.firstSphere = _movingSpheres.size();
+    moving.sphereCount = group.sphereCount;
+    moving.firstTriangle = _movingTriangles.size();
+    moving.triangleCount = group.triangleCount;
+    moving.firstInstance = _movingInstances.size();
+    moving.instanceCount = group.instanceCount;
+    for (auto i = group.firstSphere; i < group.firstSphere + group.sphereCount; i++) {
+        auto index = compiledIndex[i];
+        auto center = Vec3(_spheres.centerX[index], _spheres.centerY[index], _spheres.centerZ[index]);
+        _movingSpheres.push_back(MovingSphere{ index, center - pivot, _spheres.radius[index] });
+    }
+    for (auto i = group.firstTriangle; i < group.firstTriangle + group.triangleCount; i++) {
+        auto index = compiledIndex[sphereCount + i];
+        auto vertex0 = Vec3(_triangles.vertex0X[index], _triangles.vertex0Y[index], _triangles.vertex0Z[index]);
+        auto edge1 = Vec3(_triangles.edge1X[index], _triangles.edge1Y[index], _triangles.edge1Z[index]);
+        auto edge2 = Vec3(_triangles.edge2X[index], _triangles.edge2Y[index], _triangles.edge2Z[index]);
+        _movingTriangles.push_back(MovingTriangle{ index, vertex0 - pivot, edge1, edge2 });
+    }
+    for (auto i = group.firstInstance; i < group.firstInstance + group.instanceCount; i++) {
+        auto index = compiledIndex[sphereCount + triangleCount + i];
+        auto transform = _instances[index].transform;
+        transform.translation = transform.translation - pivot;
+        _movingInstances.push_back(MovingInstance{ index, transform });
+    }
+    _movingGroups.push_back(moving);
+    return _movingGroups.size() - 1;
+}
+
+void CompiledScene::moveGroup(size_t group, const Transform &transform) {
+    auto &moving = _movingGroups[group];
+    if (moving.transform == transform) {
+        return;
+    }
+    moving.transform = transform;
+
+    for (auto i = moving.firstSphere; i < moving.firstSphere + moving.sphereCount; i++) {
+        const auto &sphere = _movingSpheres[i];
+        auto center = transform.applyToPoint(sphere.center);
+        _sphereStorage.centerX[sphere.index] = center.x;
+        _sphereStorage.centerY[sphere.index] = center.y;
+        _sphereStorage.centerZ[sphere.index] = center.z;
+        _sphereStorage.radius[sphere.index] = sphere.radius * transform.scale;
+        _movedLeaves.push_back(_sphereLeaves[sphere.index]);
+    }
+    for (auto i = moving.firstTriangle; i < moving.firstTriangle + moving.triangleCount; i++) {
+        const auto &triangle = _movingTriangles[i];
+        auto vertex0 = transform.applyToPoint(triangle.vertex0);
+        auto edge1 = transform.applyToVector(triangle.edge1);
+        auto edge2 = transform.applyToVector(triangle.edge2);
+        auto index = triangle.index;
+        _triangleStorage.vertex0X[index] = vertex0.x;
+        _triangleStorage.vertex0Y[index] = vertex0.y;
+        _triangleStorage.vertex0Z[index] = vertex0.z;
+        _triangleStorage.edge1X[index] = edge1.x;
+        _triangleStorage.edge1Y[index] = edge1.y;
+        _triangleStorage.edge1Z[index] = edge1.z;
+        _triangleStorage.edge2X[index] = edge2.x;
+        _triangleStorage.edge2Y[index] = edge2.y;
+        _triangleStorage.edge2Z[index] = edge2.z;
+        _movedLeaves.push_back(_triangleLeaves[index]);
+    }
+    // Only the instance moves, its geometry stays as it is.
+    for (auto i = moving.firstInstance; i < moving.firstInstance + moving.instanceCount; i++) {
+        const auto &instance = _movingInstances[i];
+        _instances[instance.index].setTransform(Transform::combine(transform, instance.transform));
+        _movedLeaves.push_back(_instanceLeaves[instance.index]);
+    }
+    _movedPrimitives += moving.sphereCount + moving.triangleCount + moving.instanceCount;
+}
+
+CompiledScene::MotionUpdate CompiledScene::updateMotion() {
+    auto update = MotionUpdate();
+    update.movedPrimitives = _movedPrimitives;
+    if (_movedLeaves.empty()) {
+        return update;
+    }
+
+    update.refitNodes = _bvh.refit(_movedLeaves, [&](const BvhNode &leaf) {
+        auto bounds = BoundingBox();
+        for (auto i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++) {
+            bounds = bounds.expand(leaf.primitiveType == uint16_t(PrimitiveType::Sphere) ? sphereBounds(i)
+                : leaf.primitiveType == uint16_t(PrimitiveType::Triangle) ? triangleBounds(i) : instanceBounds(i));
+        }
+        return bounds;
+    });
+    _movedLeaves.clear();
+    _movedPrimitives = 0;
+
+    if (_bvh.costGrowth() > REBUILD_COST_GROWTH) {
+        rebuild();
+        update.rebuilt = true;
+    }
+    return update;
+}
+
+BoundingBox CompiledScene::sphereBounds(uint32_t index) const {
+    auto center = Vec3(_spheres.centerX[index], _spheres.centerY[index], _spheres.centerZ[index]);
+    auto radius = _spheres.radius[index];
+    return BoundingBox(center - Vec3(radius, radius, radius), center + Vec3(radius, radius, radius));
+}
+
+BoundingBox CompiledScene::triangleBounds(uint32_t index) const {
+    auto vertex0 = Vec3(_triangles.vertex0X[index], _triangles.vertex0Y[index], _triangles.vertex0Z[index]);
+    auto edge1 = Vec3(_triangles.edge1X[index], _triangles.edge1Y[index], _triangles.edge1Z[index]);
+    auto edge2 = Vec3(_triangles.edge2X[index], _triangles.edge2Y[index], _triangles.edge2Z[index]);
+    return BoundingBox().expand(vertex0).expand(vertex0 + edge1).expand(vertex0 + edge2);
+}
+
+BoundingBox CompiledScene::instanceBounds(uint32_t index) const {
+    const auto &instance = _instances[index];
+    return instance.transform.applyToBox(_geometries[instance.geometry].bvh.bounds());
+}
+
+void CompiledScene::rebuild() {
+    // The geometries keep their BVHs, only the one over the scene's own primitives and the instances is built.
+    auto sphereCount = _ownSphereCount;
+    auto triangleCount = _ownTriangleCount;
+    auto instanceCount = uint32_t(_instances.size());
+    auto bounds = std::vector<BoundingBox>();
+    auto types = std::vector<uint16_t>();
+    bounds.reserve(sphereCount + triangleCount + instanceCount);
+    types.reserve(bounds.capacity());
+    for (uint32_t i = 0; i < sphereCount; i++) {
+        bounds.push_back(sphereBounds(i));
+        types.push_back(uint16_t(PrimitiveType::Sphere));
+    }
+    for (uint32_t i = 0; i < triangleCount; i++) {
+        bounds.push_back(triangleBounds(i));
+        types.push_back(uint16_t(PrimitiveType::Triangle));
+    }
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        bounds.push_back(instanceBounds(i));
+        types.push_back(uint16_t(PrimitiveType::Instance));
+    }
+    _bvh.build(bounds, types);
+
+    // The new leaf order, and where every primitive was before, spheres first, then triangles and instances.
+    const auto &order = _bvh.primitiveIndices();
+    auto reorder = [&](auto &values, uint32_t count, PrimitiveType type, uint32_t first) {
+        if (count == 0) {
+            return;
+        }
+        auto offset = _bvh.typeOffset(uint16_t(type));
+        auto previous = values;
+        for (uint32_t i = 0; i < count; i++) {
+            values[i] = previous[order[offset + i] - first];
+        }
+    };
+    for (auto *values : { &_sphereStorage.centerX, &_sphereStorage.centerY, &_sphereStorage.centerZ, &_sphereStorage.radius }) {
+        reorder(*values, sphereCount, PrimitiveType::Sphere, 0);
+    }
+    reorder(_sphereStorage.materialIndex, sphereCount, PrimitiveType::Sphere, 0);
+    for (auto *values : { &_triangleStorage.vertex0X, &_triangleStorage.vertex0Y, &_triangleStorage.vertex0Z,
+                          &_triangleStorage.edge1X, &_triangleStorage.edge1Y, &_triangleStorage.edge1Z,
+                          &_triangleStorage.edge2X, &_triangleStorage.edge2Y, &_triangleStorage.edge2Z }) {
+        reorder(*values, triangleCount, PrimitiveType::Triangle, sphereCount);
+    }
+    reorder(_triangleStorage.materialIndex, triangleCount, PrimitiveType::Triangle, sphereCount);
+    reorder(_instances, instanceCount, PrimitiveType::Instance, sphereCount + triangleCount);
+
+    auto newIndex = std::vector<uint32_t>(order.size());
+    auto assignNewIndices = [&](uint32_t count, PrimitiveType type) {
+        for (uint32_t i = 0; i < count; i++) {
+            newIndex[order[_bvh.typeOffset(uint16_t(type)) + i]] = i;
+        }
+    };
+    assignNewIndices(sphereCount, PrimitiveType::Sphere);
+    assignNewIndices(triangleCount, PrimitiveType::Triangle);
+    assignNewIndices(instanceCount, PrimitiveType::Instance);
+    for (auto &sphere : _movingSpheres) {
+        sphere.index = newIndex[sphere.index];
+    }
+    for (auto &triangle : _movingTriangles) {
+        triangle.index = newIndex[sphereCount + triangle.index];
+    }
+    for (auto &instance : _movingInstances) {
+        instance.index = newIndex[sphereCount + triangleCount + instance.index];
+    }
+
+    _spheres = viewOf(_sphereStorage);
+    _triangles = viewOf(_triangleStorage);
+    updateLeaves();
+}
+
+void CompiledScene::clearMotion() {
+    _movingSpheres.clear();
+    _movingTriangles.clear();
+    _movingInstances.clear();
+    _movingGroups.clear();
+    _sphereLeaves.clear();
+    _triangleLeaves.clear();
+    _instanceLeaves.clear();
+    _movedLeaves.clear();
+    _movedPrimitives = 0;
+}
+
+void CompiledScene::updateLeaves() {
+    _sphereLeaves.assign(_ownSphereCount, 0);
+    _triangleLeaves.assign(_ownTriangleCount, 0);
+    _instanceLeaves.assign(_instances.size(), 0);
+    auto nodes = _bvh.nodes();
+    for (uint32_t nodeIndex = 0; nodeIndex < nodes.size(); nodeIndex++) {
+        const auto &node = nodes[nodeIndex];
+        auto &leaves = node.primitiveType == uint16_t(PrimitiveType::Sphere) ? _sphereLeaves
+            : node.primitiveType == uint16_t(PrimitiveType::Triangle) ? _triangleLeaves : _instanceLeaves;
+        for (auto i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+            leaves[i] = nodeIndex;
+        }
+    }
+}
+
+bool CompiledScene::saveCache(const std::string &path, uint64_t sourceHash) const {
+    using scenecache::Section;
+
+    auto materials = std::vector<scenecache::MaterialRecord>();
+    for (const auto &material : _materials) {
+        auto record = scenecache::MaterialRecord();
+        auto color = material.color();
+        auto emittingColor = material.emittingColor().value_or(Radiance());
+        for (auto channel = 0; channel < 3; channel++) {
+            record.color[channel] = color[channel];
+            record.emittingColor[channel] = emittingColor[channel];
+        }
+        record.reflectionPercent = material.reflectionPercent().value_or(0.0f);
+        record.roughness = material.roughness();
+        record.flags = (material.emittingColor() ? scenecache::MATERIAL_EMITS : 0) |
+            (material.reflectionPercent() ? scenecache::MATERIAL_REFLECTS : 0);
+        materials.push_back(record);
+    }
+
+    auto geometryNodes = std::vector<BvhNode>();
+    auto geometries = std::vector<scenecache::GeometryRecord>();
+    for (const auto &geometry : _geometries) {
+        auto nodes = geometry.bvh.nodes();
+        geometries.push_back(scenecache::GeometryRecord{ geometryNodes.size(), nodes.size(), geometry.firstSphere,
+            geometry.sphereCount, geometry.firstTriangle, geometry.triangleCount });
+        geometryNodes.insert(geometryNodes.end(), nodes.begin(), nodes.end());
+    }
+    auto instances = std::vector<scenecache::InstanceRecord>();
+    for (const auto &instance : _instances) {
+        const auto &transform = instance.transform;
+        instances.push_back(scenecache::InstanceRecord{ { transform.translation.x, transform.translation.y, transform.translation.z },
+            transform.scale, transform.yaw, instance.geometry, instance.materialIndex });
+    }
+
+    struct Source {
+        const void *data;
+        size_t size;
+    };
+    auto floats = [](ArrayView<float> values) { return Source{ values.data(), values.size() * sizeof(float) }; };
+    auto indices = [](ArrayView<uint32_t> values) { return Source{ values.data(), values.size() * sizeof(uint32_t) }; };
+    const Source sources[size_t(Section::Count)] = {
+        floats(_spheres.centerX), floats(_spheres.centerY), floats(_spheres.centerZ), floats(_spheres.radius),
+        indices(_spheres.materialIndex),
+        floats(_triangles.vertex0X), floats(_triangles.vertex0Y), floats(_triangles.vertex0Z),
+        floats(_triangles.edge1X), floats(_triangles.edge1Y), floats(_triangles.edge1Z),
+        floats(_triangles.edge2X), floats(_triangles.edge2Y), floats(_triangles.edge2Z),
+        indices(_triangles.materialIndex),
+        Source{ _bvh.nodes().data(), _bvh.nodeCount() * sizeof(BvhNode) },
+        Source{ materials.data(), materials.size() * sizeof(scenecache::MaterialRecord) },
+        Source{ geometryNodes.data(), geometryNodes.size() * sizeof(BvhNode) },
+        Source{ geometries.data(), geometries.size() * sizeof(scenecache::GeometryRecord) },
+        Source{ instances.data(), instances.size() * sizeof(scenecache::InstanceRecord) },
+    };
+
+    auto header = scenecache::Header();
+    std::memcpy(header.magic, scenecache::MAGIC, sizeof(header.magic));
+    header.version = scenecache::VERSION;
+    header.headerSize = uint32_t(sizeof(header));
+    header.sourceHash = sourceHash;
+    auto offset = alignUp(sizeof(header));
+    for (size_t i = 0; i < size_t(Section::Count); i++) {
+        header.sections[i] = scenecache::SectionEntry{ offset, sources[i].size };
+        offset = alignUp(offset + sources[i].size);
+    }
+
+    // Written next to the cache and renamed over it, so a reader never maps a half written file.
+    auto temporaryPath = path + ".tmp";
+    auto file = std::fopen(temporaryPath.c_str(), "wb");
+    if (!file) {
+        fmt::print(stderr, "Could not open {} for writing\n", temporaryPath);
+        return false;
+    }
+    const char padding[scenecache::SECTION_ALIGNMENT] = {};
+    auto written = uint64_t(0);
+    auto write = [&](const void *data, size_t size) {
+        written += size;
+        return size == 0 || std::fwrite(data, 1, size, file) == size;
+    };
+    auto ok = write(&header, sizeof(header));
+    for (size_t i = 0; i < size_t(Section::Count) && ok; i++) {
+        ok = write(padding, size_t(header.sections[i].offset - written)) && write(sources[i].data, sources[i].size);
+    }
+    ok = std::fclose(file) == 0 && ok;
+
+    auto error = std::error_code();
+    if (ok) {
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+    if (!ok || error) {
+        std::filesystem::remove(temporaryPath, error);
+        fmt::print(stderr, "Could not write {}\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool CompiledScene::loadCache(const std::string &path, uint64_t sourceHash) {
+    using scenecache::Section;
+
+    auto error = std::error_code();
+    if (!std::filesystem::exists(path, error)) {
+        return false;
+    }
+    auto file = MappedFile::open(path);
+    if (!file) {
+        return false;
+    }
+
+    auto header = scenecache::Header();
+    if (file->size() < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, scenecache::MAGIC, sizeof(header.magic)) != 0 || header.version != scenecache::VERSION ||
+        header.headerSize != sizeof(header) || header.sourceHash != sourceHash) {
+        return false;
+    }
+
+    auto sectionsValid = true;
+    auto section = [&](Section name, size_t elementSize) {
+        const auto &entry = header.sections[size_t(name)];
+        if (entry.offset % scenecache::SECTION_ALIGNMENT != 0 || entry.offset > file->size() ||
+            entry.size > file->size() - entry.offset || entry.size % elementSize != 0) {
+            sectionsValid = false;
+            return std::make_pair(static_cast<const char *>(nullptr), size_t(0));
+        }
+        return std::make_pair(file->data() + entry.offset, size_t(entry.size / elementSize));
+    };
+    auto floats = [&](Section name) {
+        auto [data, count] = section(name, sizeof(float));
+        return ArrayView<float>(reinterpret_cast<const float *>(data), count);
+    };
+    auto indices = [&](Section name) {
+        auto [data, count] = section(name, sizeof(uint32_t));
+        return ArrayView<uint32_t>(reinterpret_cast<const uint32_t *>(data), count);
+    };
+
+    auto spheres = SphereArrays<ArrayView>{
+        floats(Section::SphereCenterX), floats(Section::SphereCenterY), floats(Section::SphereCenterZ),
+        floats(Section::SphereRadius), indices(Section::SphereMaterialIndex)
+    };
+    auto triangles = TriangleArrays<ArrayView>{
+        floats(Section::TriangleVertex0X), floats(Section::TriangleVertex0Y), floats(Section::TriangleVertex0Z),
+        floats(Section::TriangleEdge1X), floats(Section::TriangleEdge1Y), floats(Section::TriangleEdge1Z),
+        floats(Section::TriangleEdge2X), floats(Section::TriangleEdge2Y), floats(Section::TriangleEdge2Z),
+        indices(Section::TriangleMaterialIndex)
+    };
+    auto [nodeData, nodeCount] = section(Section::BvhNodes, sizeof(BvhNode));
+    auto nodes = ArrayView<BvhNode>(reinterpret_cast<const BvhNode *>(nodeData), nodeCount);
+    auto [materialData, materialCount] = section(Section::Materials, sizeof(scenecache::MaterialRecord));
+    auto [geometryNodeData, geometryNodeCount] = section(Section::GeometryNodes, sizeof(BvhNode));
+    auto geometryNodes = ArrayView<BvhNode>(reinterpret_cast<const BvhNode *>(geometryNodeData), geometryNodeCount);
+    auto [geometryData, geometryCount] = section(Section::Geometries, sizeof(scenecache::GeometryRecord));
+    auto [instanceData, instanceCount] = section(Section::Instances, sizeof(scenecache::InstanceRecord));
+    if (!sectionsValid) {
+        return false;
+    }
+
+    auto sphereCount = spheres.radius.size();
+    auto triangleCount = triangles.edge1X.size();
+    for (auto values : { spheres.centerX, spheres.centerY, spheres.centerZ }) {
+        sectionsValid = sectionsValid && values.size() == sphereCount;
+    }
+    for (auto values : { triangles.vertex0X, triangles.vertex0Y, triangles.vertex0Z, triangles.edge1Y, triangles.edge1Z,
+                         triangles.edge2X, triangles.edge2Y, triangles.edge2Z }) {
+        sectionsValid = sectionsValid && values.size() == triangleCount;
+    }
+    sectionsValid = sectionsValid && spheres.materialIndex.size() == sphereCount && triangles.materialIndex.size() == triangleCount;
+    for (auto materialIndices : { spheres.materialIndex, triangles.materialIndex }) {
+        sectionsValid = sectionsValid && std::all_of(materialIndices.begin(), materialIndices.end(),
+            [materialCount = materialCount](uint32_t index) { return index < materialCount; });
+    }
+    sectionsValid = sectionsValid && validNodes(nodes, sphereCount, triangleCount, instanceCount);
+
+    // Every geometry's nodes are checked like the scene's, against its own primitives.
+    auto geometries = std::vector<Geometry>();
+    for (size_t i = 0; i < geometryCount && sectionsValid; i++) {
+        auto record = scenecache::GeometryRecord();
+        std::memcpy(&record, geometryData + i * sizeof(record), sizeof(record));
+        sectionsValid = record.firstNode <= geometryNodes.size() && record.nodeCount <= geometryNodes.size() - record.firstNode &&
+            uint64_t(record.firstSphere) + record.sphereCount <= sphereCount &&
+            uint64_t(record.firstTriangle) + record.triangleCount <= triangleCount;
+        if (!sectionsValid) {
+            break;
+        }
+        auto nodeView = ArrayView<BvhNode>(geometryNodes.data() + record.firstNode, size_t(record.nodeCount));
+        sectionsValid = !nodeView.empty() && validNodes(nodeView, record.sphereCount, record.triangleCount, 0);
+        auto geometry = Geometry();
+        geometry.bvh.attach(nodeView);
+        geometry.firstSphere = record.firstSphere;
+        geometry.sphereCount = record.sphereCount;
+        geometry.firstTriangle = record.firstTriangle;
+        geometry.triangleCount = record.triangleCount;
+        geometries.push_back(std::move(geometry));
+    }
+    auto instances = std::vector<Instance>();
+    for (size_t i = 0; i < instanceCount && sectionsValid; i++) {
+        auto record = scenecache::InstanceRecord();
+        std::memcpy(&record, instanceData + i * sizeof(record), sizeof(record));
+        sectionsValid = record.geometry < geometryCount && record.scale > 0.0f && std::isfinite(record.scale) &&
+            (record.materialIndex == InstancePrimitive::NO_MATERIAL || record.materialIndex < materialCount);
+        auto instance = Instance();
+        instance.geometry = record.geometry;
+        instance.materialIndex = record.materialIndex;
+        instance.setTransform(Transform{ Vec3(record.translation[0], record.translation[1], record.translation[2]), record.scale, record.yaw });
+        instances.push_back(instance);
+    }
+    if (!sectionsValid) {
+        fmt::print(stderr, "Ignoring damaged scene cache {}\n", path);
+        return false;
+    }
+
+    auto materials = std::vector<Material>();
+    for (size_t i = 0; i < materialCount; i++) {
+        auto record = scenecache::MaterialRecord();
+        std::memcpy(&record, materialData + i * sizeof(record), sizeof(record));
+        auto material = Material(Radiance(record.color[0], record.color[1], record.color[2])).setRoughness(record.roughness);
+        if (record.flags & scenecache::MATERIAL_EMITS) {
+            material = material.setEmittingColor(Radiance(record.emittingColor[0], record.emittingColor[1], record.emittingColor[2]));
+        }
+        if (record.flags & scenecache::MATERIAL_REFLECTS) {
+            material = material.setReflectingPercent(record.reflectionPercent);
+        }
+        materials.push_back(material);
+    }
+
+    _sphereStorage = {};
+    _triangleStorage = {};
+    _spheres = spheres;
+    _triangles = triangles;
+    _materials = std::move(materials);
+    _bvh.attach(nodes);
+    _geometries = std::move(geometries);
+    _instances = std::move(instances);
+    // The scene's own primitives come before those of the geometries.
+    _ownSphereCount = uint32_t(sphereCount);
+    _ownTriangleCount = uint32_t(triangleCount);
+    for (const auto &geometry : _geometries) {
+        _ownSphereCount = std::min(_ownSphereCount, geometry.firstSphere);
+        _ownTriangleCount = std::min(_ownTriangleCount, geometry.firstTriangle);
+    }
+    _cacheFile = std::move(*file);
+    clearMotion();
+    return true;
+}
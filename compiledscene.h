@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cmath>
+#include <optional>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+#include "alignedallocator.h"
+#include "intersection.h"
+#include "hitrecord.h"
+#include "primitives.h"
+#include "material.h"
+#include "ray.h"
+#include "bvh.h"
+#include "arrayview.h"
+#include "mappedfile.h"
+#include "transform.h"
+
+// The scene as it is traced: primitives sorted by type into flat, aligned structure-of-arrays storage
+// in BVH leaf order, so a leaf is a contiguous run in one set of arrays and is intersected without
+// a virtual call. Triangles store their edges, not their other two vertices.
+// It is either built from a PrimitiveList or mapped from a cache file written after an earlier build.
+//
+// Shared geometries have a BVH of their own over their primitives, which are stored after the scene's own
+// ones. Their instances are leaves of the scene's BVH, rays that reach one are taken into the coordinates
+// of its geometry and traverse the geometry's BVH there.
+//
+// Groups of primitives of a built scene can be moved between frames. Only they are rewritten and only the
+// BVH nodes above them are refit, the rest of the scene stays as it is. Once refitting has made the BVH
+// too slow to trace, it is built again from the primitives where they are.
+class CompiledScene {
+public:
+    // Primitives that move together, by their index in the PrimitiveList given to build().
+    // Spheres, loose triangles and instances, not the triangles of meshes.
+    struct PrimitiveGroup {
+    public:
+        uint32_t firstSphere = 0;
+        uint32_t sphereCount = 0;
+        uint32_t firstTriangle = 0;
+        uint32_t triangleCount = 0;
+        uint32_t firstInstance = 0;
+        uint32_t instanceCount = 0;
+    };
+
+    // What updateMotion did.
+    struct MotionUpdate {
+    public:
+        size_t movedPrimitives = 0;
+        size_t refitNodes = 0;
+        bool rebuilt = false;
+    };
+
+private:
+    template<template<class> class Array>
+    struct SphereArrays {
+    public:
+        Array<float> centerX = {};
+        Array<float> centerY = {};
+        Array<float> centerZ = {};
+        Array<float> radius = {};
+        // Only read when resolving the winning hit.
+        Array<uint32_t> materialIndex = {};
+    };
+
+    template<template<class> class Array>
+    struct TriangleArrays {
+    public:
+        Array<float> vertex0X = {};
+        Array<float> vertex0Y = {};
+        Array<float> vertex0Z = {};
+        Array<float> edge1X = {};
+        Array<float> edge1Y = {};
+        Array<float> edge1Z = {};
+        Array<float> edge2X = {};
+        Array<float> edge2Y = {};
+        Array<float> edge2Z = {};
+        Array<uint32_t> materialIndex = {};
+    };
+
+    // Its primitives are [firstSphere, firstSphere + sphereCount) and [firstTriangle, firstTriangle + triangleCount)
+    // of the arrays below, its BVH leaves count from there.
+    struct Geometry {
+    public:
+        Bvh bvh = {};
+        uint32_t firstSphere = 0;
+        uint32_t sphereCount = 0;
+        uint32_t firstTriangle = 0;
+        uint32_t triangleCount = 0;
+    };
+
+    struct Instance {
+    public:
+        Transform transform = {};
+        // Of the transform, worked out once for all the rays taken into the geometry.
+        float cosYaw = 1.0f;
+        float sinYaw = 0.0f;
+        float inverseScale = 1.0f;
+        uint32_t geometry = 0;
+        uint32_t materialIndex = InstancePrimitive::NO_MATERIAL;
+
+        void setTransform(const Transform &placement) {
+            transform = placement;
+            cosYaw = std::cos(placement.yaw);
+            sinYaw = std::sin(placement.yaw);
+            inverseScale = 1.0f / placement.scale;
+        }
+        // Into the coordinates of the geometry. Distances there are shorter by the scale.
+        Ray toGeometry(const Ray &ray) const { return Ray(pointToGeometry(ray.origin()), directionToGeometry(ray.direction())); }
+        Vec3 pointToGeometry(Vec3 point) const { return directionToGeometry(point - transform.translation) * inverseScale; }
+        // Only turned, the length stays.
+        Vec3 directionToGeometry(Vec3 direction) const {
+            return Vec3(cosYaw * direction.x - sinYaw * direction.z, direction.y, cosYaw * direction.z + sinYaw * direction.x);
+        }
+        Vec3 directionToScene(Vec3 direction) const {
+            return Vec3(cosYaw * direction.x + sinYaw * direction.z, direction.y, cosYaw * direction.z - sinYaw * direction.x);
+        }
+    };
+
+    // Filled by build(), empty when the scene comes from a cache file.
+    SphereArrays<AlignedVector> _sphereStorage = {};
+    TriangleArrays<AlignedVector> _triangleStorage = {};
+    MappedFile _cacheFile = {};
+
+    // What is traced: views of the storage above, or of the mapped cache file.
+    SphereArrays<ArrayView> _spheres = {};
+    TriangleArrays<ArrayView> _triangles = {};
+    std::vector<Material> _materials = {};
+    // Over the scene's own spheres and triangles, which come first in the arrays, and the instances.
+    Bvh _bvh = {};
+    uint32_t _ownSphereCount = 0;
+    uint32_t _ownTriangleCount = 0;
+    std::vector<Geometry> _geometries = {};
+    // In the order of the leaves of _bvh, like the primitives.
+    std::vector<Instance> _instances = {};
+
+    // The geometry of moving primitives relative to their group, and where they are in the arrays above.
+    struct MovingSphere {
+    public:
+        uint32_t index = 0;
+        Vec3 center = {};
+        float radius = 0.0f;
+    };
+    struct MovingTriangle {
+    public:
+        uint32_t index = 0;
+        Vec3 vertex0 = {};
+        Vec3 edge1 = {};
+        Vec3 edge2 = {};
+    };
+    struct MovingInstance {
+    public:
+        uint32_t index = 0;
+        Transform transform = {};
+    };
+    struct MovingGroup {
+    public:
+        Transform transform = {};
+        size_t firstSphere = 0;
+        size_t sphereCount = 0;
+        size_t firstTriangle = 0;
+        size_t triangleCount = 0;
+        size_t firstInstance = 0;
+        size_t instanceCount = 0;
+    };
+    std::vector<MovingSphere> _movingSpheres = {};
+    std::vector<MovingTriangle> _movingTriangles = {};
+    std::vector<MovingInstance> _movingInstances = {};
+    std::vector<MovingGroup> _movingGroups = {};
+    // The leaf of every sphere, triangle and instance of _bvh, only kept once something can move.
+    std::vector<uint32_t> _sphereLeaves = {};
+    std::vector<uint32_t> _triangleLeaves = {};
+    std::vector<uint32_t> _instanceLeaves = {};
+    // Since the last updateMotion.
+    std::vector<uint32_t> _movedLeaves = {};
+    size_t _movedPrimitives = 0;
+
+public:
+    CompiledScene() = default;
+    // The views would point into the other scene.
+    CompiledScene(const CompiledScene &) = delete;
+    CompiledScene &operator=(const CompiledScene &) = delete;
+
+    void build(const PrimitiveList &primitives);
+
+    // Writes the compiled scene, ready to be traced, see scenecache.h. sourceHash identifies what it was built from.
+    bool saveCache(const std::string &path, uint64_t sourceHash) const;
+    // Maps a cache written by saveCache and traces it in place. Returns false, leaving the scene as it was,
+    // if there is no cache, it is of another version or source, or it is damaged.
+    bool loadCache(const std::string &path, uint64_t sourceHash);
+
+    // Stored ones, the scene's own and those of the geometries once.
+    size_t sphereCount() const { return _spheres.radius.size(); }
+    size_t triangleCount() const { return _triangles.edge1X.size(); }
+    size_t geometryCount() const { return _geometries.size(); }
+    size_t instanceCount() const { return _instances.size(); }
+    // The scene's own triangles and those every instance places.
+    size_t placedTriangleCount() const;
+    const std::vector<Material> &materials() const { return _materials; }
+
+    // Closest hit closer than tMax, as a HitRecord which does not hit anything if there is none.
+    HitRecord intersect(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const;
+    // Works out position, normal and material of a hit returned by intersect() for the same ray.
+    Intersection resolve(const Ray &ray, const HitRecord &hit) const;
+
+    // Lets the primitives of group be moved with moveGroup, their geometry at build time is placed by a
+    // Transform whose translation is pivot. Returns the number of the group, nothing if the scene was mapped
+    // from a cache and cannot be changed.
+    std::optional<size_t> addMovingGroup(const PrimitiveGroup &group, Vec3 pivot);
+    // Places the primitives of a moving group, if the transform changed. Tracing sees them right away, but
+    // must not run at the same time. The BVH only fits them again with updateMotion.
+    void moveGroup(size_t group, const Transform &transform);
+    // Refits the BVH above what moved since the last update, or builds it again if refitting made it too slow.
+    MotionUpdate updateMotion();
+
+    // Same contracts as Scene::closestHit and Scene::occluded.
+    std::optional<Intersection> closestHit(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const;
+    bool occluded(const Ray &ray, float tMax) const;
+
+private:
+    BoundingBox sphereBounds(uint32_t index) const;
+    BoundingBox triangleBounds(uint32_t index) const;
+    BoundingBox instanceBounds(uint32_t index) const;
+    // Builds the BVH over the primitives where they are now and lays them out in its order again.
+    void rebuild();
+    void updateLeaves();
+    void clearMotion();
+
+    static SphereArrays<ArrayView> viewOf(const SphereArrays<AlignedVector> &spheres);
+    static TriangleArrays<ArrayView> viewOf(const TriangleArrays<AlignedVector> &triangles);
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cassert>
+
+// Bounded multi-producer multi-consumer queue without locks (after Dmitry Vyukov).
+// Every cell carries a sequence number that tells producers and consumers whose turn it is,
+// so each operation is a single compare-and-swap on the respective position.
+template<class T>
+class ConcurrentQueue {
+    struct alignas(64) Cell {
+    public:
+        std::atomic<size_t> sequence = 0;
+        T data = {};
+    };
+
+    std::unique_ptr<Cell[]> _cells = {};
+    size_t _mask = 0;
+    alignas(64) std::atomic<size_t> _enqueuePosition = 0;
+    alignas(64) std::atomic<size_t> _dequeuePosition = 0;
+
+public:
+    // capacity has to be a power of two.
+    explicit ConcurrentQueue(size_t capacity)
+        : _cells(std::make_unique<Cell[]>(capacity)), _mask(capacity - 1) {
+        assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+        for (size_t i = 0; i < capacity; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentQueue(const ConcurrentQueue &) = delete;
+    ConcurrentQueue &operator=(const ConcurrentQueue &) = delete;
+
+    // Returns false if the queue is full.
+    bool tryPush(const T &value) {
+        auto position = _enqueuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = _cells[position & _mask];
+            auto sequence = cell.sequence.load(std::memory_order_acquire);
+            auto difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0) {
+                if (_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.data = value;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = _enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false if the queue is empty.
+    bool tryPop(T &value) {
+        auto position = _dequeuePosition.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = _cells[position & _mask];
+            auto sequence = cell.sequence.load(std::memory_order_acquire);
+            auto difference = intptr_t(sequence) - intptr_t(position + 1);
+            if (difference == 0) {
+                if (_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = cell.data;
+                    cell.sequence.store(position + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0) {
+                return false;
+            }
+            else {
+                position = _dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
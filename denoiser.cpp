@@ -0,0 +1,147 @@
+#include "denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace {
+    const int ITERATIONS = 5;
+    const int TILE_SIZE = 64;
+    // B3 spline, by the distance of the tap from the center.
+    const float KERNEL[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+    // The cosine between normals is raised to 2 to the power of this, 128.
+    const int NORMAL_POWER_OF_TWO = 7;
+    // Depth difference that costs a factor of e in weight, relative to the depth and per step between taps.
+    const float DEPTH_SIGMA = 0.02f;
+    // Luminance difference in standard deviations of the pixel's noise.
+    const float LUMINANCE_SIGMA = 4.0f;
+    const float ALBEDO_SIGMA = 0.1f;
+    // Below this the albedo is not divided out, there is hardly any light to filter.
+    const float MIN_ALBEDO = 0.01f;
+
+    struct Guide {
+    public:
+        Radiance albedo = {};
+        // Unit length, or zero for the background.
+        Vec3 normal = {};
+        float depth = 0.0f;
+    };
+
+    // Runs filterTile on every tile and waits until all of them are done.
+    void runTiles(TileScheduler &scheduler, const std::vector<Tile> &tiles, TileScheduler::TileFunction filterTile) {
+        scheduler.submit(tiles, std::move(filterTile));
+        auto tile = Tile();
+        while (true) {
+            auto done = scheduler.idle();
+            while (scheduler.popCompleted(tile)) {
+            }
+            if (done) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    Radiance clampedAlbedo(Radiance albedo) {
+        return Radiance(std::max(albedo[0], MIN_ALBEDO), std::max(albedo[1], MIN_ALBEDO), std::max(albedo[2], MIN_ALBEDO));
+    }
+
+    float normalWeight(Vec3 a, Vec3 b) {
+        auto aIsBackground = a.dot(a) == 0.0f;
+        auto bIsBackground = b.dot(b) == 0.0f;
+        if (aIsBackground || bIsBackground) {
+            return aIsBackground == bIsBackground ? 1.0f : 0.0f;
+        }
+        auto weight = std::max(a.dot(b), 0.0f);
+        for (auto i = 0; i < NORMAL_POWER_OF_TWO; i++) {
+            weight *= weight;
+        }
+        return weight;
+    }
+}
+
+std::vector<Radiance> denoiser::denoise(const Framebuffer &framebuffer, TileScheduler &scheduler) {
+    auto width = framebuffer.width();
+    auto height = framebuffer.height();
+    auto pixelCount = size_t(width) * height;
+
+    auto guides = std::vector<Guide>(pixelCount);
+    auto illumination = std::vector<Radiance>(pixelCount);
+    auto variance = std::vector<float>(pixelCount);
+    for (auto y = 0; y < height; y++) {
+        for (auto x = 0; x < width; x++) {
+            auto index = size_t(y) * width + x;
+            auto features = framebuffer.features(x, y);
+            auto &guide = guides[index];
+            guide.albedo = clampedAlbedo(features.albedo);
+            guide.normal = features.normal.length() > 0.0f ? features.normal.normalize() : Vec3();
+            guide.depth = features.depth;
+
+            illumination[index] = framebuffer.average(x, y) / guide.albedo;
+            // Of the mean, in the units of the illumination.
+            const auto &statistics = framebuffer.statistics(x, y);
+            auto albedoLuminance = PixelStatistics::luminance(guide.albedo);
+            variance[index] = statistics.count > 0
+                ? statistics.variance() / float(statistics.count) / (albedoLuminance * albedoLuminance)
+                : 0.0f;
+        }
+    }
+
+    auto tiles = tileutils::splitIntoTiles(Tile{ 0, 0, width, height }, TILE_SIZE);
+    auto filtered = std::vector<Radiance>(pixelCount);
+    auto filteredVariance = std::vector<float>(pixelCount);
+    for (auto iteration = 0; iteration < ITERATIONS; iteration++) {
+        auto step = 1 << iteration;
+        runTiles(scheduler, tiles, [&](const Tile &tile) {
+            for (auto y = tile.y0; y < tile.y1; y++) {
+                for (auto x = tile.x0; x < tile.x1; x++) {
+                    auto index = size_t(y) * width + x;
+                    const auto &center = guides[index];
+                    auto centerLuminance = PixelStatistics::luminance(illumination[index]);
+                    auto luminanceScale = LUMINANCE_SIGMA * std::sqrt(std::max(variance[index], 0.0f)) + 1e-4f;
+                    auto depthScale = DEPTH_SIGMA * float(step) * std::max(center.depth, 1e-3f);
+
+                    auto sum = Radiance();
+                    auto weightSum = 0.0f;
+                    auto varianceSum = 0.0f;
+                    for (auto dy = -2; dy <= 2; dy++) {
+                        auto sampleY = y + dy * step;
+                        if (sampleY < 0 || sampleY >= height) {
+                            continue;
+                        }
+                        for (auto dx = -2; dx <= 2; dx++) {
+                            auto sampleX = x + dx * step;
+                            if (sampleX < 0 || sampleX >= width) {
+                                continue;
+                            }
+                            auto sampleIndex = size_t(sampleY) * width + sampleX;
+                            const auto &guide = guides[sampleIndex];
+
+                            auto albedoDifference = center.albedo - guide.albedo;
+                            auto luminanceDifference = std::abs(centerLuminance - PixelStatistics::luminance(illumination[sampleIndex]));
+                            auto weight = KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)] *
+                                normalWeight(center.normal, guide.normal) *
+                                std::exp(-std::abs(center.depth - guide.depth) / depthScale
+                                    - luminanceDifference / luminanceScale
+                                    - albedoDifference.dot(albedoDifference) / (ALBEDO_SIGMA * ALBEDO_SIGMA));
+
+                            sum += illumination[sampleIndex] * weight;
+                            weightSum += weight;
+                            varianceSum += weight * weight * variance[sampleIndex];
+                        }
+                    }
+                    // The center tap always has weight, the sums are never zero.
+                    filtered[index] = sum / weightSum;
+                    filteredVariance[index] = varianceSum / (weightSum * weightSum);
+                }
+            }
+        });
+        std::swap(illumination, filtered);
+        std::swap(variance, filteredVariance);
+    }
+
+    for (size_t i = 0; i < pixelCount; i++) {
+        illumination[i] = illumination[i] * guides[i].albedo;
+    }
+    return illumination;
+}
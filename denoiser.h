@@ -0,0 +1,19 @@
+#pragma once
+
+#include <vector>
+
+#include "vec3.h"
+#include "framebuffer.h"
+#include "tilescheduler.h"
+
+// Edge-avoiding À-trous wavelet filter (Dammertz et al. 2010) with variance guided luminance weights
+// (Schied et al. 2017). It filters the illumination, the radiance divided by the first hit albedo, so colors
+// and textures stay sharp, and multiplies the albedo back in at the end. Normals, depth and albedo of the
+// first hits keep it from blurring across edges, the sample variance of every pixel tells it how much
+// of a luminance difference is just noise.
+// Every iteration spreads the taps of a 5x5 kernel twice as far apart, so five of them reach 61 pixels
+// wide at 25 taps per pixel each.
+namespace denoiser {
+    // Row by row. Every iteration runs over tiles on the workers of the scheduler, which must be idle.
+    std::vector<Radiance> denoise(const Framebuffer &framebuffer, TileScheduler &scheduler);
+}
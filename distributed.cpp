@@ -0,0 +1,493 @@
+#include "distributed.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+
+#include "tcpsocket.h"
+#include "tilescheduler.h"
+#include "mappedfile.h"
+#include "renderer.h"
+#include "wavefront.h"
+
+namespace {
+    // Bump whenever a record below or the meaning of a message changes.
+    const uint32_t PROTOCOL_VERSION = 4;
+    const int TILE_SIZE = 32;
+    // Samples per pixel of one task. Larger tasks send less per sample, smaller ones lose less when a worker dies.
+    const int SAMPLES_PER_TASK = 64;
+    // A worker gets this many tasks per thread, so it has the next one at hand while a result is on its way.
+    const size_t TASKS_PER_THREAD = 2;
+    const int POLL_MILLISECONDS = 10;
+    // Workers say they are alive this often while they render.
+    const auto HEARTBEAT_INTERVAL = std::chrono::seconds(1);
+    // A worker that was not heard from for this long is taken for dead, also if its connection looks fine.
+    const auto WORKER_TIMEOUT = std::chrono::seconds(30);
+
+    enum class MessageType : uint32_t {
+        // Worker to coordinator, a HelloRecord.
+        Hello,
+        // Coordinator to worker, a JobRecord followed by the compiled scene cache.
+        Job,
+        // Coordinator to worker, a TaskRecord.
+        Task,
+        // Worker to coordinator, the TaskRecord followed by a PixelRecord per pixel of the tile, row by row.
+        Result,
+        // Coordinator to worker, the frame is done.
+        Finish,
+        // Worker to coordinator, no payload, every HEARTBEAT_INTERVAL.
+        Heartbeat
+    };
+
+    struct HelloRecord {
+    public:
+        uint32_t version = 0;
+        uint32_t threads = 0;
+    };
+
+    struct JobRecord {
+    public:
+        uint32_t version = 0;
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t maxDepth = 0;
+        int32_t seed = 0;
+        uint32_t sampler = 0;
+        uint32_t engine = 0;
+        uint32_t sceneType = 0;
+        uint32_t hasCameraPosition = 0;
+        float cameraPosition[3] = {};
+        uint32_t hasCameraTarget = 0;
+        float cameraTarget[3] = {};
+        // 0 for the scene camera's.
+        float fieldOfView = 0.0f;
+        uint64_t sourceHash = 0;
+    };
+
+    struct TaskRecord {
+    public:
+        uint32_t id = 0;
+        int32_t x0 = 0;
+        int32_t y0 = 0;
+        int32_t x1 = 0;
+        int32_t y1 = 0;
+        int32_t firstSample = 0;
+        int32_t sampleCount = 0;
+
+        Tile tile() const { return Tile{ x0, y0, x1, y1 }; }
+    };
+
+    std::string temporaryPath(const std::string &name) {
+        auto error = std::error_code();
+        auto directory = std::filesystem::temp_directory_path(error);
+        return (error ? std::filesystem::path(name) : directory / name).string();
+    }
+
+    bool writeFile(const std::string &path, const char *data, size_t size) {
+        auto file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            fmt::print(stderr, "Could not open {} for writing\n", path);
+            return false;
+        }
+        auto ok = size == 0 || std::fwrite(data, 1, size, file) == size;
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok) {
+            fmt::print(stderr, "Could not write {}\n", path);
+        }
+        return ok;
+    }
+
+    // The compiled scene as the cache file the workers map, see scenecache.h.
+    std::optional<std::vector<char>> serializeScene(const Scene &scene, int port) {
+        auto path = temporaryPath(fmt::format("pathtracer-coordinator-{}.scene", port));
+        if (!scene.compiledScene().saveCache(path, scene.sourceHash())) {
+            return std::optional<std::vector<char>>();
+        }
+        auto data = std::vector<char>();
+        if (auto file = MappedFile::open(path)) {
+            data.assign(file->data(), file->data() + file->size());
+        }
+        auto error = std::error_code();
+        std::filesystem::remove(path, error);
+        return data;
+    }
+
+    struct Task {
+    public:
+        Tile tile = {};
+        int firstSample = 0;
+        int sampleCount = 0;
+    };
+
+    struct Connection {
+    public:
+        TcpSocket socket = {};
+        int id = 0;
+        // Tasks it is sent at once, 0 until it said hello and got the job.
+        size_t capacity = 0;
+        // Sent but not returned yet.
+        std::vector<uint32_t> tasks = {};
+        // The message coming in, read as it arrives.
+        TcpSocket::PartialMessage incoming = {};
+        std::chrono::steady_clock::time_point lastHeard = {};
+        bool failed = false;
+    };
+
+    // Takes the next task after the worker's last one. Never two tasks of one tile at once, the worker
+    // would add both to the same pixels.
+    std::deque<uint32_t>::iterator nextTaskFor(const Connection &connection, std::deque<uint32_t> &pending,
+        const std::vector<Task> &tasks) {
+        return std::find_if(pending.begin(), pending.end(), [&](uint32_t candidate) {
+            const auto &tile = tasks[candidate].tile;
+            return std::none_of(connection.tasks.begin(), connection.tasks.end(), [&](uint32_t busy) {
+                return tasks[busy].tile.x0 == tile.x0 && tasks[busy].tile.y0 == tile.y0;
+            });
+        });
+    }
+
+    // Renders tasks until the coordinator says the frame is done. False if the connection breaks before.
+    bool renderTasks(TcpSocket &socket, TileScheduler &scheduler, const RenderOptions &localOptions, const JobRecord &job,
+        const std::string &scenePath) {
+        auto scene = Scene();
+        if (!scene.initializeFromCache(SceneType(job.sceneType), scenePath, job.sourceHash)) {
+            return false;
+        }
+        auto options = localOptions;
+        options.width = job.width;
+        options.height = job.height;
+        options.maxDepth = job.maxDepth;
+        options.seed = job.seed;
+        options.samplerType = SamplerType(job.sampler);
+        options.engine = Engine(job.engine);
+        if (job.hasCameraPosition) {
+            options.cameraPosition = Vec3(job.cameraPosition[0], job.cameraPosition[1], job.cameraPosition[2]);
+        }
+        if (job.hasCameraTarget) {
+            options.cameraTarget = Vec3(job.cameraTarget[0], job.cameraTarget[1], job.cameraTarget[2]);
+        }
+        if (job.fieldOfView != 0.0f) {
+            options.fieldOfView = job.fieldOfView;
+        }
+        fmt::print("Rendering {}x{} pixels for {}:{} on {} threads\n", options.width, options.height,
+            options.workerHost, options.workerPort, scheduler.workerCount());
+
+        auto camera = renderCamera(options, scene);
+        // Only holds the tiles of the tasks in flight, every pixel is sent off and cleared once its task is done.
+        auto framebuffer = Framebuffer(options.width, options.height);
+        const auto allPixels = std::vector<uint8_t>();
+        std::mutex sendMutex;
+        auto sendFailed = std::atomic<bool>(false);
+        auto tasksDone = std::atomic<int>(0);
+
+        auto renderTask = [&](const TaskRecord &task) {
+            auto tile = task.tile();
+            if (options.engine == Engine::Wavefront) {
+                // One per worker, so its queues are only allocated for the first tile.
+                static thread_local WavefrontRenderer wavefront;
+                wavefront.renderTile(tile, task.firstSample, task.sampleCount, allPixels, options, scene, framebuffer);
+            }
+            else {
+                for (auto y = tile.y0; y < tile.y1; y++) {
+                    for (auto x = tile.x0; x < tile.x1; x++) {
+                        auto pixel = renderPixel(x, y, task.firstSample, task.sampleCount, camera, options, scene);
+                        framebuffer.add(pixel.x, pixel.y, pixel.radianceSum, pixel.statistics, pixel.featureSum);
+                    }
+                }
+            }
+
+            auto pixels = std::vector<PixelRecord>();
+            pixels.reserve(size_t(tile.width()) * tile.height());
+            for (auto y = tile.y0; y < tile.y1; y++) {
+                for (auto x = tile.x0; x < tile.x1; x++) {
+                    pixels.push_back(framebuffer.record(x, y));
+                    framebuffer.clear(x, y);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (!sendFailed && !socket.sendMessage(uint32_t(MessageType::Result),
+                    { TcpSocket::Buffer{ &task, sizeof(task) }, TcpSocket::Buffer{ pixels.data(), pixels.size() * sizeof(PixelRecord) } })) {
+                sendFailed = true;
+            }
+            tasksDone++;
+        };
+
+        auto finished = false;
+        auto connected = true;
+        auto lastHeartbeat = std::chrono::steady_clock::now();
+        while (connected && !finished && !sendFailed) {
+            auto tile = Tile();
+            while (scheduler.popCompleted(tile)) {
+            }
+            if (std::chrono::steady_clock::now() - lastHeartbeat >= HEARTBEAT_INTERVAL) {
+                std::lock_guard<std::mutex> lock(sendMutex);
+                if (!sendFailed && !socket.sendMessage(uint32_t(MessageType::Heartbeat))) {
+                    sendFailed = true;
+                }
+                lastHeartbeat = std::chrono::steady_clock::now();
+            }
+            if (TcpSocket::poll({ &socket }, POLL_MILLISECONDS).empty()) {
+                continue;
+            }
+            auto message = socket.receiveMessage();
+            auto task = TaskRecord();
+            if (!message) {
+                connected = false;
+            }
+            else if (message->type == uint32_t(MessageType::Finish)) {
+                finished = true;
+            }
+            else if (message->type == uint32_t(MessageType::Task) && TcpSocket::readRecord(message->payload, task) &&
+                task.x0 >= 0 && task.y0 >= 0 && task.x0 < task.x1 && task.y0 < task.y1 &&
+                task.x1 <= options.width && task.y1 <= options.height && task.firstSample >= 0 && task.sampleCount > 0) {
+                scheduler.submit({ task.tile() }, [&renderTask, task](const Tile &) { renderTask(task); });
+            }
+            else {
+                fmt::print(stderr, "Got an unknown message from the coordinator\n");
+                connected = false;
+            }
+        }
+
+        // Tasks still running write to the framebuffer, their results have nowhere to go any more.
+        auto tile = Tile();
+        while (!scheduler.idle()) {
+            while (scheduler.popCompleted(tile)) {
+            }
+            std::this_thread::yield();
+        }
+        while (scheduler.popCompleted(tile)) {
+        }
+
+        if (!finished || sendFailed) {
+            fmt::print(stderr, "Lost the connection to the coordinator\n");
+            return false;
+        }
+        fmt::print("Rendered {} tasks, the frame is done\n", tasksDone.load());
+        return true;
+    }
+}
+
+bool distributed::renderAsCoordinator(const RenderOptions &options, const Scene &scene, Framebuffer &framebuffer) {
+    auto listener = TcpSocket::listen({}, options.coordinatorPort);
+    if (!listener) {
+        return false;
+    }
+    auto sceneData = serializeScene(scene, options.coordinatorPort);
+    if (!sceneData) {
+        return false;
+    }
+
+    auto job = JobRecord();
+    job.version = PROTOCOL_VERSION;
+    job.width = options.width;
+    job.height = options.height;
+    job.maxDepth = options.maxDepth;
+    job.seed = options.seed;
+    job.sampler = uint32_t(options.samplerType);
+    job.engine = uint32_t(options.engine);
+    job.sceneType = uint32_t(options.sceneType);
+    job.hasCameraPosition = options.cameraPosition.has_value();
+    if (options.cameraPosition) {
+        for (auto axis = 0; axis < 3; axis++) {
+            job.cameraPosition[axis] = (*options.cameraPosition)[axis];
+        }
+    }
+    job.hasCameraTarget = options.cameraTarget.has_value();
+    if (options.cameraTarget) {
+        for (auto axis = 0; axis < 3; axis++) {
+            job.cameraTarget[axis] = (*options.cameraTarget)[axis];
+        }
+    }
+    job.fieldOfView = options.fieldOfView.value_or(0.0f);
+    job.sourceHash = scene.sourceHash();
+
+    // Sample range by sample range, so the whole image fills in evenly.
+    auto tiles = tileutils::splitIntoTiles(Tile{ 0, 0, options.width, options.height }, TILE_SIZE);
+    auto tasks = std::vector<Task>();
+    for (auto firstSample = 0; firstSample < options.samplesPerPixel; firstSample += SAMPLES_PER_TASK) {
+        auto sampleCount = std::min(SAMPLES_PER_TASK, options.samplesPerPixel - firstSample);
+        for (const auto &tile : tiles) {
+            tasks.push_back(Task{ tile, firstSample, sampleCount });
+        }
+    }
+    auto pending = std::deque<uint32_t>();
+    for (size_t i = 0; i < tasks.size(); i++) {
+        pending.push_back(uint32_t(i));
+    }
+    auto tasksDone = size_t(0);
+
+    fmt::print("Waiting for workers on port {}, {}x{} pixels at {} samples in {} tasks, {:.1f} MB of scene each\n",
+        options.coordinatorPort, options.width, options.height, options.samplesPerPixel, tasks.size(),
+        sceneData->size() / 1'000'000.0);
+
+    auto connections = std::vector<std::unique_ptr<Connection>>();
+    auto nextWorkerId = 1;
+    auto fail = [](Connection &connection, const char *reason) {
+        if (!connection.failed) {
+            fmt::print(stderr, "Worker {} {}, its {} tasks go to the others\n", connection.id, reason, connection.tasks.size());
+        }
+        connection.failed = true;
+    };
+
+    auto handle = [&](Connection &connection, const TcpSocket::Message &message) {
+        if (message.type == uint32_t(MessageType::Heartbeat)) {
+            return;
+        }
+        if (message.type == uint32_t(MessageType::Hello)) {
+            auto hello = HelloRecord();
+            if (connection.capacity > 0 || !TcpSocket::readRecord(message.payload, hello) || hello.version != PROTOCOL_VERSION ||
+                hello.threads == 0) {
+                fail(connection, "speaks another protocol");
+                return;
+            }
+            if (!connection.socket.sendMessage(uint32_t(MessageType::Job),
+                    { TcpSocket::Buffer{ &job, sizeof(job) }, TcpSocket::Buffer{ sceneData->data(), sceneData->size() } })) {
+                fail(connection, "could not be sent the scene");
+                return;
+            }
+            connection.capacity = hello.threads * TASKS_PER_THREAD;
+            fmt::print("Worker {} joined with {} threads\n", connection.id, hello.threads);
+            return;
+        }
+
+        auto record = TaskRecord();
+        auto inFlight = connection.tasks.end();
+        if (message.type == uint32_t(MessageType::Result) && TcpSocket::readRecord(message.payload, record)) {
+            inFlight = std::find(connection.tasks.begin(), connection.tasks.end(), record.id);
+        }
+        if (inFlight == connection.tasks.end()) {
+            fail(connection, "sent an unknown message");
+            return;
+        }
+        const auto &tile = tasks[record.id].tile;
+        auto pixelCount = size_t(tile.width()) * tile.height();
+        if (message.payload.size() != sizeof(record) + pixelCount * sizeof(PixelRecord)) {
+            fail(connection, "sent a damaged result");
+            return;
+        }
+
+        auto offset = sizeof(record);
+        for (auto y = tile.y0; y < tile.y1; y++) {
+            for (auto x = tile.x0; x < tile.x1; x++) {
+                auto pixel = PixelRecord();
+                TcpSocket::readRecord(message.payload, pixel, offset);
+                offset += sizeof(pixel);
+                framebuffer.add(x, y, pixel);
+            }
+        }
+        connection.tasks.erase(inFlight);
+        tasksDone++;
+    };
+
+    auto lastProgressOutputTime = std::chrono::steady_clock::now();
+    while (tasksDone < tasks.size()) {
+        auto sockets = std::vector<TcpSocket *>{ &*listener };
+        for (auto &connection : connections) {
+            sockets.push_back(&connection->socket);
+        }
+        for (auto index : TcpSocket::poll(sockets, POLL_MILLISECONDS)) {
+            if (index == 0) {
+                if (auto socket = listener->accept()) {
+                    connections.push_back(std::make_unique<Connection>());
+                    connections.back()->socket = std::move(*socket);
+                    connections.back()->id = nextWorkerId++;
+                    connections.back()->lastHeard = std::chrono::steady_clock::now();
+                }
+                continue;
+            }
+            auto &connection = *connections[index - 1];
+            if (!connection.socket.receivePart(connection.incoming)) {
+                fail(connection, "disconnected");
+            }
+            else if (connection.incoming.complete()) {
+                auto message = std::move(connection.incoming.message);
+                connection.incoming = {};
+                connection.lastHeard = std::chrono::steady_clock::now();
+                handle(connection, message);
+            }
+        }
+
+        // Machines that hang or lose power do not close their connections.
+        auto now = std::chrono::steady_clock::now();
+        for (auto &connection : connections) {
+            if (now - connection->lastHeard > WORKER_TIMEOUT) {
+                fail(*connection, "stopped answering");
+            }
+        }
+
+        for (auto &connection : connections) {
+            while (!connection->failed && connection->tasks.size() < connection->capacity) {
+                auto next = nextTaskFor(*connection, pending, tasks);
+                if (next == pending.end()) {
+                    break;
+                }
+                const auto &task = tasks[*next];
+                auto record = TaskRecord{ *next, task.tile.x0, task.tile.y0, task.tile.x1, task.tile.y1, task.firstSample, task.sampleCount };
+                if (!connection->socket.sendRecord(uint32_t(MessageType::Task), record)) {
+                    fail(*connection, "disconnected");
+                    break;
+                }
+                connection->tasks.push_back(*next);
+                pending.erase(next);
+            }
+        }
+
+        // Their tasks go first, they are the oldest.
+        for (auto &connection : connections) {
+            if (connection->failed) {
+                pending.insert(pending.begin(), connection->tasks.begin(), connection->tasks.end());
+            }
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+            [](const std::unique_ptr<Connection> &connection) { return connection->failed; }), connections.end());
+
+        if (std::chrono::steady_clock::now() - lastProgressOutputTime > std::chrono::seconds(1)) {
+            fmt::print("{} of {} tasks done on {} workers\n", tasksDone, tasks.size(), connections.size());
+            lastProgressOutputTime = std::chrono::steady_clock::now();
+        }
+    }
+
+    for (auto &connection : connections) {
+        connection->socket.sendRecord(uint32_t(MessageType::Finish), uint32_t(0));
+    }
+    return true;
+}
+
+bool distributed::runWorker(const RenderOptions &options) {
+    auto socket = TcpSocket::connect(options.workerHost, options.workerPort);
+    if (!socket) {
+        return false;
+    }
+    TileScheduler scheduler(options.threads);
+    auto hello = HelloRecord{ PROTOCOL_VERSION, uint32_t(scheduler.workerCount()) };
+    auto message = socket->sendRecord(uint32_t(MessageType::Hello), hello) ? socket->receiveMessage() : std::optional<TcpSocket::Message>();
+    auto job = JobRecord();
+    if (!message || message->type != uint32_t(MessageType::Job) || !TcpSocket::readRecord(message->payload, job) ||
+        job.version != PROTOCOL_VERSION || job.width <= 0 || job.height <= 0 ||
+        job.sceneType > uint32_t(SceneType::Crowd) || job.engine > uint32_t(Engine::Wavefront) ||
+        job.sampler > uint32_t(SamplerType::Sobol)) {
+        fmt::print(stderr, "Did not get a job from {}:{}\n", options.workerHost, options.workerPort);
+        return false;
+    }
+
+    // Named after the connection, so workers on the same machine do not write over each other's scene.
+    auto scenePath = temporaryPath(fmt::format("pathtracer-worker-{}.scene", socket->localPort()));
+    if (!writeFile(scenePath, message->payload.data() + sizeof(job), message->payload.size() - sizeof(job))) {
+        return false;
+    }
+    message.reset();
+    auto ok = renderTasks(*socket, scheduler, options, job, scenePath);
+    auto error = std::error_code();
+    std::filesystem::remove(scenePath, error);
+    return ok;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "scene.h"
+#include "options.h"
+#include "framebuffer.h"
+
+// Renders one frame on several processes, usually on several machines.
+//
+// The coordinator listens for workers. Every worker that connects gets the scene once, as the compiled
+// scene cache (see scenecache.h), and the render settings. After that it only gets tasks: a tile and a range
+// of samples. It renders them on all its threads and sends back the sums, statistics and features of every
+// pixel, which the coordinator adds to its framebuffer. Samples only depend on the pixel and the sample
+// index, so the image is the same as a local render, up to the order in which the sums are added.
+//
+// Tasks of a worker whose connection breaks, or that stops sending heartbeats, go back into the queue and are
+// handed to the others. Workers can join at any time while the frame is rendering.
+namespace distributed {
+    // Renders the frame on the workers that connect to options.coordinatorPort. Returns once every sample
+    // is in the framebuffer, or false if the frame cannot be handed out.
+    bool renderAsCoordinator(const RenderOptions &options, const Scene &scene, Framebuffer &framebuffer);
+    // Renders for the coordinator at options.workerHost, with options.threads threads, until it says the
+    // frame is done. Returns false if the connection fails before that.
+    bool runWorker(const RenderOptions &options);
+}
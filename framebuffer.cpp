@@ -0,0 +1,58 @@
+#include "framebuffer.h"
+
+#include <algorithm>
+
+void Framebuffer::clear() {
+    std::fill(_sums.begin(), _sums.end(), Radiance());
+    std::fill(_statistics.begin(), _statistics.end(), PixelStatistics());
+    std::fill(_featureSums.begin(), _featureSums.end(), PixelFeatures());
+}
+
+void Framebuffer::copy(const Framebuffer &other, int x0, int y0, int x1, int y1) {
+    for (auto y = y0; y < y1; y++) {
+        auto first = size_t(y) * _width + x0;
+        auto last = size_t(y) * _width + x1;
+        std::copy(other._sums.begin() + first, other._sums.begin() + last, _sums.begin() + first);
+        std::copy(other._statistics.begin() + first, other._statistics.begin() + last, _statistics.begin() + first);
+        std::copy(other._featureSums.begin() + first, other._featureSums.begin() + last, _featureSums.begin() + first);
+    }
+}
+
+std::vector<Radiance> Framebuffer::averages() const {
+    auto pixels = std::vector<Radiance>();
+    pixels.reserve(size_t(_width) * _height);
+    for (auto y = 0; y < _height; y++) {
+        for (auto x = 0; x < _width; x++) {
+            pixels.push_back(average(x, y));
+        }
+    }
+    return pixels;
+}
+
+PixelRecord Framebuffer::record(int x, int y) const {
+    auto index = size_t(y) * _width + x;
+    auto record = PixelRecord();
+    const auto &features = _featureSums[index];
+    for (auto channel = 0; channel < 3; channel++) {
+        record.sum[channel] = _sums[index][channel];
+        record.albedo[channel] = features.albedo[channel];
+        record.normal[channel] = features.normal[channel];
+    }
+    record.count = _statistics[index].count;
+    record.mean = _statistics[index].mean;
+    record.m2 = _statistics[index].m2;
+    record.depth = features.depth;
+    return record;
+}
+
+void Framebuffer::add(int x, int y, const PixelRecord &record) {
+    auto statistics = PixelStatistics();
+    statistics.count = record.count;
+    statistics.mean = record.mean;
+    statistics.m2 = record.m2;
+    auto features = PixelFeatures();
+    features.albedo = Radiance(record.albedo[0], record.albedo[1], record.albedo[2]);
+    features.normal = Vec3(record.normal[0], record.normal[1], record.normal[2]);
+    features.depth = record.depth;
+    add(x, y, Radiance(record.sum[0], record.sum[1], record.sum[2]), statistics, features);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "vec3.h"
+#include "pixelstatistics.h"
+#include "pixelfeatures.h"
+
+// One framebuffer pixel in plain floats, for files and the network. Vec3 may be padded for SIMD.
+struct PixelRecord {
+public:
+    float sum[3] = {};
+    int32_t count = 0;
+    float mean = 0.0f;
+    float m2 = 0.0f;
+    float albedo[3] = {};
+    float normal[3] = {};
+    float depth = 0.0f;
+};
+
+// Float accumulation buffer. Every pixel holds the sum of all samples taken so far, their statistics and
+// the sum of their first hit features, so passes can be added in any order and the image can be shown
+// after each of them.
+class Framebuffer {
+    int _width = 0;
+    int _height = 0;
+    std::vector<Radiance> _sums = {};
+    std::vector<PixelStatistics> _statistics = {};
+    std::vector<PixelFeatures> _featureSums = {};
+
+public:
+    Framebuffer() = default;
+    Framebuffer(int width, int height)
+        : _width(width), _height(height), _sums(size_t(width) * height), _statistics(size_t(width) * height),
+          _featureSums(size_t(width) * height) {}
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    // statistics and featureSum are of the samples that make up sampleSum.
+    void add(int x, int y, Radiance sampleSum, const PixelStatistics &statistics, const PixelFeatures &featureSum) {
+        auto index = size_t(y) * _width + x;
+        _sums[index] += sampleSum;
+        _statistics[index].merge(statistics);
+        _featureSums[index] += featureSum;
+    }
+
+    int sampleCount(int x, int y) const { return _statistics[size_t(y) * _width + x].count; }
+    const PixelStatistics &statistics(int x, int y) const { return _statistics[size_t(y) * _width + x]; }
+    Radiance sum(int x, int y) const { return _sums[size_t(y) * _width + x]; }
+    const PixelFeatures &featureSum(int x, int y) const { return _featureSums[size_t(y) * _width + x]; }
+
+    // Mean of all samples of the pixel, black if it has none yet.
+    Radiance average(int x, int y) const {
+        auto index = size_t(y) * _width + x;
+        auto count = _statistics[index].count;
+        return count > 0 ? _sums[index] / float(count) : Radiance();
+    }
+
+    // The mean of every pixel, row by row.
+    std::vector<Radiance> averages() const;
+
+    // Mean features of all samples of the pixel, all zero if it has none yet.
+    PixelFeatures features(int x, int y) const {
+        auto index = size_t(y) * _width + x;
+        auto count = _statistics[index].count;
+        return count > 0 ? _featureSums[index] / float(count) : PixelFeatures();
+    }
+
+    PixelRecord record(int x, int y) const;
+    // Adds the samples of a record like add() above, into an empty pixel exactly as they were.
+    void add(int x, int y, const PixelRecord &record);
+
+    void clear();
+    // Copies [x0, x1) x [y0, y1) from other, which has the same size.
+    void copy(const Framebuffer &other, int x0, int y0, int x1, int y1);
+    // Forgets the samples of one pixel.
+    void clear(int x, int y) {
+        auto index = size_t(y) * _width + x;
+        _sums[index] = Radiance();
+        _statistics[index] = PixelStatistics();
+        _featureSums[index] = PixelFeatures();
+    }
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+// Also the primitive type of the BVH leaves. Instances are only leaves of the scene's BVH, what they
+// place is spheres and triangles again.
+enum class PrimitiveType : uint16_t {
+    Sphere = 0,
+    Triangle = 1,
+    Instance = 2
+};
+
+// What the traversal keeps about the closest hit so far. Turning it into an Intersection
+// (position, normal, material) is left to CompiledScene::resolve, once, for the winner.
+struct HitRecord {
+public:
+    static const uint32_t NO_INSTANCE = ~0u;
+
+    float distance = std::numeric_limits<float>::infinity();
+    // Index into the arrays of the primitive's type.
+    uint32_t primitiveIndex = 0;
+    PrimitiveType primitiveType = PrimitiveType::Sphere;
+    // Barycentric coordinates of the hit on a triangle, the weights of vertex1 and vertex2.
+    float u = 0.0f;
+    float v = 0.0f;
+    // The instance the primitive was hit through, NO_INSTANCE for one of the scene's own.
+    uint32_t instance = NO_INSTANCE;
+
+    bool hit() const { return distance != std::numeric_limits<float>::infinity(); }
+};
@@ -0,0 +1,103 @@
+#include "image.h"
+#include "tonemap.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fmt/format.h>
+
+namespace {
+    bool endsWith(const std::string &text, const std::string &suffix) {
+        return text.size() >= suffix.size() &&
+            std::equal(suffix.rbegin(), suffix.rend(), text.rbegin(), [](char a, char b) {
+                return std::tolower(a) == std::tolower(b);
+            });
+    }
+
+    std::vector<char> encodePpm(int width, int height, const std::vector<Color> &pixels) {
+        auto header = fmt::format("P6\n{} {}\n255\n", width, height);
+        auto bytes = std::vector<char>(header.begin(), header.end());
+        bytes.reserve(bytes.size() + size_t(width) * height * 3);
+        for (const auto &pixel : pixels) {
+            bytes.push_back(char(std::clamp(pixel.x(), 0, 255)));
+            bytes.push_back(char(std::clamp(pixel.y(), 0, 255)));
+            bytes.push_back(char(std::clamp(pixel.z(), 0, 255)));
+        }
+        return bytes;
+    }
+
+    std::vector<char> encodePfm(int width, int height, const std::vector<Radiance> &pixels) {
+        // A negative scale marks little endian data.
+        auto header = fmt::format("PF\n{} {}\n-1.0\n", width, height);
+        auto bytes = std::vector<char>(header.begin(), header.end());
+        auto offset = bytes.size();
+        bytes.resize(offset + size_t(width) * height * 3 * sizeof(float));
+        for (auto y = height - 1; y >= 0; y--) {
+            for (auto x = 0; x < width; x++) {
+                const auto &pixel = pixels[size_t(y) * width + x];
+                const float channels[3] = { pixel.x, pixel.y, pixel.z };
+                std::memcpy(bytes.data() + offset, channels, sizeof(channels));
+                offset += sizeof(channels);
+            }
+        }
+        return bytes;
+    }
+}
+
+bool imageio::write(const std::string &path, const Framebuffer &framebuffer, float exposure) {
+    return write(path, framebuffer.width(), framebuffer.height(), framebuffer.averages(), exposure);
+}
+
+bool imageio::write(const std::string &path, int width, int height, const std::vector<Radiance> &pixels, float exposure) {
+    auto format = formatOf(path);
+    if (!format) {
+        fmt::print(stderr, "Unknown image format for {}, use .ppm or .pfm\n", path);
+        return false;
+    }
+    return writeEncoded(path, encode(*format, width, height, pixels, exposure));
+}
+
+std::optional<imageio::Format> imageio::formatOf(const std::string &path) {
+    if (endsWith(path, ".ppm")) {
+        return Format::Ppm;
+    }
+    if (endsWith(path, ".pfm")) {
+        return Format::Pfm;
+    }
+    return std::optional<Format>();
+}
+
+std::vector<char> imageio::encode(Format format, int width, int height, const std::vector<Radiance> &pixels, float exposure) {
+    if (format == Format::Pfm) {
+        return encodePfm(width, height, pixels);
+    }
+    auto colors = std::vector<Color>();
+    colors.reserve(pixels.size());
+    for (const auto &pixel : pixels) {
+        colors.push_back(tonemap::toDisplayColor(pixel, exposure));
+    }
+    return encodePpm(width, height, colors);
+}
+
+bool imageio::writePpm(const std::string &path, int width, int height, const std::vector<Color> &pixels) {
+    return writeEncoded(path, encodePpm(width, height, pixels));
+}
+
+bool imageio::writePfm(const std::string &path, int width, int height, const std::vector<Radiance> &pixels) {
+    return writeEncoded(path, encodePfm(width, height, pixels));
+}
+
+bool imageio::writeEncoded(const std::string &path, const std::vector<char> &bytes) {
+    auto file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        fmt::print(stderr, "Could not open {} for writing\n", path);
+        return false;
+    }
+    auto ok = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) {
+        fmt::print(stderr, "Could not write {}\n", path);
+    }
+    return ok;
+}
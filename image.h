@@ -0,0 +1,34 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "vec3.h"
+#include "framebuffer.h"
+
+namespace imageio {
+    enum class Format {
+        // Binary 8 bit RGB, tonemapped.
+        Ppm,
+        // Binary 32 bit float RGB, little endian, rows stored bottom to top.
+        Pfm
+    };
+
+    // By the extension of path, nothing if it is neither .ppm nor .pfm.
+    std::optional<Format> formatOf(const std::string &path);
+    // The whole file, for pixels row by row. exposure only applies to formats that are tonemapped.
+    std::vector<char> encode(Format format, int width, int height, const std::vector<Radiance> &pixels, float exposure);
+
+    // Writes an image that was encoded before.
+    bool writeEncoded(const std::string &path, const std::vector<char> &bytes);
+    // Picks the format from the extension of path. A .ppm is tonemapped with the exposure (in stops),
+    // a .pfm stores the linear radiance as it is.
+    // Returns false if the format is unknown or the file cannot be written.
+    bool write(const std::string &path, const Framebuffer &framebuffer, float exposure);
+    // The same for linear radiance stored row by row.
+    bool write(const std::string &path, int width, int height, const std::vector<Radiance> &pixels, float exposure);
+
+    bool writePpm(const std::string &path, int width, int height, const std::vector<Color> &pixels);
+    bool writePfm(const std::string &path, int width, int height, const std::vector<Radiance> &pixels);
+}
@@ -0,0 +1,67 @@
+#include "instance.h"
+
+#include <algorithm>
+#include <cassert>
+
+Ray Instance::toGeometry(const Ray &ray) const {
+    return Ray(_transform.applyInverseToPoint(ray.origin()), _transform.applyInverseToVector(ray.direction()));
+}
+
+std::optional<Intersection> Instance::intersect(const Ray &ray, float tMax) const {
+    auto geometryRay = toGeometry(ray);
+    auto closest = std::optional<Intersection>();
+    auto geometryTMax = tMax / _transform.scale;
+    for (const auto &object : _geometry->objects) {
+        auto hit = object->intersect(geometryRay, geometryTMax);
+        if (hit) {
+            closest = hit;
+            geometryTMax = hit->distance();
+        }
+    }
+    if (!closest) {
+        return closest;
+    }
+
+    auto distance = closest->distance() * _transform.scale;
+    const auto &material = _material ? *_material : closest->material();
+    return Intersection(ray.origin() + ray.direction() * distance, _transform.applyToVector(closest->surfaceNormal()),
+        distance, material);
+}
+
+bool Instance::occludes(const Ray &ray, float tMax) const {
+    auto geometryRay = toGeometry(ray);
+    auto geometryTMax = tMax / _transform.scale;
+    return std::any_of(_geometry->objects.begin(), _geometry->objects.end(),
+        [&](const std::unique_ptr<SceneObject> &object) { return object->occludes(geometryRay, geometryTMax); });
+}
+
+BoundingBox Instance::boundingBox() const {
+    auto bounds = BoundingBox();
+    for (const auto &object : _geometry->objects) {
+        bounds = bounds.expand(object->boundingBox());
+    }
+    return _transform.applyToBox(bounds);
+}
+
+void Instance::appendTo(PrimitiveList &primitives) const {
+    auto source = static_cast<const void *>(_geometry.get());
+    auto existing = std::find_if(primitives.geometries.begin(), primitives.geometries.end(),
+        [&](const GeometryPrimitive &geometry) { return geometry.source == source; });
+    auto geometryIndex = uint32_t(existing - primitives.geometries.begin());
+
+    if (existing == primitives.geometries.end()) {
+        // The objects add themselves to a list of their own, which shares the materials of the scene.
+        auto geometryPrimitives = PrimitiveList();
+        geometryPrimitives.materials = std::move(primitives.materials);
+        for (const auto &object : _geometry->objects) {
+            object->appendTo(geometryPrimitives);
+        }
+        primitives.materials = std::move(geometryPrimitives.materials);
+        assert(geometryPrimitives.meshes.empty() && geometryPrimitives.instances.empty());
+        primitives.geometries.push_back(GeometryPrimitive{ source, std::move(geometryPrimitives.spheres),
+            std::move(geometryPrimitives.triangles) });
+    }
+
+    auto materialIndex = _material ? primitives.addMaterial(*_material) : InstancePrimitive::NO_MATERIAL;
+    primitives.instances.push_back(InstancePrimitive{ geometryIndex, _transform, materialIndex });
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "sceneobject.h"
+#include "transform.h"
+#include "material.h"
+
+// Objects in coordinates of their own, placed in the scene by Instances. Spheres and triangles only.
+struct SharedGeometry {
+public:
+    std::vector<std::unique_ptr<SceneObject>> objects = {};
+};
+
+// A shared geometry placed in the scene by a transform. The geometry is compiled once with a BVH of its
+// own, every instance of it only adds itself to the BVH of the scene, so a thousand copies of an object
+// take about the memory of one.
+class Instance final : public SceneObject {
+    std::shared_ptr<const SharedGeometry> _geometry = {};
+    Transform _transform = {};
+    // Replaces the materials of the geometry's objects if set.
+    std::optional<Material> _material = {};
+
+public:
+    Instance(std::shared_ptr<const SharedGeometry> geometry, const Transform &transform, std::optional<Material> material = {})
+        : _geometry(std::move(geometry)), _transform(transform), _material(std::move(material)) {}
+    ~Instance() = default;
+
+    const Transform &transform() const { return _transform; }
+
+private:
+    // The ray in the coordinates of the geometry. Its distances are shorter by the scale of the transform.
+    Ray toGeometry(const Ray &ray) const;
+
+public:
+
+    // Inherited via SceneObject. These test every object of the geometry, rays are traced against the CompiledScene.
+    virtual std::optional<Intersection> intersect(const Ray &ray, float tMax) const override;
+    virtual bool occludes(const Ray &ray, float tMax) const override;
+    virtual BoundingBox boundingBox() const override;
+    virtual void appendTo(PrimitiveList &primitives) const override;
+};
@@ -1,21 +1,29 @@
 #pragma once
 
+#include <cassert>
+
 #include "vec3.h"
 #include "material.h"
 
+// Everything about a hit that shading needs. Only built for the closest hit of a ray,
+// the traversal itself works with HitRecords.
 class Intersection {
     float _distance = 0.0f;
     Vec3 _position = {};
     Vec3 _surfaceNormal = {};
-    Material _material = {};
+    // Points into the scene's material table (or the object's material), which outlives the intersection.
+    const Material *_material = nullptr;
 
 public:
     Intersection() = default;
-    Intersection(Vec3 position, Vec3 surfaceNormal, float distance, Material material)
-        : _position(position), _surfaceNormal(surfaceNormal.normalize()), _distance(distance), _material(material) {}
+    Intersection(Vec3 position, Vec3 surfaceNormal, float distance, const Material &material)
+        : _distance(distance), _position(position), _surfaceNormal(surfaceNormal.normalize()), _material(&material) {}
 
     Vec3 position() const { return _position; }
     Vec3 surfaceNormal() const { return _surfaceNormal; }
     float distance() const { return _distance; }
-    Material material() const { return _material; }
+    const Material &material() const {
+        assert(_material);
+        return *_material;
+    }
 };
@@ -4,198 +4,373 @@
 #include <numeric>
 #include <cmath>
 #include <vector>
-#include <deque>
 #include <cstdio>
-#include <future>
 #include <chrono>
 #include <ctime>
 #include <atomic>
 #include <chrono>
+#include <string>
+#include <thread>
+#include <filesystem>
 #include <fmt/format.h>
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
 
 #include "scene.h"
-#include "ray.h"
-#include "vec3.h"
+#include "tilescheduler.h"
+#include "options.h"
+#include "image.h"
+#include "framebuffer.h"
+#include "renderer.h"
+#include "tonemap.h"
+#include "allocationcounter.h"
+#include "renderstats.h"
+#include "denoiser.h"
+#include "distributed.h"
+#include "renderserver.h"
+
+void printSummary(const ProgressiveRender &render) {
+    auto seconds = render.secondsElapsed();
+    auto rays = render.stats().totalRays();
+    fmt::print("Rendered {:.1f} samples per pixel in {} passes, {:.2f} s, {} rays, {:.3f} MRays/s\n",
+        render.averageSamples(), render.passesDone(), seconds, rays, rays / seconds / 1'000'000.0);
+}
 
-namespace mainvariables {
-    std::atomic<int> numberOfRaysShot = 0;
+// The finished image row by row, denoised if the options ask for it.
+std::vector<Radiance> finalImage(const RenderOptions &options, const Framebuffer &framebuffer, TileScheduler &scheduler) {
+    if (options.denoise) {
+        auto start = std::chrono::steady_clock::now();
+        auto pixels = denoiser::denoise(framebuffer, scheduler);
+        fmt::print("Denoised in {:.2f} s\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        return pixels;
+    }
+    return framebuffer.averages();
 }
 
-Color shootRay(const Ray &ray, const Scene &scene, int depth) {
-    mainvariables::numberOfRaysShot++;
+bool writeFeatures(const std::string &prefix, const Framebuffer &framebuffer) {
+    auto albedo = std::vector<Radiance>();
+    auto normal = std::vector<Radiance>();
+    auto depth = std::vector<Radiance>();
+    for (auto y = 0; y < framebuffer.height(); y++) {
+        for (auto x = 0; x < framebuffer.width(); x++) {
+            auto features = framebuffer.features(x, y);
+            albedo.push_back(features.albedo);
+            normal.push_back(features.normal);
+            depth.push_back(Radiance(features.depth, features.depth, features.depth));
+        }
+    }
+    auto width = framebuffer.width();
+    auto height = framebuffer.height();
+    return imageio::writePfm(prefix + "albedo.pfm", width, height, albedo) &&
+        imageio::writePfm(prefix + "normal.pfm", width, height, normal) &&
+        imageio::writePfm(prefix + "depth.pfm", width, height, depth);
+}
 
-    const int MAX_DEPTH = 5;
-    if (depth > MAX_DEPTH) {
-        return Color(50, 50, 50);
+bool reportWritten(const std::string &path, bool written) {
+    if (written) {
+        fmt::print("Wrote {}\n", path);
     }
+    return written;
+}
 
-    auto intersection = scene.firstIntersection(ray);
-    if (!intersection) {
-        // Hit outside of the world
-        return Color(70, 70, 70);
+// The image and its features. Returns false if any of it failed.
+bool writeImages(const RenderOptions &options, const Framebuffer &framebuffer, const std::vector<Radiance> &image) {
+    auto ok = true;
+    if (!options.outputPath.empty()) {
+        ok = reportWritten(options.outputPath,
+            imageio::write(options.outputPath, options.width, options.height, image, options.exposure)) && ok;
     }
-    auto material = intersection->material();
-    auto emittingColor = material.emittingColor();
-    if (emittingColor) {
-        return emittingColor.value();
+    if (!options.featuresPrefix.empty()) {
+        ok = reportWritten(options.featuresPrefix + "*.pfm", writeFeatures(options.featuresPrefix, framebuffer)) && ok;
     }
+    return ok;
+}
 
-    auto selfColor = material.color();
-    // return selfColor;
-
-    // Shoot a random ray, to simulate global illumination
-    auto newRayDirection = vectorutils::createRandomVectorInHemisphere(intersection->surfaceNormal());
-    auto newRayOrigin = intersection->position() + intersection->surfaceNormal() * 0.5f;
-    auto newRay = Ray(newRayOrigin, newRayDirection);
-    auto randomVecColor = shootRay(newRay, scene, depth + 1);
-    randomVecColor = randomVecColor * 0.8f;
-    return colorutils::multiplyColors(selfColor, randomVecColor);
-
-    auto color = Color();
-    auto reflectionPercent = material.reflectionPercent();
-    if (reflectionPercent) {
-        auto normal = intersection->surfaceNormal();
-
-        auto newRayOrigin = intersection->position() + normal * 0.5f;
-        auto delta = normal * 2 * ray.direction().dot(normal);
-        auto newRayDirection = ray.direction() - delta;
-        newRayDirection = newRayDirection.normalize();
+// Everything that is written once the render is done. Returns false if any of it failed.
+bool writeResults(const RenderOptions &options, const ProgressiveRender &render, const Framebuffer &framebuffer,
+    const std::vector<Radiance> &image) {
+    auto ok = writeImages(options, framebuffer, image);
+    auto write = [&](const std::string &path, bool written) {
+        ok = reportWritten(path, written) && ok;
+    };
+    if (!options.statsPath.empty()) {
+        write(options.statsPath, renderstats::writeReport(options.statsPath, render));
+    }
+    if (!options.heatmapPath.empty()) {
+        write(options.heatmapPath, renderstats::writeHeatmap(options.heatmapPath, render));
+    }
+    return ok;
+}
 
-        auto newRay = Ray(newRayOrigin, newRayDirection);
-        auto reflectionColor = shootRay(newRay, scene, depth + 1);
+// The checkpoint to go on from with --resume, nothing to start over.
+std::optional<Checkpoint> loadCheckpoint(const RenderOptions &options, const Scene &scene) {
+    if (!options.resume) {
+        return std::optional<Checkpoint>();
+    }
+    auto checkpoint = checkpoint::load(options.checkpointPath, checkpoint::renderHash(options, scene));
+    if (checkpoint) {
+        fmt::print("Resuming at {} samples per pixel from {}\n", checkpoint->samplesDone, options.checkpointPath);
+    }
+    else {
+        fmt::print("No checkpoint of this render at {}, starting over\n", options.checkpointPath);
+    }
+    return checkpoint;
+}
 
-        color = reflectionColor * reflectionPercent.value() + color * (1 - reflectionPercent.value());
+// Shoots camera and shadow rays through the scene queries and whole paths through the integrator on this thread,
+// and fails if any of them touched the heap.
+int runAllocationCheck(const RenderOptions &options, const Scene &scene) {
+    const int NUM_RAYS = 10'000;
+
+    auto randomCameraRay = [&]() {
+        auto x = utils::randomFloat(-0.5f, 0.5f) * options.width;
+        auto y = utils::randomFloat(-0.5f, 0.5f) * options.height;
+        return Ray(scene.camera().origin(), Vec3(x, y, float(options.width)));
+    };
+
+    // The first calls set up thread locals like the random generator, which may allocate once.
+    scene.closestHit(randomCameraRay());
+    auto camera = renderCamera(options, scene);
+    renderPixel(0, 0, 0, 1, camera, options, scene);
+
+    auto allocationsBefore = allocationcounter::threadAllocations();
+    auto statsBefore = renderstats::totals();
+    for (auto i = 0; i < NUM_RAYS; i++) {
+        auto ray = randomCameraRay();
+        auto intersection = scene.closestHit(ray);
+        if (intersection) {
+            auto toLight = scene.light() - intersection->position();
+            auto shadowRay = Ray(intersection->position() + intersection->surfaceNormal() * 0.5f, toLight);
+            scene.occluded(shadowRay, toLight.length());
+        }
+        renderPixel(i % options.width, i / options.width % options.height, i, 1, camera, options, scene);
     }
+    auto allocations = allocationcounter::threadAllocations() - allocationsBefore;
+    auto rays = 2 * NUM_RAYS + (renderstats::totals() - statsBefore).totalRays();
 
+    fmt::print("{} heap allocations in {} rays, {} per ray\n", allocations, rays, double(allocations) / rays);
+    return allocations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    auto intersectionPosition = intersection->position();
+int renderHeadless(const RenderOptions &options, const Scene &scene, TileScheduler &scheduler) {
+    auto framebuffer = Framebuffer(options.width, options.height);
 
-    // Easy to debug intersection problems. Use with the last object in the scene (uncommented).
-    //if (intersectionPosition.y() > 4.5f) {
-    //    int breakhere = 3;
-    //}
+    auto resumeFrom = loadCheckpoint(options, scene);
+    auto render = ProgressiveRender(options, scene, scheduler, framebuffer, resumeFrom ? &*resumeFrom : nullptr);
 
-    // Shoot ray to the light
-    auto lightPosition = scene.light();
-    auto lightRayDirection = lightPosition - intersection->position();
-    lightRayDirection = lightRayDirection.normalize();
+    auto lastProgressOutputTime = std::chrono::steady_clock::now();
+    while (render.update([](const Tile &) {})) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-    // Move the origin a little bit out of the object so it does not hit itself
-    auto lightRayOrigin = intersection->position() + intersection->surfaceNormal() * 0.5f;
-    auto rayToLight = Ray(lightRayOrigin, lightRayDirection);
+        if (std::chrono::steady_clock::now() - lastProgressOutputTime > std::chrono::seconds(1)) {
+            fmt::print("{} samples per pixel done, {} pixels still sampling\n", render.samplesDone(), render.activePixelCount());
+            lastProgressOutputTime = std::chrono::steady_clock::now();
+        }
+    }
 
-    auto cosBetweenNormalAndLight = lightRayDirection.dot(intersection->surfaceNormal());
-    cosBetweenNormalAndLight = std::max(0.2f, cosBetweenNormalAndLight);
-    color = color * cosBetweenNormalAndLight;
+    printSummary(render);
+    auto image = finalImage(options, framebuffer, scheduler);
+    return writeResults(options, render, framebuffer, image) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    if (!scene.hitsLight(rayToLight)) {
-        color = color * 0.8;
-    }
-    return color;
+int runHeadless(const RenderOptions &options, const Scene &scene) {
+    TileScheduler scheduler(options.threads);
+    return renderHeadless(options, scene, scheduler);
 }
 
-Color shootRayforPixel(int x, int y, const Scene &scene) {
-    auto camera = scene.camera();
-    // TODO: This hard codes the camera direction vector. Change.
-    auto pointOnVirtualScreen = camera.origin() + Vec3(float(x), float(y), 500.0f);
-    auto rayDirection = pointOnVirtualScreen - camera.origin();
-    rayDirection = rayDirection.normalize();
-    auto ray = Ray(camera.origin(), rayDirection);
-    return shootRay(ray, scene, 0);
+// path with the frame number before its extension, or at its end if there is none.
+std::string framePath(const std::string &path, int frame) {
+    auto extension = std::filesystem::path(path).extension().string();
+    auto stem = path.substr(0, path.size() - extension.size());
+    return fmt::format("{}.{:04}{}", stem, frame, extension);
 }
 
-struct PixelWork {
-public:
-    int x = -1;
-    int y = -1;
-    Color pixelColor = {};
-};
+// Every frame is rendered on its own, the scene only moves what the animation changed in between.
+int runAnimation(const RenderOptions &options, Scene &scene) {
+    TileScheduler scheduler(options.threads);
+    for (auto frame = 0; frame < options.frames; frame++) {
+        auto time = float(frame) / options.frameRate;
+        auto start = std::chrono::steady_clock::now();
+        auto update = scene.setTime(time);
+        if (!update) {
+            return EXIT_FAILURE;
+        }
+        fmt::print("Frame {} at {:.3f} s: moved {} primitives, {} {} BVH nodes in {:.2f} ms\n", frame, time,
+            update->movedPrimitives, update->rebuilt ? "rebuilt after refitting" : "refit", update->refitNodes,
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+
+        auto frameOptions = options;
+        frameOptions.outputPath = framePath(options.outputPath, frame);
+        for (auto *path : { &frameOptions.statsPath, &frameOptions.heatmapPath }) {
+            if (!path->empty()) {
+                *path = framePath(*path, frame);
+            }
+        }
+        if (!options.featuresPrefix.empty()) {
+            frameOptions.featuresPrefix = fmt::format("{}{:04}.", options.featuresPrefix, frame);
+        }
+        if (renderHeadless(frameOptions, scene, scheduler) != EXIT_SUCCESS) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
 
-int main(int argc, char **argv) {
-    SDL_SetMainReady();
+// The frame is rendered by the workers, only the denoiser runs here.
+int runCoordinator(const RenderOptions &options, const Scene &scene) {
+    auto framebuffer = Framebuffer(options.width, options.height);
+    auto start = std::chrono::steady_clock::now();
+    if (!distributed::renderAsCoordinator(options, scene, framebuffer)) {
+        return EXIT_FAILURE;
+    }
+    fmt::print("Rendered {} samples per pixel in {:.2f} s\n", options.samplesPerPixel,
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
 
-    Scene scene = {};
-    scene.initialize();
+    TileScheduler scheduler(options.threads);
+    auto image = finalImage(options, framebuffer, scheduler);
+    return writeImages(options, framebuffer, image) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    const auto WINDOW_WIDTH = 500;
-    const auto WINDOW_HEIGHT = 500;
+// Moves the camera on w/a/s/d/q/e, turns it on the arrow keys or while dragging with the left mouse button and
+// zooms on the mouse wheel or page up/down. r goes back to home. Nothing for events that leave the camera alone.
+std::optional<Camera> navigate(const SDL_Event &event, const Camera &camera, const Camera &home) {
+    // In scene units, radians and degrees.
+    const float MOVE_STEP = 2.0f;
+    const float KEY_TURN_STEP = 0.05f;
+    const float MOUSE_TURN_STEP = 0.005f;
+    const float ZOOM_STEP = 5.0f;
+
+    if (event.type == SDL_MOUSEMOTION && (event.motion.state & SDL_BUTTON_LMASK) &&
+        (event.motion.xrel != 0 || event.motion.yrel != 0)) {
+        return camera.turned(event.motion.xrel * MOUSE_TURN_STEP, -event.motion.yrel * MOUSE_TURN_STEP);
+    }
+    if (event.type == SDL_MOUSEWHEEL && event.wheel.y != 0) {
+        return camera.withFieldOfView(camera.fieldOfView() - event.wheel.y * ZOOM_STEP);
+    }
+    if (event.type != SDL_KEYDOWN) {
+        return std::optional<Camera>();
+    }
+    switch (event.key.keysym.sym) {
+        case SDLK_w: return camera.moved(0.0f, 0.0f, MOVE_STEP);
+        case SDLK_s: return camera.moved(0.0f, 0.0f, -MOVE_STEP);
+        case SDLK_d: return camera.moved(MOVE_STEP, 0.0f, 0.0f);
+        case SDLK_a: return camera.moved(-MOVE_STEP, 0.0f, 0.0f);
+        case SDLK_e: return camera.moved(0.0f, MOVE_STEP, 0.0f);
+        case SDLK_q: return camera.moved(0.0f, -MOVE_STEP, 0.0f);
+        case SDLK_RIGHT: return camera.turned(KEY_TURN_STEP, 0.0f);
+        case SDLK_LEFT: return camera.turned(-KEY_TURN_STEP, 0.0f);
+        case SDLK_UP: return camera.turned(0.0f, KEY_TURN_STEP);
+        case SDLK_DOWN: return camera.turned(0.0f, -KEY_TURN_STEP);
+        case SDLK_PAGEUP: return camera.withFieldOfView(camera.fieldOfView() - ZOOM_STEP);
+        case SDLK_PAGEDOWN: return camera.withFieldOfView(camera.fieldOfView() + ZOOM_STEP);
+        case SDLK_r: return home;
+        default: return std::optional<Camera>();
+    }
+}
 
+int runWindowed(const RenderOptions &options, const Scene &scene) {
     SDL_Event event;
     SDL_Renderer *renderer;
     SDL_Window *window;
-    int i;
 
     SDL_Init(SDL_INIT_VIDEO);
-    SDL_CreateWindowAndRenderer(WINDOW_WIDTH, WINDOW_HEIGHT, 0, &window, &renderer);
+    SDL_CreateWindowAndRenderer(options.width, options.height, 0, &window, &renderer);
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     SDL_RenderClear(renderer);
 
-    std::deque<std::future<PixelWork>> pixelFutures = {};
-
-    // Shoot rays
-    // TODO: Get orthogonal plane to direction vector?
-    for (auto x = 50; x < WINDOW_WIDTH - 50; x++) {
-        for (auto y = 50; y < WINDOW_WIDTH - 50; y++) {
-            auto pixelColorLambda = [WINDOW_WIDTH, WINDOW_HEIGHT, &scene = std::as_const(scene)](int x, int y) {
-                PixelWork work = {};
-                work.x = x;
-                work.y = y;
-
-                auto moved_x = x - (WINDOW_WIDTH / 2);
-                // Positive y is up in world space, but in screen (sdl) space its down
-                auto moved_y = (WINDOW_WIDTH / 2) - y;
-
-                const int NUM_SAMPLES = 1024;
-                for (auto i = 0; i < NUM_SAMPLES; i++) {
-                    work.pixelColor = work.pixelColor + shootRayforPixel(moved_x, moved_y, scene);
-                }
-                work.pixelColor = work.pixelColor / NUM_SAMPLES;
-                // Make the whole scene brighter. TODO: Why is it so dark?
-                work.pixelColor = work.pixelColor * 10.0f;
-                work.pixelColor = work.pixelColor.clamp(0, 255);
+    // Workers add their samples here, the display loop reads a tile once it shows up as completed.
+    auto framebuffer = Framebuffer(options.width, options.height);
 
-                return work;
-            };
+    // The render follows the camera through these, it starts over whenever the camera moves.
+    auto viewOptions = options;
+    auto homeCamera = renderCamera(options, scene);
+    auto camera = homeCamera;
 
-            auto pixelColorWork = std::async(std::launch::async, pixelColorLambda, x, y);
-            pixelFutures.push_back(std::move(pixelColorWork));
-        }
-    }
+    // Shoot rays
+    TileScheduler scheduler(options.threads);
+    auto resumeFrom = loadCheckpoint(options, scene);
+    auto render = ProgressiveRender(viewOptions, scene, scheduler, framebuffer, resumeFrom ? &*resumeFrom : nullptr);
+    auto summaryPrinted = false;
+    // From the last camera move to the whole image showing at the coarsest preview stride.
+    auto viewChangeTime = std::chrono::steady_clock::now();
+    auto previewMilliseconds = std::optional<double>();
 
     auto lastRayPerSecondOutputTime = std::chrono::steady_clock::now();
-    auto lastRayPerSecondValue = mainvariables::numberOfRaysShot.load();
-
-    while (1) {
-        if (SDL_PollEvent(&event) &&
-            event.type == SDL_QUIT)
+    auto lastRayPerSecondValue = render.stats().totalRays();
+
+    auto quit = false;
+    while (!quit) {
+        // All events that came in, a drag sends many and only the last camera is rendered.
+        auto newCamera = std::optional<Camera>();
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                quit = true;
+            }
+            if (auto moved = navigate(event, newCamera.value_or(camera), homeCamera)) {
+                newCamera = moved;
+            }
+        }
+        if (quit) {
             break;
+        }
+        if (newCamera) {
+            // Workers read the camera from viewOptions until the render is cancelled.
+            render.cancel();
+            camera = *newCamera;
+            viewOptions.cameraPosition = camera.origin();
+            viewOptions.cameraTarget = camera.target();
+            viewOptions.fieldOfView = camera.fieldOfView();
+            render.restart();
+            summaryPrinted = false;
+            viewChangeTime = std::chrono::steady_clock::now();
+            previewMilliseconds.reset();
+        }
 
-        while (pixelFutures.size() > 0 &&
-               utils::futureReady(pixelFutures.front())) {
-            auto pixelFuture = std::move(pixelFutures.front());
-            pixelFutures.pop_front();
-            auto pixel = pixelFuture.get();
-            auto pixelColor = pixel.pixelColor;
+        render.update([&](const Tile &tile) {
+            for (auto y = tile.y0; y < tile.y1; y++) {
+                for (auto x = tile.x0; x < tile.x1; x++) {
+                    auto pixelColor = tonemap::toDisplayColor(render.displayRadiance(x, y), options.exposure);
+                    SDL_SetRenderDrawColor(renderer,
+                        pixelColor.x(), pixelColor.y(), pixelColor.z(), 255);
+                    SDL_RenderDrawPoint(renderer, x, y);
+                }
+            }
+        });
 
-            SDL_SetRenderDrawColor(renderer,
-                pixelColor.x(), pixelColor.y(), pixelColor.z(), 255);
-            SDL_RenderDrawPoint(renderer, pixel.x, pixel.y);
+        if (!previewMilliseconds && render.previewStride() != ProgressiveRender::PREVIEW_STRIDE) {
+            previewMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - viewChangeTime).count();
         }
 
         SDL_Delay(10);
         SDL_RenderPresent(renderer);
 
+        if (render.finished() && !summaryPrinted) {
+            summaryPrinted = true;
+            printSummary(render);
+            auto image = finalImage(viewOptions, framebuffer, scheduler);
+            if (options.denoise) {
+                for (auto y = 0; y < options.height; y++) {
+                    for (auto x = 0; x < options.width; x++) {
+                        auto pixelColor = tonemap::toDisplayColor(image[size_t(y) * options.width + x], options.exposure);
+                        SDL_SetRenderDrawColor(renderer, pixelColor.x(), pixelColor.y(), pixelColor.z(), 255);
+                        SDL_RenderDrawPoint(renderer, x, y);
+                    }
+                }
+                SDL_RenderPresent(renderer);
+            }
+            writeResults(viewOptions, render, framebuffer, image);
+        }
+
         // Print Rays/s
         auto durationSinceLastWrite = 
             std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - lastRayPerSecondOutputTime);
         if (durationSinceLastWrite.count() > 1000) {
-            fmt::print("{} MRays/s\n", 
-                (mainvariables::numberOfRaysShot - lastRayPerSecondValue) / 1'000'000.0f);
+            auto rays = render.stats().totalRays();
+            fmt::print("{} MRays/s, {} samples per pixel, preview after {:.0f} ms\n",
+                (rays - lastRayPerSecondValue) / 1'000'000.0f, render.samplesDone(), previewMilliseconds.value_or(0.0));
             lastRayPerSecondOutputTime = std::chrono::steady_clock::now();
-            lastRayPerSecondValue = mainvariables::numberOfRaysShot;
+            lastRayPerSecondValue = rays;
         }
     }
 
@@ -203,4 +378,47 @@ int main(int argc, char **argv) {
     SDL_DestroyWindow(window);
     SDL_Quit();
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+int main(int argc, char **argv) {
+    SDL_SetMainReady();
+
+    auto options = options::parse(argc, argv);
+    if (!options) {
+        return EXIT_FAILURE;
+    }
+    if (options->help) {
+        return EXIT_SUCCESS;
+    }
+
+    // Workers get the scene from the coordinator, the server loads the scenes of its jobs.
+    if (!options->workerHost.empty()) {
+        return distributed::runWorker(*options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (options->servePort > 0) {
+        return renderserver::serve(*options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (options->submitPort > 0) {
+        return renderserver::submit(*options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    Scene scene = {};
+    if (!scene.initialize(options->sceneType, options->meshPath, options->sceneCachePath)) {
+        return EXIT_FAILURE;
+    }
+    fmt::print("Scene has {} objects\n", scene.objectCount());
+
+    if (options->checkAllocations) {
+        return runAllocationCheck(*options, scene);
+    }
+    if (options->coordinatorPort > 0) {
+        return runCoordinator(*options, scene);
+    }
+    if (options->frames > 1) {
+        return runAnimation(*options, scene);
+    }
+    if (options->headless) {
+        return runHeadless(*options, scene);
+    }
+    return runWindowed(*options, scene);
+}
@@ -0,0 +1,128 @@
+#include "mappedfile.h"
+
+#include <utility>
+#include <fmt/format.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        close();
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+#ifdef _WIN32
+        _file = std::exchange(other._file, nullptr);
+        _mapping = std::exchange(other._mapping, nullptr);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+std::optional<MappedFile> MappedFile::open(const std::string &path) {
+    auto file = MappedFile();
+    auto handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        fmt::print(stderr, "Could not open {}\n", path);
+        return std::optional<MappedFile>();
+    }
+    file._file = handle;
+
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(handle, &size)) {
+        fmt::print(stderr, "Could not read the size of {}\n", path);
+        return std::optional<MappedFile>();
+    }
+    if (size.QuadPart == 0) {
+        return file;
+    }
+
+    file._mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    auto view = file._mapping ? MapViewOfFile(file._mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        fmt::print(stderr, "Could not map {}\n", path);
+        return std::optional<MappedFile>();
+    }
+    file._data = static_cast<const char *>(view);
+    file._size = size_t(size.QuadPart);
+    return file;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping) {
+        CloseHandle(_mapping);
+    }
+    if (_file) {
+        CloseHandle(_file);
+    }
+    _data = nullptr;
+    _size = 0;
+    _mapping = nullptr;
+    _file = nullptr;
+}
+
+#else
+
+std::optional<MappedFile> MappedFile::open(const std::string &path) {
+    auto descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        fmt::print(stderr, "Could not open {}\n", path);
+        return std::optional<MappedFile>();
+    }
+
+    struct stat status = {};
+    if (fstat(descriptor, &status) != 0) {
+        ::close(descriptor);
+        fmt::print(stderr, "Could not read the size of {}\n", path);
+        return std::optional<MappedFile>();
+    }
+
+    auto file = MappedFile();
+    if (status.st_size > 0) {
+        auto data = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (data == MAP_FAILED) {
+            ::close(descriptor);
+            fmt::print(stderr, "Could not map {}\n", path);
+            return std::optional<MappedFile>();
+        }
+        // Parsers stream through the file front to back.
+        madvise(data, size_t(status.st_size), MADV_SEQUENTIAL);
+        file._data = static_cast<const char *>(data);
+        file._size = size_t(status.st_size);
+    }
+    // The mapping stays valid without the descriptor.
+    ::close(descriptor);
+    return file;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        munmap(const_cast<char *>(_data), _size);
+    }
+    _data = nullptr;
+    _size = 0;
+}
+
+#endif
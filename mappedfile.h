@@ -0,0 +1,34 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <cstddef>
+
+// A whole file mapped read-only into memory. Pages are only read from disk when they are touched,
+// and several threads can parse different parts of the file at once without any copying.
+class MappedFile {
+    const char *_data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void *_file = nullptr;
+    void *_mapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Prints the problem and returns nothing if the file cannot be opened or mapped.
+    static std::optional<MappedFile> open(const std::string &path);
+
+    // Null for an empty file.
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    void close();
+};
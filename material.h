@@ -5,17 +5,19 @@
 #include "vec3.h"
 
 class Material {
-    std::optional<Color> _emittingColor = {};
-    Color _color = {};
+    std::optional<Radiance> _emittingColor = {};
+    Radiance _color = {};
     std::optional<float> _reflectionPercent = {};
+    // Of the reflecting part, 0 for a perfect mirror, up to 1 for a very blurry one.
+    float _roughness = 0.0f;
 
 public:
     Material() = default;
-    Material(Color color)
+    Material(Radiance color)
         : _color(color) {}
 
 
-    Material setEmittingColor(Color emittingColor) const {
+    Material setEmittingColor(Radiance emittingColor) const {
         Material m = *this;
         m._emittingColor = emittingColor;
         return m;
@@ -27,15 +29,32 @@ public:
         return m;
     }
 
-    Color color() const { return _color; }
-    std::optional<Color> emittingColor() const { return _emittingColor; }
-    std::optional<float> reflectionPercent() const { return _reflectionPercent; }
+    Material setRoughness(float roughness) const {
+        Material m = *this;
+        m._roughness = roughness;
+        return m;
+    }
 
-    static Material black() { return Material(Color(0, 0, 0)); }
-    static Material white() { return Material(Color(255, 255, 255)); }
-    static Material red() { return Material(Color(255, 0, 0)); }
-    static Material green() { return Material(Color(0, 255, 0)); }
-    static Material blue() { return Material(Color(0, 0, 255)); }
-    static Material pink() { return Material(Color(255, 192, 203)); }
-    static Material gray() { return Material(Color(211, 211, 211)); }
+    bool operator==(const Material &other) const {
+        return _color == other._color &&
+            _emittingColor == other._emittingColor &&
+            _reflectionPercent == other._reflectionPercent &&
+            _roughness == other._roughness;
+    }
+    bool operator!=(const Material &other) const { return !(*this == other); }
+
+    Radiance color() const { return _color; }
+    std::optional<Radiance> emittingColor() const { return _emittingColor; }
+    // The fraction of light that is reflected like in a mirror instead of diffusely.
+    std::optional<float> reflectionPercent() const { return _reflectionPercent; }
+    float roughness() const { return _roughness; }
+
+    // Colors are the fraction of light reflected per channel, so between 0 and 1.
+    static Material black() { return Material(Radiance(0.0f, 0.0f, 0.0f)); }
+    static Material white() { return Material(Radiance(1.0f, 1.0f, 1.0f)); }
+    static Material red() { return Material(Radiance(1.0f, 0.0f, 0.0f)); }
+    static Material green() { return Material(Radiance(0.0f, 1.0f, 0.0f)); }
+    static Material blue() { return Material(Radiance(0.0f, 0.0f, 1.0f)); }
+    static Material pink() { return Material(Radiance(1.0f, 0.753f, 0.796f)); }
+    static Material gray() { return Material(Radiance(0.827f, 0.827f, 0.827f)); }
 }; 
@@ -0,0 +1,67 @@
+#include "mesh.h"
+
+#include <limits>
+
+std::optional<float> Mesh::hitDistance(const Ray &ray, float tMax, size_t &triangle) const {
+    const float EPSILON = std::numeric_limits<float>::epsilon();
+
+    auto closest = std::optional<float>();
+    const auto &indices = _data->indices;
+    for (size_t i = 0; i < _data->triangleCount(); i++) {
+        auto vertex0 = vertex(indices[3 * i]);
+        auto edge1 = vertex(indices[3 * i + 1]) - vertex0;
+        auto edge2 = vertex(indices[3 * i + 2]) - vertex0;
+
+        // Moeller-Trumbore, like Triangle::hitDistance.
+        auto h = ray.direction().cross(edge2);
+        auto a = edge1.dot(h);
+        if (a > -EPSILON && a < EPSILON) {
+            continue;
+        }
+        auto f = 1.0f / a;
+        auto s = ray.origin() - vertex0;
+        auto u = f * s.dot(h);
+        if (u < 0.0f || u > 1.0f) {
+            continue;
+        }
+        auto q = s.cross(edge1);
+        auto v = f * ray.direction().dot(q);
+        if (v < 0.0f || u + v > 1.0f) {
+            continue;
+        }
+        auto t = f * edge2.dot(q);
+        if (t > EPSILON && t < tMax) {
+            closest = t;
+            tMax = t;
+            triangle = i;
+        }
+    }
+    return closest;
+}
+
+std::optional<Intersection> Mesh::intersect(const Ray &ray, float tMax) const {
+    size_t triangle = 0;
+    auto t = hitDistance(ray, tMax, triangle);
+    if (!t) {
+        return std::optional<Intersection>();
+    }
+
+    const auto &indices = _data->indices;
+    auto vertex0 = vertex(indices[3 * triangle]);
+    auto normal = (vertex(indices[3 * triangle + 1]) - vertex0).cross(vertex(indices[3 * triangle + 2]) - vertex0);
+    return Intersection(ray.origin() + ray.direction() * *t, normal, *t, _material);
+}
+
+bool Mesh::occludes(const Ray &ray, float tMax) const {
+    size_t triangle = 0;
+    return hitDistance(ray, tMax, triangle).has_value();
+}
+
+BoundingBox Mesh::boundingBox() const {
+    auto bounds = _data->bounds();
+    return BoundingBox(bounds.min() * _scale + _offset, bounds.max() * _scale + _offset);
+}
+
+void Mesh::appendTo(PrimitiveList &primitives) const {
+    primitives.meshes.push_back(MeshPrimitive{ _data, _offset, _scale, primitives.addMaterial(_material) });
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+
+#include "sceneobject.h"
+#include "meshdata.h"
+
+// A triangle mesh placed in the scene, scaled uniformly and then moved by offset.
+// The vertex and index buffers are shared, so placing a mesh does not copy them.
+class Mesh final : public SceneObject {
+    std::shared_ptr<const MeshData> _data = {};
+    Vec3 _offset = {};
+    float _scale = 1.0f;
+    Material _material;
+
+public:
+    Mesh(std::shared_ptr<const MeshData> data, Vec3 offset, float scale, Material material)
+        : _data(std::move(data)), _offset(offset), _scale(scale), _material(material) {}
+    ~Mesh() = default;
+
+    const MeshData &data() const { return *_data; }
+    Vec3 vertex(uint32_t index) const { return _data->vertex(index) * _scale + _offset; }
+
+private:
+    // Closest hit closer than tMax, and the triangle it is on.
+    std::optional<float> hitDistance(const Ray &ray, float tMax, size_t &triangle) const;
+
+public:
+
+    // Inherited via SceneObject. These test every triangle, rays are traced against the CompiledScene.
+    virtual std::optional<Intersection> intersect(const Ray &ray, float tMax) const override;
+    virtual bool occludes(const Ray &ray, float tMax) const override;
+    virtual BoundingBox boundingBox() const override;
+    virtual void appendTo(PrimitiveList &primitives) const override;
+};
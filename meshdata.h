@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "vec3.h"
+#include "boundingbox.h"
+
+// An indexed triangle mesh: every vertex is stored once, triangles are three indices into the vertices.
+// That is 12 bytes per vertex and 12 per triangle, shared by every Mesh that uses it.
+struct MeshData {
+public:
+    // x, y, z of every vertex.
+    std::vector<float> positions = {};
+    // Three vertex indices per triangle.
+    std::vector<uint32_t> indices = {};
+
+    size_t vertexCount() const { return positions.size() / 3; }
+    size_t triangleCount() const { return indices.size() / 3; }
+
+    Vec3 vertex(uint32_t index) const {
+        return Vec3(positions[3 * size_t(index)], positions[3 * size_t(index) + 1], positions[3 * size_t(index) + 2]);
+    }
+
+    BoundingBox bounds() const {
+        auto box = BoundingBox();
+        for (size_t i = 0; i < vertexCount(); i++) {
+            box = box.expand(vertex(uint32_t(i)));
+        }
+        return box;
+    }
+};
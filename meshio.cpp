@@ -0,0 +1,637 @@
+#include "meshio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <vector>
+#include <fmt/format.h>
+
+#include "mappedfile.h"
+
+namespace {
+    // Below this, splitting the work costs more than it saves.
+    const size_t MIN_BYTES_PER_CHUNK = 1 << 20;
+
+    bool endsWith(const std::string &text, const std::string &suffix) {
+        return text.size() >= suffix.size() &&
+            std::equal(suffix.rbegin(), suffix.rend(), text.rbegin(), [](char a, char b) {
+                return std::tolower(a) == std::tolower(b);
+            });
+    }
+
+    size_t chunkCountFor(size_t bytes) {
+        auto threads = std::max(1u, std::thread::hardware_concurrency());
+        return std::clamp<size_t>(bytes / MIN_BYTES_PER_CHUNK, 1, threads);
+    }
+
+    // Runs work(chunk) for every chunk in [0, chunkCount) on its own thread.
+    template<class Work>
+    void forEachChunk(size_t chunkCount, Work &&work) {
+        if (chunkCount == 1) {
+            work(size_t(0));
+            return;
+        }
+        auto threads = std::vector<std::thread>();
+        threads.reserve(chunkCount);
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            threads.emplace_back([&work, chunk]() { work(chunk); });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    // OBJ
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char *skipSpaces(const char *position, const char *end) {
+        while (position < end && isSpace(*position)) {
+            position++;
+        }
+        return position;
+    }
+
+    bool isVertexLine(const char *line, const char *end) {
+        return end - line >= 2 && line[0] == 'v' && isSpace(line[1]);
+    }
+
+    bool isFaceLine(const char *line, const char *end) {
+        return end - line >= 2 && line[0] == 'f' && isSpace(line[1]);
+    }
+
+    // Calls visit(line, lineEnd) for every line in [begin, end), without the newline.
+    template<class Visit>
+    void forEachLine(const char *begin, const char *end, Visit &&visit) {
+        while (begin < end) {
+            auto lineEnd = static_cast<const char *>(std::memchr(begin, '\n', size_t(end - begin)));
+            if (!lineEnd) {
+                lineEnd = end;
+            }
+            visit(skipSpaces(begin, lineEnd), lineEnd);
+            begin = lineEnd + 1;
+        }
+    }
+
+    struct ObjChunk {
+    public:
+        const char *begin = nullptr;
+        const char *end = nullptr;
+        // Vertices in all chunks before this one, relative face indices count back from there.
+        size_t firstVertex = 0;
+        size_t vertexCount = 0;
+        std::vector<float> positions = {};
+        std::vector<uint32_t> indices = {};
+        // Face indices are checked against the final vertex count when the chunks are merged.
+        std::vector<int64_t> faceIndices = {};
+        bool valid = true;
+    };
+
+    bool parseObjChunk(ObjChunk &chunk) {
+        auto vertexCount = chunk.firstVertex;
+        auto polygon = std::vector<int64_t>();
+
+        forEachLine(chunk.begin, chunk.end, [&](const char *line, const char *lineEnd) {
+            if (!chunk.valid) {
+                return;
+            }
+            if (isVertexLine(line, lineEnd)) {
+                auto position = line + 1;
+                for (auto axis = 0; axis < 3; axis++) {
+                    position = skipSpaces(position, lineEnd);
+                    auto value = 0.0f;
+                    auto result = std::from_chars(position, lineEnd, value);
+                    if (result.ec != std::errc()) {
+                        chunk.valid = false;
+                        return;
+                    }
+                    chunk.positions.push_back(value);
+                    position = result.ptr;
+                }
+                vertexCount++;
+            }
+            else if (isFaceLine(line, lineEnd)) {
+                // Corners are v, v/vt, v//vn or v/vt/vn, only v is used.
+                polygon.clear();
+                auto position = skipSpaces(line + 1, lineEnd);
+                while (position < lineEnd) {
+                    int64_t index = 0;
+                    auto result = std::from_chars(position, lineEnd, index);
+                    if (result.ec != std::errc() || index == 0) {
+                        chunk.valid = false;
+                        return;
+                    }
+                    polygon.push_back(index > 0 ? index - 1 : int64_t(vertexCount) + index);
+                    position = result.ptr;
+                    while (position < lineEnd && !isSpace(*position)) {
+                        position++;
+                    }
+                    position = skipSpaces(position, lineEnd);
+                }
+                if (polygon.size() < 3) {
+                    chunk.valid = false;
+                    return;
+                }
+                for (size_t i = 1; i + 1 < polygon.size(); i++) {
+                    chunk.faceIndices.push_back(polygon[0]);
+                    chunk.faceIndices.push_back(polygon[i]);
+                    chunk.faceIndices.push_back(polygon[i + 1]);
+                }
+            }
+        });
+        return chunk.valid;
+    }
+
+    // PLY
+
+    enum class PlyType {
+        Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64
+    };
+
+    std::optional<PlyType> plyTypeFromName(const std::string &name) {
+        if (name == "char" || name == "int8") return PlyType::Int8;
+        if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+        if (name == "short" || name == "int16") return PlyType::Int16;
+        if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+        if (name == "int" || name == "int32") return PlyType::Int32;
+        if (name == "uint" || name == "uint32") return PlyType::UInt32;
+        if (name == "float" || name == "float32") return PlyType::Float32;
+        if (name == "double" || name == "float64") return PlyType::Float64;
+        return std::optional<PlyType>();
+    }
+
+    size_t plyTypeSize(PlyType type) {
+        switch (type) {
+        case PlyType::Int8: case PlyType::UInt8: return 1;
+        case PlyType::Int16: case PlyType::UInt16: return 2;
+        case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+        case PlyType::Float64: return 8;
+        }
+        return 0;
+    }
+
+    template<class T>
+    T readRaw(const char *data, bool swapBytes) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, data, sizeof(T));
+        if (swapBytes) {
+            std::reverse(bytes, bytes + sizeof(T));
+        }
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    double readPlyValue(const char *data, PlyType type, bool swapBytes) {
+        switch (type) {
+        case PlyType::Int8: return double(readRaw<int8_t>(data, false));
+        case PlyType::UInt8: return double(readRaw<uint8_t>(data, false));
+        case PlyType::Int16: return double(readRaw<int16_t>(data, swapBytes));
+        case PlyType::UInt16: return double(readRaw<uint16_t>(data, swapBytes));
+        case PlyType::Int32: return double(readRaw<int32_t>(data, swapBytes));
+        case PlyType::UInt32: return double(readRaw<uint32_t>(data, swapBytes));
+        case PlyType::Float32: return double(readRaw<float>(data, swapBytes));
+        case PlyType::Float64: return readRaw<double>(data, swapBytes);
+        }
+        return 0.0;
+    }
+
+    // A count or an index read as a PLY value, nothing unless it is in [0, limit). Converting anything
+    // else to an unsigned integer would be undefined.
+    std::optional<size_t> plyIndex(double value, size_t limit) {
+        if (!(value >= 0.0 && value < double(limit))) {
+            return std::optional<size_t>();
+        }
+        return size_t(value);
+    }
+
+    struct PlyProperty {
+    public:
+        std::string name = {};
+        PlyType type = PlyType::Float32;
+        bool isList = false;
+        PlyType countType = PlyType::UInt8;
+    };
+
+    struct PlyElement {
+    public:
+        std::string name = {};
+        size_t count = 0;
+        std::vector<PlyProperty> properties = {};
+
+        bool hasList() const {
+            return std::any_of(properties.begin(), properties.end(), [](const PlyProperty &p) { return p.isList; });
+        }
+        // Size of one record if it has no list properties.
+        size_t fixedSize() const {
+            size_t size = 0;
+            for (const auto &property : properties) {
+                size += plyTypeSize(property.type);
+            }
+            return size;
+        }
+    };
+
+    // Size in bytes of the record at data, which has list properties. 0 if it does not fit before end.
+    size_t plyRecordSize(const PlyElement &element, const char *data, const char *end, bool swapBytes) {
+        size_t size = 0;
+        for (const auto &property : element.properties) {
+            if (property.isList) {
+                auto countSize = plyTypeSize(property.countType);
+                if (data + size + countSize > end) {
+                    return 0;
+                }
+                // Every entry takes at least a byte, so a count beyond the end of the file is malformed anyway.
+                auto count = plyIndex(readPlyValue(data + size, property.countType, swapBytes), size_t(end - data) + 1);
+                if (!count) {
+                    return 0;
+                }
+                size += countSize + *count * plyTypeSize(property.type);
+            }
+            else {
+                size += plyTypeSize(property.type);
+            }
+        }
+        return data + size <= end ? size : 0;
+    }
+
+    struct PlyHeader {
+    public:
+        bool bigEndian = false;
+        std::vector<PlyElement> elements = {};
+        size_t dataOffset = 0;
+    };
+
+    std::optional<PlyHeader> parsePlyHeader(const MappedFile &file, const std::string &path) {
+        auto header = PlyHeader();
+        auto begin = file.data();
+        auto end = file.data() + file.size();
+        auto lineNumber = 0;
+        auto fail = [&](const char *problem) {
+            fmt::print(stderr, "{}: {} in header line {}\n", path, problem, lineNumber);
+            return std::optional<PlyHeader>();
+        };
+
+        auto position = begin;
+        while (position < end) {
+            auto lineEnd = static_cast<const char *>(std::memchr(position, '\n', size_t(end - position)));
+            if (!lineEnd) {
+                return fail("Unterminated header");
+            }
+            auto line = std::string(position, lineEnd);
+            position = lineEnd + 1;
+            lineNumber++;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+
+            auto words = std::vector<std::string>();
+            for (size_t i = 0; i < line.size();) {
+                auto wordEnd = line.find(' ', i);
+                if (wordEnd == std::string::npos) {
+                    wordEnd = line.size();
+                }
+                if (wordEnd > i) {
+                    words.push_back(line.substr(i, wordEnd - i));
+                }
+                i = wordEnd + 1;
+            }
+            if (words.empty()) {
+                continue;
+            }
+
+            if (lineNumber == 1) {
+                if (words[0] != "ply") {
+                    return fail("Missing ply magic");
+                }
+            }
+            else if (words[0] == "format") {
+                if (words.size() < 2 || words[1] == "ascii") {
+                    return fail("Only binary PLY is supported");
+                }
+                header.bigEndian = words[1] == "binary_big_endian";
+            }
+            else if (words[0] == "element") {
+                if (words.size() != 3) {
+                    return fail("Malformed element");
+                }
+                auto element = PlyElement();
+                element.name = words[1];
+                element.count = size_t(std::strtoull(words[2].c_str(), nullptr, 10));
+                header.elements.push_back(element);
+            }
+            else if (words[0] == "property") {
+                if (header.elements.empty()) {
+                    return fail("Property outside of an element");
+                }
+                auto property = PlyProperty();
+                if (words.size() == 5 && words[1] == "list") {
+                    auto countType = plyTypeFromName(words[2]);
+                    auto type = plyTypeFromName(words[3]);
+                    if (!countType || !type) {
+                        return fail("Unknown property type");
+                    }
+                    property.isList = true;
+                    property.countType = *countType;
+                    property.type = *type;
+                    property.name = words[4];
+                }
+                else if (words.size() == 3) {
+                    auto type = plyTypeFromName(words[1]);
+                    if (!type) {
+                        return fail("Unknown property type");
+                    }
+                    property.type = *type;
+                    property.name = words[2];
+                }
+                else {
+                    return fail("Malformed property");
+                }
+                header.elements.back().properties.push_back(property);
+            }
+            else if (words[0] == "end_header") {
+                header.dataOffset = size_t(position - begin);
+                return header;
+            }
+        }
+        return fail("Missing end_header");
+    }
+
+    bool readPlyVertices(const PlyElement &element, const char *data, bool swapBytes, MeshData &mesh) {
+        size_t offsets[3] = {};
+        PlyType types[3] = {};
+        const char *names[3] = { "x", "y", "z" };
+        for (auto axis = 0; axis < 3; axis++) {
+            size_t offset = 0;
+            auto found = false;
+            for (const auto &property : element.properties) {
+                if (property.name == names[axis]) {
+                    offsets[axis] = offset;
+                    types[axis] = property.type;
+                    found = true;
+                    break;
+                }
+                offset += plyTypeSize(property.type);
+            }
+            if (!found) {
+                return false;
+            }
+        }
+
+        auto stride = element.fixedSize();
+        mesh.positions.resize(3 * element.count);
+        auto chunkCount = chunkCountFor(element.count * stride);
+        forEachChunk(chunkCount, [&](size_t chunk) {
+            auto first = element.count * chunk / chunkCount;
+            auto last = element.count * (chunk + 1) / chunkCount;
+            for (auto i = first; i < last; i++) {
+                auto record = data + i * stride;
+                for (auto axis = 0; axis < 3; axis++) {
+                    mesh.positions[3 * i + axis] = float(readPlyValue(record + offsets[axis], types[axis], swapBytes));
+                }
+            }
+        });
+        return true;
+    }
+
+    // Appends the faces of the element as triangle fans. Returns the end of the element, or null if it is malformed
+    // or refers to a vertex that does not exist.
+    const char *readPlyFaces(const PlyElement &element, const char *data, const char *end, bool swapBytes, size_t vertexCount,
+        MeshData &mesh) {
+        auto indexLimit = std::min<size_t>(vertexCount, std::numeric_limits<uint32_t>::max());
+        auto listProperty = std::find_if(element.properties.begin(), element.properties.end(), [](const PlyProperty &p) {
+            return p.isList && (p.name == "vertex_indices" || p.name == "vertex_index");
+        });
+        if (listProperty == element.properties.end()) {
+            return nullptr;
+        }
+        size_t listOffset = 0;
+        for (auto property = element.properties.begin(); property != listProperty; property++) {
+            if (property->isList) {
+                return nullptr;
+            }
+            listOffset += plyTypeSize(property->type);
+        }
+        auto countSize = plyTypeSize(listProperty->countType);
+        auto indexSize = plyTypeSize(listProperty->type);
+
+        // Nearly every PLY holds only triangles, which makes every record the same size and the records
+        // independent. Try that in parallel first and fall back to walking the records one by one.
+        auto triangleStride = element.fixedSize() - indexSize + countSize + 3 * indexSize;
+        if (!element.properties.empty() && std::count_if(element.properties.begin(), element.properties.end(),
+                [](const PlyProperty &p) { return p.isList; }) == 1 &&
+            size_t(end - data) >= element.count * triangleStride) {
+            mesh.indices.resize(3 * element.count);
+            auto allTriangles = std::atomic<bool>(true);
+            auto indicesValid = std::atomic<bool>(true);
+            auto chunkCount = chunkCountFor(element.count * triangleStride);
+            forEachChunk(chunkCount, [&](size_t chunk) {
+                auto first = element.count * chunk / chunkCount;
+                auto last = element.count * (chunk + 1) / chunkCount;
+                for (auto i = first; i < last && allTriangles && indicesValid; i++) {
+                    auto list = data + i * triangleStride + listOffset;
+                    if (readPlyValue(list, listProperty->countType, swapBytes) != 3.0) {
+                        allTriangles = false;
+                        return;
+                    }
+                    for (auto corner = 0; corner < 3; corner++) {
+                        auto index = plyIndex(readPlyValue(list + countSize + corner * indexSize, listProperty->type, swapBytes), indexLimit);
+                        if (!index) {
+                            indicesValid = false;
+                            return;
+                        }
+                        mesh.indices[3 * i + corner] = uint32_t(*index);
+                    }
+                }
+            });
+            if (!indicesValid) {
+                return nullptr;
+            }
+            if (allTriangles) {
+                return data + element.count * triangleStride;
+            }
+            mesh.indices.clear();
+        }
+
+        for (size_t i = 0; i < element.count; i++) {
+            auto recordSize = plyRecordSize(element, data, end, swapBytes);
+            if (recordSize == 0) {
+                return nullptr;
+            }
+            auto list = data + listOffset;
+            // plyRecordSize checked the count already.
+            auto count = size_t(readPlyValue(list, listProperty->countType, swapBytes));
+            auto cornerValue = [&](size_t c) {
+                return readPlyValue(list + countSize + c * indexSize, listProperty->type, swapBytes);
+            };
+            for (size_t c = 0; c < count; c++) {
+                if (!plyIndex(cornerValue(c), indexLimit)) {
+                    return nullptr;
+                }
+            }
+            auto corner = [&](size_t c) { return uint32_t(cornerValue(c)); };
+            for (size_t c = 1; c + 1 < count; c++) {
+                mesh.indices.push_back(corner(0));
+                mesh.indices.push_back(corner(c));
+                mesh.indices.push_back(corner(c + 1));
+            }
+            data += recordSize;
+        }
+        return data;
+    }
+
+    bool indicesInRange(const MeshData &mesh) {
+        auto vertexCount = mesh.vertexCount();
+        return std::all_of(mesh.indices.begin(), mesh.indices.end(), [vertexCount](uint32_t index) { return index < vertexCount; });
+    }
+}
+
+std::optional<MeshData> meshio::load(const std::string &path) {
+    if (endsWith(path, ".obj")) {
+        return loadObj(path);
+    }
+    if (endsWith(path, ".ply")) {
+        return loadPly(path);
+    }
+    fmt::print(stderr, "Unknown mesh format for {}, use .obj or .ply\n", path);
+    return std::optional<MeshData>();
+}
+
+std::optional<MeshData> meshio::loadObj(const std::string &path) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+        return std::optional<MeshData>();
+    }
+    auto begin = file->data();
+    auto end = file->data() + file->size();
+
+    // Cut the file into chunks at line boundaries.
+    auto chunks = std::vector<ObjChunk>(chunkCountFor(file->size()));
+    for (size_t i = 0; i < chunks.size(); i++) {
+        chunks[i].begin = i == 0 ? begin : chunks[i - 1].end;
+        auto chunkEnd = begin + file->size() * (i + 1) / chunks.size();
+        if (i + 1 < chunks.size()) {
+            while (chunkEnd < end && chunkEnd > chunks[i].begin && chunkEnd[-1] != '\n') {
+                chunkEnd++;
+            }
+        }
+        chunks[i].end = std::max(chunks[i].begin, i + 1 < chunks.size() ? chunkEnd : end);
+    }
+
+    // Relative face indices depend on the number of vertices before them, so count those first.
+    forEachChunk(chunks.size(), [&](size_t i) {
+        forEachLine(chunks[i].begin, chunks[i].end, [&](const char *line, const char *lineEnd) {
+            chunks[i].vertexCount += isVertexLine(line, lineEnd);
+        });
+    });
+    for (size_t i = 1; i < chunks.size(); i++) {
+        chunks[i].firstVertex = chunks[i - 1].firstVertex + chunks[i - 1].vertexCount;
+    }
+    auto totalVertices = chunks.back().firstVertex + chunks.back().vertexCount;
+    chunks.back().valid = totalVertices <= std::numeric_limits<uint32_t>::max();
+
+    forEachChunk(chunks.size(), [&](size_t i) {
+        if (!parseObjChunk(chunks[i])) {
+            return;
+        }
+        chunks[i].indices.reserve(chunks[i].faceIndices.size());
+        for (auto index : chunks[i].faceIndices) {
+            if (index < 0 || size_t(index) >= totalVertices) {
+                chunks[i].valid = false;
+                return;
+            }
+            chunks[i].indices.push_back(uint32_t(index));
+        }
+        chunks[i].faceIndices = {};
+    });
+
+    auto mesh = MeshData();
+    size_t positionCount = 0;
+    size_t indexCount = 0;
+    for (const auto &chunk : chunks) {
+        if (!chunk.valid) {
+            fmt::print(stderr, "{} is not a valid OBJ file\n", path);
+            return std::optional<MeshData>();
+        }
+        positionCount += chunk.positions.size();
+        indexCount += chunk.indices.size();
+    }
+    mesh.positions.reserve(positionCount);
+    mesh.indices.reserve(indexCount);
+    for (const auto &chunk : chunks) {
+        mesh.positions.insert(mesh.positions.end(), chunk.positions.begin(), chunk.positions.end());
+        mesh.indices.insert(mesh.indices.end(), chunk.indices.begin(), chunk.indices.end());
+    }
+    return mesh;
+}
+
+std::optional<MeshData> meshio::loadPly(const std::string &path) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+        return std::optional<MeshData>();
+    }
+    auto header = parsePlyHeader(*file, path);
+    if (!header) {
+        return std::optional<MeshData>();
+    }
+
+    // Faces may come before the vertices, so they are checked against the count the header gives.
+    size_t vertexCount = 0;
+    for (const auto &element : header->elements) {
+        if (element.name == "vertex") {
+            vertexCount = element.count;
+        }
+    }
+
+    auto mesh = MeshData();
+    auto data = file->data() + header->dataOffset;
+    auto end = file->data() + file->size();
+    auto fail = [&](const std::string &problem) {
+        fmt::print(stderr, "{}: {}\n", path, problem);
+        return std::optional<MeshData>();
+    };
+
+    for (const auto &element : header->elements) {
+        if (element.name == "vertex") {
+            if (element.hasList() || size_t(end - data) < element.count * element.fixedSize()) {
+                return fail("Malformed vertex element");
+            }
+            if (!readPlyVertices(element, data, header->bigEndian, mesh)) {
+                return fail("Vertices need x, y and z");
+            }
+            data += element.count * element.fixedSize();
+        }
+        else if (element.name == "face") {
+            data = readPlyFaces(element, data, end, header->bigEndian, vertexCount, mesh);
+            if (!data) {
+                return fail("Malformed face element, or a face refers to a vertex that does not exist");
+            }
+        }
+        else if (!element.hasList()) {
+            if (size_t(end - data) < element.count * element.fixedSize()) {
+                return fail(fmt::format("Truncated {} element", element.name));
+            }
+            data += element.count * element.fixedSize();
+        }
+        else {
+            for (size_t i = 0; i < element.count; i++) {
+                auto recordSize = plyRecordSize(element, data, end, header->bigEndian);
+                if (recordSize == 0) {
+                    return fail(fmt::format("Truncated {} element", element.name));
+                }
+                data += recordSize;
+            }
+        }
+    }
+
+    if (!indicesInRange(mesh)) {
+        return fail("Face refers to a vertex that does not exist");
+    }
+    return mesh;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "meshdata.h"
+
+namespace meshio {
+    // Picks the format from the extension of path, .obj or .ply.
+    // Prints the problem and returns nothing if the file cannot be read.
+    std::optional<MeshData> load(const std::string &path);
+
+    // Wavefront OBJ. Only vertex positions and faces are read, polygons are split into triangle fans.
+    std::optional<MeshData> loadObj(const std::string &path);
+    // Binary PLY, little or big endian, with x, y, z vertex properties and a vertex_indices face list.
+    std::optional<MeshData> loadPly(const std::string &path);
+}
@@ -0,0 +1,323 @@
+#include "options.h"
+
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+#include <fmt/format.h>
+
+#include "image.h"
+
+namespace {
+    bool parseInt(const char *text, int min, int &value) {
+        char *end = nullptr;
+        errno = 0;
+        auto parsed = std::strtol(text, &end, 10);
+        if (errno != 0 || end == text || *end != '\0' || parsed < min || parsed > 1'000'000'000) {
+            return false;
+        }
+        value = int(parsed);
+        return true;
+    }
+
+    bool parseFloat(const char *text, float &value) {
+        char *end = nullptr;
+        errno = 0;
+        auto parsed = std::strtof(text, &end);
+        if (errno != 0 || end == text || *end != '\0' || !std::isfinite(parsed)) {
+            return false;
+        }
+        value = parsed;
+        return true;
+    }
+
+    // Three comma separated numbers.
+    bool parseVector(const char *text, Vec3 &value) {
+        auto parts = std::string(text);
+        auto first = parts.find(',');
+        auto second = first == std::string::npos ? first : parts.find(',', first + 1);
+        if (second == std::string::npos) {
+            return false;
+        }
+        return parseFloat(parts.substr(0, first).c_str(), value.x) &&
+            parseFloat(parts.substr(first + 1, second - first - 1).c_str(), value.y) &&
+            parseFloat(parts.substr(second + 1).c_str(), value.z);
+    }
+}
+
+void options::printUsage(const char *program) {
+    fmt::print(
+        "Usage: {} [options]\n"
+        "  --headless          Render without opening a window, requires --output\n"
+        "  --width <n>         Image width in pixels (default 500)\n"
+        "  --height <n>        Image height in pixels (default 500)\n"
+        "  --samples <n>       Samples per pixel (default 1024)\n"
+        "  --samples-per-pass <n>  Samples per pixel in each progressive pass (default 4)\n"
+        "  --adaptive <error>  Stop sampling pixels whose relative error is below this, e.g. 0.05,\n"
+        "                      --samples becomes the average budget (default 0, off)\n"
+        "  --time-limit <s>    Stop after the pass that exceeds this many seconds, 0 for none (default 0)\n"
+        "  --max-depth <n>     Maximum number of bounces, Russian roulette ends most paths earlier (default 32)\n"
+        "  --exposure <stops>  Brightness adjustment before tonemapping (default 0)\n"
+        "  --threads <n>       Number of render threads, 0 for all cores (default 0)\n"
+        "  --output <path>     Write the finished image, .ppm (8 bit) or .pfm (float)\n"
+        "  --denoise           Filter the finished image guided by first hit albedo, normals and depth\n"
+        "  --features <prefix> Write the first hit albedo, normals and depth as <prefix>albedo.pfm, ...\n"
+        "  --stats <path>      Write ray counts, intersection tests, path lengths and tile times as JSON\n"
+        "  --heatmap <path>    Write the render time per pixel as a false color .ppm\n"
+        "  --checkpoint <path> Save the state of the render there now and then, and when it stops\n"
+        "  --checkpoint-interval <s>  Seconds between checkpoints (default 60)\n"
+        "  --resume            Go on from the --checkpoint of an earlier run of the same render\n"
+        "  --frames <n>        Render n frames of the animation as <output>.0000.ppm, ..., implies --headless\n"
+        "  --frame-rate <n>    Frames per second of the animation (default 24)\n"
+        "  --high-poly         Render the >100k triangle scene\n"
+        "  --crowd             Render the scene of >3M triangles placed by instances of one sphere\n"
+        "  --mesh <path>       Put an .obj or binary .ply mesh into the scene\n"
+        "  --scene-cache <path>  Map the compiled scene from this file, or write it there if it is missing or stale\n"
+        "  --camera <x,y,z>    Put the camera there (default 0,0,0)\n"
+        "  --look-at <x,y,z>   Point the camera there (default straight ahead along +z)\n"
+        "  --fov <degrees>     Vertical field of view of the camera (default 53.13)\n"
+        "  --sampler <name>    random or sobol (default sobol)\n"
+        "  --seed <n>          Seed for the sampler (default 0)\n"
+        "  --engine <name>     recursive or wavefront (default recursive)\n"
+        "  --coordinator <port> Render on the workers that connect to this port instead of here, requires --output\n"
+        "  --worker <host>:<port>  Render tiles for the coordinator there, with the scene and settings it sends\n"
+        "  --serve <port>      Render jobs sent to this local port, keeping scenes and images between them\n"
+        "  --submit <port>     Send the render to the server on this local port and write the image it returns,\n"
+        "                      requires --output\n"
+        "  --priority <n>      Of a job sent with --submit, higher ones are rendered first (default 0)\n"
+        "  --check-allocations Trace rays on one thread and fail if that allocates\n"
+        "  --help              Show this text\n",
+        program
+    );
+}
+
+std::optional<RenderOptions> options::parse(int argc, char **argv) {
+    auto options = RenderOptions();
+
+    for (auto i = 1; i < argc; i++) {
+        auto argument = std::string(argv[i]);
+        auto hasValue = i + 1 < argc;
+
+        struct IntOption {
+            const char *name;
+            int min;
+            int *value;
+        };
+        const IntOption intOptions[] = {
+            { "--width", 1, &options.width },
+            { "--height", 1, &options.height },
+            { "--samples", 1, &options.samplesPerPixel },
+            { "--samples-per-pass", 1, &options.samplesPerPass },
+            { "--time-limit", 0, &options.timeLimit },
+            { "--max-depth", 0, &options.maxDepth },
+            { "--threads", 0, &options.threads },
+            { "--seed", 0, &options.seed },
+            { "--coordinator", 1, &options.coordinatorPort },
+            { "--serve", 1, &options.servePort },
+            { "--submit", 1, &options.submitPort },
+            { "--priority", 0, &options.priority },
+            { "--checkpoint-interval", 0, &options.checkpointInterval },
+            { "--frames", 1, &options.frames },
+            { "--frame-rate", 1, &options.frameRate },
+        };
+
+        auto handled = false;
+        for (const auto &intOption : intOptions) {
+            if (argument != intOption.name) {
+                continue;
+            }
+            if (!hasValue || !parseInt(argv[i + 1], intOption.min, *intOption.value)) {
+                fmt::print(stderr, "{} expects an integer >= {}\n", intOption.name, intOption.min);
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            i++;
+            handled = true;
+        }
+        if (handled) {
+            continue;
+        }
+
+        if (argument == "--headless") {
+            options.headless = true;
+        }
+        else if (argument == "--denoise") {
+            options.denoise = true;
+        }
+        else if (argument == "--features" && hasValue) {
+            options.featuresPrefix = argv[++i];
+        }
+        else if (argument == "--worker") {
+            auto address = hasValue ? std::string(argv[i + 1]) : std::string();
+            auto colon = address.rfind(':');
+            if (colon == std::string::npos || colon == 0 ||
+                !parseInt(address.c_str() + colon + 1, 1, options.workerPort) || options.workerPort > 65535) {
+                fmt::print(stderr, "--worker expects <host>:<port>\n");
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            options.workerHost = address.substr(0, colon);
+            i++;
+        }
+        else if (argument == "--checkpoint" && hasValue) {
+            options.checkpointPath = argv[++i];
+        }
+        else if (argument == "--resume") {
+            options.resume = true;
+        }
+        else if (argument == "--check-allocations") {
+            options.checkAllocations = true;
+        }
+        else if (argument == "--high-poly") {
+            options.sceneType = SceneType::HighPolygon;
+        }
+        else if (argument == "--crowd") {
+            options.sceneType = SceneType::Crowd;
+        }
+        else if (argument == "--sampler") {
+            auto name = hasValue ? std::string(argv[i + 1]) : std::string();
+            if (name == "random") {
+                options.samplerType = SamplerType::Random;
+            }
+            else if (name == "sobol") {
+                options.samplerType = SamplerType::Sobol;
+            }
+            else {
+                fmt::print(stderr, "--sampler expects random or sobol\n");
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            i++;
+        }
+        else if (argument == "--engine") {
+            auto name = hasValue ? std::string(argv[i + 1]) : std::string();
+            if (name == "recursive") {
+                options.engine = Engine::Recursive;
+            }
+            else if (name == "wavefront") {
+                options.engine = Engine::Wavefront;
+            }
+            else {
+                fmt::print(stderr, "--engine expects recursive or wavefront\n");
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            i++;
+        }
+        else if (argument == "--exposure") {
+            if (!hasValue || !parseFloat(argv[i + 1], options.exposure)) {
+                fmt::print(stderr, "--exposure expects a number\n");
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            i++;
+        }
+        else if (argument == "--camera") {
+            auto position = Vec3();
+            if (!hasValue || !parseVector(argv[i + 1], position)) {
+                fmt::print(stderr, "--camera expects x,y,z\n");
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            options.cameraPosition = position;
+            i++;
+        }
+        else if (argument == "--look-at") {
+            auto target = Vec3();
+            if (!hasValue || !parseVector(argv[i + 1], target)) {
+                fmt::print(stderr, "--look-at expects x,y,z\n");
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            options.cameraTarget = target;
+            i++;
+        }
+        else if (argument == "--fov") {
+            auto fieldOfView = 0.0f;
+            if (!hasValue || !parseFloat(argv[i + 1], fieldOfView) || fieldOfView < Camera::MIN_FIELD_OF_VIEW ||
+                fieldOfView > Camera::MAX_FIELD_OF_VIEW) {
+                fmt::print(stderr, "--fov expects degrees from {} to {}\n", Camera::MIN_FIELD_OF_VIEW, Camera::MAX_FIELD_OF_VIEW);
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            options.fieldOfView = fieldOfView;
+            i++;
+        }
+        else if (argument == "--adaptive") {
+            if (!hasValue || !parseFloat(argv[i + 1], options.adaptiveThreshold) || options.adaptiveThreshold < 0.0f) {
+                fmt::print(stderr, "--adaptive expects a relative error of 0 or more\n");
+                printUsage(argv[0]);
+                return std::optional<RenderOptions>();
+            }
+            i++;
+        }
+        else if (argument == "--output" && hasValue) {
+            options.outputPath = argv[++i];
+        }
+        else if (argument == "--stats" && hasValue) {
+            options.statsPath = argv[++i];
+        }
+        else if (argument == "--heatmap" && hasValue) {
+            options.heatmapPath = argv[++i];
+        }
+        else if (argument == "--mesh" && hasValue) {
+            options.meshPath = argv[++i];
+        }
+        else if (argument == "--scene-cache" && hasValue) {
+            options.sceneCachePath = argv[++i];
+        }
+        else if (argument == "--help") {
+            printUsage(argv[0]);
+            options.help = true;
+            return options;
+        }
+        else {
+            fmt::print(stderr, "Unknown or incomplete argument {}\n", argument);
+            printUsage(argv[0]);
+            return std::optional<RenderOptions>();
+        }
+    }
+
+    if (options.frames > 1) {
+        options.headless = true;
+        if (options.coordinatorPort > 0 || !options.checkpointPath.empty() || !options.sceneCachePath.empty()) {
+            fmt::print(stderr, "--frames does not support --coordinator, --checkpoint or --scene-cache\n");
+            printUsage(argv[0]);
+            return std::optional<RenderOptions>();
+        }
+    }
+
+    if (options.headless && options.outputPath.empty()) {
+        fmt::print(stderr, "--headless needs an --output path\n");
+        printUsage(argv[0]);
+        return std::optional<RenderOptions>();
+    }
+
+    if (options.coordinatorPort > 65535 || options.servePort > 65535 || options.submitPort > 65535) {
+        fmt::print(stderr, "Ports go up to 65535\n");
+        printUsage(argv[0]);
+        return std::optional<RenderOptions>();
+    }
+    if (options.coordinatorPort > 0) {
+        options.headless = true;
+        if (options.outputPath.empty() || options.adaptiveThreshold > 0.0f || !options.statsPath.empty() ||
+            !options.heatmapPath.empty() || !options.checkpointPath.empty()) {
+            fmt::print(stderr, "--coordinator needs an --output path and does not support --adaptive, --stats, --heatmap or --checkpoint\n");
+            printUsage(argv[0]);
+            return std::optional<RenderOptions>();
+        }
+    }
+
+    if (options.resume && options.checkpointPath.empty()) {
+        fmt::print(stderr, "--resume needs a --checkpoint path\n");
+        printUsage(argv[0]);
+        return std::optional<RenderOptions>();
+    }
+
+    if (options.submitPort > 0 && !imageio::formatOf(options.outputPath)) {
+        fmt::print(stderr, "--submit needs an --output path ending in .ppm or .pfm\n");
+        printUsage(argv[0]);
+        return std::optional<RenderOptions>();
+    }
+
+    return options;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "scene.h"
+#include "sampler.h"
+
+enum class Engine {
+    // Depth first, one path at a time, see shootRay.
+    Recursive,
+    // Breadth first, a tile's paths at a time, see WavefrontRenderer.
+    Wavefront
+};
+
+struct RenderOptions {
+public:
+    int width = 500;
+    int height = 500;
+    int samplesPerPixel = 1024;
+    // Samples per pixel in every progressive pass after the first one, which always takes one.
+    int samplesPerPass = 4;
+    // Pixels stop taking samples once the standard error of their mean, relative to the mean,
+    // drops below this. samplesPerPixel then is the average. 0 samples every pixel the same.
+    float adaptiveThreshold = 0.0f;
+    // Stop after the pass that exceeds this many seconds, 0 for no limit.
+    int timeLimit = 0;
+    // Bounces after which a path is cut off. Only a safety net, Russian roulette ends paths long before.
+    int maxDepth = 32;
+    // In stops, applied before tonemapping to 8 bit.
+    float exposure = 0.0f;
+    // 0 uses one worker per hardware thread.
+    int threads = 0;
+    // --help was given and the usage printed, there is nothing else to do.
+    bool help = false;
+    // Render without a window, for batch jobs and benchmarks. Needs an output path. The window lets the
+    // camera be moved, see runWindowed.
+    bool headless = false;
+    // Render this many frames of the scene's animation, each written next to the output path with its
+    // number, see Scene::setTime. More than one implies headless. 1 renders the scene as created.
+    int frames = 1;
+    // Frames per second of animation time.
+    int frameRate = 24;
+    // Listen on this port and render the frame on the workers that connect, instead of on this machine.
+    // Implies headless. 0 for a local render.
+    int coordinatorPort = 0;
+    // Render tiles for the coordinator at this host and port instead, as long as it has any. Empty for none.
+    std::string workerHost = {};
+    int workerPort = 0;
+    // Where the state of the render is saved now and then, so it can be resumed. Empty for never.
+    std::string checkpointPath = {};
+    // Seconds between checkpoints, they are only taken between passes. 0 takes one after every pass.
+    int checkpointInterval = 60;
+    // Go on from the checkpoint at checkpointPath, if there is one for the same render.
+    bool resume = false;
+    // Keep compiled scenes and finished images around and render the jobs that come in on this port of
+    // the local machine, see renderserver.h. 0 for none.
+    int servePort = 0;
+    // Send a render job to the server on this local port instead of rendering, and write the image it
+    // returns to outputPath. 0 for none.
+    int submitPort = 0;
+    // Of the job sent with submitPort, the server renders higher ones first.
+    int priority = 0;
+    // Check that tracing rays does not allocate, instead of rendering.
+    bool checkAllocations = false;
+    // .ppm or .pfm, chosen by the extension. Empty for no output.
+    std::string outputPath = {};
+    // Filter the finished image, see denoiser.h. The window shows it too once the render is done.
+    bool denoise = false;
+    // Writes the first hit albedo, normal and depth as <prefix>albedo.pfm, <prefix>normal.pfm and
+    // <prefix>depth.pfm, for external denoisers. Empty for none.
+    std::string featuresPrefix = {};
+    // Render statistics as JSON, written when the render is done. Empty for none.
+    std::string statsPath = {};
+    // Time spent per pixel as a false color .ppm. Empty for none, timing every pixel costs a little.
+    std::string heatmapPath = {};
+    SceneType sceneType = SceneType::CornellBox;
+    // Where the camera is, nothing for where the scene puts it. A render setting rather than part of the
+    // scene, so renders from other places can share one compiled scene.
+    std::optional<Vec3> cameraPosition = {};
+    // What the camera looks at, nothing to keep the direction of the scene's camera.
+    std::optional<Vec3> cameraTarget = {};
+    // Vertical, in degrees. Nothing for the scene camera's.
+    std::optional<float> fieldOfView = {};
+    // .obj or .ply to put into the scene. Empty for none.
+    std::string meshPath = {};
+    // Where the compiled scene is kept between runs. Empty to always build it.
+    std::string sceneCachePath = {};
+    SamplerType samplerType = SamplerType::Sobol;
+    Engine engine = Engine::Recursive;
+    // Renders with the same seed and options are identical, independent of the number of threads.
+    int seed = 0;
+};
+
+namespace options {
+    // Prints the problem and the usage and returns nothing on invalid arguments. Prints the usage and
+    // returns options with help set for --help, the rest of the arguments are not checked then.
+    std::optional<RenderOptions> parse(int argc, char **argv);
+    void printUsage(const char *program);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+// PCG32 random number generator (pcg-random.org): 64 bits of state, a multiply, an add and a shift per number.
+class Pcg32 {
+    uint64_t _state = 0x853c49e6748fea9bULL;
+    uint64_t _increment = 0xda3e39cb94b95bdbULL;
+
+public:
+    Pcg32() = default;
+    // Generators with different sequences never overlap, whatever their seeds.
+    explicit Pcg32(uint64_t seed, uint64_t sequence = 1) {
+        _state = 0;
+        _increment = (sequence << 1u) | 1u;
+        nextUint();
+        _state += seed;
+        nextUint();
+    }
+
+    uint32_t nextUint() {
+        auto oldState = _state;
+        _state = oldState * 6364136223846793005ULL + _increment;
+        auto xorShifted = uint32_t(((oldState >> 18u) ^ oldState) >> 27u);
+        auto rotation = uint32_t(oldState >> 59u);
+        return (xorShifted >> rotation) | (xorShifted << ((~rotation + 1u) & 31));
+    }
+
+    // Uniform in [0, 1), using the top 24 bits so every value is exactly representable.
+    float nextFloat() {
+        return (nextUint() >> 8) * (1.0f / 16777216.0f);
+    }
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "vec3.h"
+
+// What the camera ray of a sample hit first. Noise free, or nearly so, and the denoiser uses it to tell
+// edges from noise. Summed over the samples of a pixel like the radiance.
+struct PixelFeatures {
+public:
+    // Of the material, emitters and the background count as white.
+    Radiance albedo = {};
+    // Facing the camera, zero for the background.
+    Vec3 normal = {};
+    // Distance along the camera ray, zero for the background.
+    float depth = 0.0f;
+
+    PixelFeatures &operator+=(const PixelFeatures &other) {
+        albedo += other.albedo;
+        normal += other.normal;
+        depth += other.depth;
+        return *this;
+    }
+
+    PixelFeatures operator/(float divisor) const {
+        auto features = *this;
+        features.albedo = albedo / divisor;
+        features.normal = normal / divisor;
+        features.depth = depth / divisor;
+        return features;
+    }
+};
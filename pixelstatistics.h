@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "vec3.h"
+
+// Running mean and variance of the luminance of a pixel's samples (Welford), so the error of the pixel
+// can be estimated without keeping the samples. Statistics of separate batches merge exactly (Chan et al.),
+// which is how a pass's samples get into the framebuffer.
+struct PixelStatistics {
+public:
+    int count = 0;
+    float mean = 0.0f;
+    // Sum of the squared differences from the mean.
+    float m2 = 0.0f;
+
+    static float luminance(Radiance radiance) {
+        return radiance.dot(Radiance(0.2126f, 0.7152f, 0.0722f));
+    }
+
+    void add(Radiance sample) {
+        auto value = luminance(sample);
+        count++;
+        auto delta = value - mean;
+        mean += delta / float(count);
+        m2 += delta * (value - mean);
+    }
+
+    void merge(const PixelStatistics &other) {
+        if (other.count == 0) {
+            return;
+        }
+        auto total = count + other.count;
+        auto delta = other.mean - mean;
+        mean += delta * float(other.count) / float(total);
+        m2 += other.m2 + delta * delta * (float(count) * float(other.count) / float(total));
+        count = total;
+    }
+
+    float variance() const { return count > 1 ? m2 / float(count - 1) : 0.0f; }
+
+    // Standard error of the mean, relative to the mean. Dark pixels are measured against a floor instead,
+    // their noise is hard to see and would otherwise never converge.
+    float relativeError() const {
+        const auto DARK_FLOOR = 0.05f;
+        if (count == 0) {
+            return INFINITY;
+        }
+        return std::sqrt(variance() / float(count)) / std::max(mean, DARK_FLOOR);
+    }
+};
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+
+#include "vec3.h"
+#include "material.h"
+#include "meshdata.h"
+#include "transform.h"
+
+struct SpherePrimitive {
+public:
+    Vec3 center = {};
+    float radius = 0.0f;
+    uint32_t materialIndex = 0;
+};
+
+struct TrianglePrimitive {
+public:
+    Vec3 vertex0 = {};
+    Vec3 vertex1 = {};
+    Vec3 vertex2 = {};
+    uint32_t materialIndex = 0;
+};
+
+// Triangles of a shared mesh, scaled and then moved by offset. Compiling the scene reads them
+// straight from the mesh, without going through a TrianglePrimitive per triangle.
+struct MeshPrimitive {
+public:
+    std::shared_ptr<const MeshData> mesh = {};
+    Vec3 offset = {};
+    float scale = 1.0f;
+    uint32_t materialIndex = 0;
+
+    Vec3 vertex(uint32_t index) const { return mesh->vertex(index) * scale + offset; }
+};
+
+// Spheres and triangles in coordinates of their own, placed in the scene by any number of instances.
+// It is compiled once, with a BVH of its own, however many instances there are. At least one primitive.
+struct GeometryPrimitive {
+public:
+    // What the geometry was made from, so it is only added once for all of its instances.
+    const void *source = nullptr;
+    std::vector<SpherePrimitive> spheres = {};
+    std::vector<TrianglePrimitive> triangles = {};
+};
+
+struct InstancePrimitive {
+public:
+    static const uint32_t NO_MATERIAL = ~0u;
+
+    uint32_t geometry = 0;
+    Transform transform = {};
+    // Replaces the materials of the geometry's primitives, NO_MATERIAL to keep them.
+    uint32_t materialIndex = NO_MATERIAL;
+};
+
+// Plain description of the geometry of a scene, which scene objects add themselves to.
+// This is what gets compiled into the CompiledScene that rays are traced against.
+struct PrimitiveList {
+public:
+    std::vector<SpherePrimitive> spheres = {};
+    std::vector<TrianglePrimitive> triangles = {};
+    std::vector<MeshPrimitive> meshes = {};
+    std::vector<GeometryPrimitive> geometries = {};
+    std::vector<InstancePrimitive> instances = {};
+    // Every distinct material once, primitives refer to it by index.
+    std::vector<Material> materials = {};
+
+    uint32_t addMaterial(const Material &material) {
+        auto existing = std::find(materials.begin(), materials.end(), material);
+        if (existing != materials.end()) {
+            return uint32_t(existing - materials.begin());
+        }
+        materials.push_back(material);
+        return uint32_t(materials.size() - 1);
+    }
+};
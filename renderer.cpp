@@ -0,0 +1,618 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <thread>
+#include <fmt/format.h>
+
+#include "wavefront.h"
+
+namespace {
+    float powerHeuristic(float pdf, float otherPdf) {
+        return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+    }
+}
+
+std::optional<LightConnection> connectToLight(Vec3 origin, Vec3 outgoing, const Bsdf &bsdf, Sampler &sampler, const Scene &scene) {
+    const auto &light = scene.lightSphere();
+    auto [u1, u2] = sampler.next2D();
+    if (!bsdf.hasSmoothLobe()) {
+        return std::optional<LightConnection>();
+    }
+    auto sample = light.sampleDirection(origin, u1, u2);
+    if (!sample) {
+        return std::optional<LightConnection>();
+    }
+    auto bsdfPdf = bsdf.pdf(outgoing, sample->direction);
+    if (bsdfPdf <= 0.0f) {
+        return std::optional<LightConnection>();
+    }
+
+    auto weight = powerHeuristic(sample->pdf, bsdfPdf);
+    auto emitted = light.material().emittingColor().value_or(Radiance());
+
+    auto connection = LightConnection();
+    connection.ray = Ray(origin, sample->direction);
+    // Stop just short of the light, which is in the scene like any other object.
+    connection.distance = sample->distance * 0.999f;
+    connection.radiance = emitted * bsdf.evaluate(outgoing, sample->direction) * (weight / sample->pdf);
+    return connection;
+}
+
+float lightHitWeight(const Ray &ray, float bouncePdf, const Scene &scene) {
+    if (bouncePdf <= 0.0f) {
+        return 1.0f;
+    }
+    return powerHeuristic(bouncePdf, scene.lightSphere().directionPdf(ray.origin()));
+}
+
+bool survivesRussianRoulette(Radiance &throughput, int bounces, Sampler &sampler) {
+    if (bounces < renderconstants::RUSSIAN_ROULETTE_MIN_BOUNCES) {
+        return true;
+    }
+    auto survival = std::min(std::max({ throughput[0], throughput[1], throughput[2] }),
+        renderconstants::RUSSIAN_ROULETTE_MAX_SURVIVAL);
+    if (sampler.next1D() >= survival) {
+        return false;
+    }
+    throughput = throughput / survival;
+    return true;
+}
+
+PixelFeatures firstHitFeatures(const Ray &ray, const std::optional<Intersection> &intersection) {
+    auto features = PixelFeatures();
+    features.albedo = Radiance(1.0f, 1.0f, 1.0f);
+    if (!intersection) {
+        return features;
+    }
+
+    auto normal = intersection->surfaceNormal();
+    if (normal.dot(ray.direction()) > 0.0f) {
+        normal = -normal;
+    }
+    features.normal = normal;
+    features.depth = intersection->distance();
+    if (!intersection->material().emittingColor()) {
+        features.albedo = Bsdf(intersection->material(), normal).albedo();
+    }
+    return features;
+}
+
+Radiance shootRay(const Ray &cameraRay, const Scene &scene, Sampler &sampler, int maxDepth, PixelFeatures &features) {
+    const auto BACKGROUND = Radiance(1.0f, 1.0f, 1.0f) * renderconstants::BACKGROUND_RADIANCE;
+
+    auto ray = cameraRay;
+    auto radiance = Radiance();
+    // Product of the attenuation of all bounces so far, what the path still carries.
+    auto throughput = Radiance(1.0f, 1.0f, 1.0f);
+    // Density of the direction of the last bounce, 0 for the camera ray.
+    auto bouncePdf = 0.0f;
+    // depth is the number of rays traced before this one.
+    for (auto depth = 0;; depth++) {
+        renderstats::countRays(depth == 0 ? renderstats::RayType::Camera : renderstats::RayType::Bounce);
+        auto intersection = scene.closestHit(ray);
+        if (depth == 0) {
+            features = firstHitFeatures(ray, intersection);
+        }
+        if (!intersection) {
+            // Hit outside of the world. The background is not sampled directly, so it needs no MIS weight.
+            renderstats::countPath(depth + 1);
+            return radiance + throughput * BACKGROUND;
+        }
+        const auto &material = intersection->material();
+        auto emittingColor = material.emittingColor();
+        if (emittingColor) {
+            renderstats::countPath(depth + 1);
+            return radiance + throughput * emittingColor.value() * lightHitWeight(ray, bouncePdf, scene);
+        }
+
+        if (depth + 1 > maxDepth) {
+            renderstats::countPath(depth + 1);
+            return radiance;
+        }
+
+        // Surfaces are two sided, shade the side the ray came from.
+        auto normal = intersection->surfaceNormal();
+        if (normal.dot(ray.direction()) > 0.0f) {
+            normal = -normal;
+        }
+        // Move the origin a little bit out of the object so it does not hit itself
+        auto origin = intersection->position() + normal * 0.5f;
+        auto outgoing = -ray.direction();
+        auto bsdf = Bsdf(material, normal);
+
+        auto connection = connectToLight(origin, outgoing, bsdf, sampler, scene);
+        if (connection) {
+            renderstats::countRays(renderstats::RayType::Shadow);
+            if (!scene.occluded(connection->ray, connection->distance)) {
+                radiance += throughput * connection->radiance;
+            }
+        }
+
+        // Continue in a direction picked by the material, to simulate global illumination
+        auto bounce = bsdf.sample(outgoing, sampler);
+        if (!bounce) {
+            renderstats::countPath(depth + 1);
+            return radiance;
+        }
+        throughput = throughput * bounce->weight;
+        if (!survivesRussianRoulette(throughput, depth + 1, sampler)) {
+            renderstats::countPath(depth + 1);
+            return radiance;
+        }
+        bouncePdf = bounce->pdf;
+        ray = Ray(origin, bounce->direction);
+    }
+}
+
+Camera renderCamera(const RenderOptions &options, const Scene &scene) {
+    auto camera = scene.camera();
+    auto position = options.cameraPosition.value_or(camera.origin());
+    // A camera that is only moved keeps looking the same way.
+    auto target = options.cameraTarget.value_or(position + camera.direction());
+    auto fieldOfView = options.fieldOfView.value_or(camera.fieldOfView());
+    return Camera(position, target, fieldOfView, float(options.width) / float(options.height));
+}
+
+Ray createCameraRay(float x, float y, Sampler &sampler, const Camera &camera, const RenderOptions &options) {
+    // Jitter inside the pixel, which antialiases the edges as the samples add up.
+    auto [jitterX, jitterY] = sampler.next2D();
+    x += jitterX - 0.5f;
+    y += jitterY - 0.5f;
+    return Ray(camera.origin(), camera.rayDirection(2.0f * x / options.width, 2.0f * y / options.height));
+}
+
+Radiance shootRayforPixel(float x, float y, Sampler &sampler, const Camera &camera, const RenderOptions &options,
+    const Scene &scene, PixelFeatures &features) {
+    auto ray = createCameraRay(x, y, sampler, camera, options);
+    return shootRay(ray, scene, sampler, options.maxDepth, features);
+}
+
+PixelWork renderPixel(int x, int y, int firstSample, int sampleCount, const Camera &camera, const RenderOptions &options,
+    const Scene &scene) {
+    PixelWork work = {};
+    work.x = x;
+    work.y = y;
+
+    auto moved_x = x - (options.width / 2);
+    // Positive y is up in world space, but in screen (sdl) space its down
+    auto moved_y = (options.height / 2) - y;
+
+    // Both live on the stack, tracing must not allocate.
+    auto randomSampler = RandomSampler(uint32_t(options.seed));
+    auto sobolSampler = SobolSampler(uint32_t(options.seed));
+    auto &sampler = options.samplerType == SamplerType::Random
+        ? static_cast<Sampler &>(randomSampler)
+        : static_cast<Sampler &>(sobolSampler);
+
+    for (auto i = 0; i < sampleCount; i++) {
+        sampler.startSample(x, y, uint32_t(firstSample + i));
+        auto features = PixelFeatures();
+        auto radiance = shootRayforPixel(float(moved_x), float(moved_y), sampler, camera, options, scene, features);
+        work.radianceSum += radiance;
+        work.statistics.add(radiance);
+        work.featureSum += features;
+    }
+
+    return work;
+}
+
+ProgressiveRender::ProgressiveRender(const RenderOptions &options, const Scene &scene, TileScheduler &scheduler, Framebuffer &framebuffer,
+    const Checkpoint *resumeFrom)
+    : _options(options), _scene(scene), _scheduler(scheduler), _framebuffer(framebuffer) {
+    _tiles = tileutils::splitIntoTiles(Tile{ 0, 0, options.width, options.height }, TILE_SIZE);
+    _tileSeconds.resize(_tiles.size());
+    if (!options.heatmapPath.empty()) {
+        _pixelSeconds.resize(size_t(options.width) * options.height);
+    }
+    _activeTiles = _tiles;
+    _activePixelCount = size_t(options.width) * options.height;
+    _statsAtStart = renderstats::totals();
+    _startTime = std::chrono::steady_clock::now();
+    fmt::print("Rendering {}x{} pixels at {} samples in {} tiles on {} workers with the {} engine\n",
+        options.width, options.height, options.samplesPerPixel, _tiles.size(), scheduler.workerCount(),
+        options.engine == Engine::Wavefront ? "wavefront" : "recursive");
+
+    if (!options.checkpointPath.empty()) {
+        _checkpointWriter = std::make_unique<CheckpointWriter>(options.checkpointPath);
+        _renderHash = checkpoint::renderHash(options, scene);
+        _lastCheckpointTime = _startTime;
+    }
+    if (resumeFrom) {
+        resume(*resumeFrom);
+    }
+    start();
+}
+
+ProgressiveRender::~ProgressiveRender() {
+    cancel();
+}
+
+void ProgressiveRender::start() {
+    _camera = renderCamera(_options, _scene);
+    if (_samplesDone == 0) {
+        _previewStride = PREVIEW_STRIDE;
+        updatePreviewPixels();
+        submitPass(1);
+        return;
+    }
+
+    auto sampleCount = nextPassSampleCount();
+    if (sampleCount == 0) {
+        _finished = true;
+        return;
+    }
+    submitPass(sampleCount);
+    beginCheckpoint();
+}
+
+void ProgressiveRender::cancel() {
+    if (_finished) {
+        return;
+    }
+    _cancelled = true;
+    _scheduler.cancelQueued();
+    auto tile = Tile();
+    while (true) {
+        // Like in update, so no tile is left over for the next render to report.
+        auto idle = _scheduler.idle();
+        while (_scheduler.popCompleted(tile)) {
+            // Nothing to show for them anymore.
+        }
+        if (idle) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    _finished = true;
+}
+
+void ProgressiveRender::restart() {
+    cancel();
+    // Half filled, it is taken again for the next checkpoint.
+    _snapshot = nullptr;
+    _framebuffer.clear();
+    std::fill(_tileSeconds.begin(), _tileSeconds.end(), 0.0);
+    std::fill(_pixelSeconds.begin(), _pixelSeconds.end(), 0.0f);
+    _activePixels.clear();
+    _activeTiles = _tiles;
+    _activePixelCount = size_t(_options.width) * _options.height;
+    _totalSamples = 0;
+    _samplesDone = 0;
+    _samplesSubmitted = 0;
+    _passesDone = 0;
+    _finished = false;
+    _cancelled = false;
+    _statsAtStart = renderstats::totals();
+    _statsBeforeStart = {};
+    _startTime = std::chrono::steady_clock::now();
+    if (_checkpointWriter) {
+        _renderHash = checkpoint::renderHash(_options, _scene);
+        _lastCheckpointTime = _startTime;
+    }
+    start();
+}
+
+void ProgressiveRender::resume(const Checkpoint &checkpoint) {
+    _framebuffer = checkpoint.framebuffer;
+    _samplesDone = checkpoint.samplesDone;
+    _samplesSubmitted = checkpoint.samplesDone;
+    _passesDone = checkpoint.passesDone;
+    _totalSamples = checkpoint.totalSamples;
+    if (checkpoint.tileSeconds.size() == _tileSeconds.size()) {
+        _tileSeconds = checkpoint.tileSeconds;
+    }
+    if (checkpoint.pixelSeconds.size() == _pixelSeconds.size()) {
+        _pixelSeconds = checkpoint.pixelSeconds;
+    }
+    _activePixels = checkpoint.activePixels;
+    if (!_activePixels.empty()) {
+        _activePixelCount = size_t(std::count(_activePixels.begin(), _activePixels.end(), uint8_t(1)));
+        updateActiveTiles();
+    }
+    _statsBeforeStart = checkpoint.stats;
+    _startTime -= std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(checkpoint.secondsElapsed));
+}
+
+void ProgressiveRender::beginCheckpoint() {
+    if (!_checkpointWriter || _snapshot ||
+        std::chrono::steady_clock::now() - _lastCheckpointTime < std::chrono::seconds(_options.checkpointInterval)) {
+        return;
+    }
+    _snapshot = _checkpointWriter->beginSnapshot();
+    if (!_snapshot) {
+        return;
+    }
+    // It keeps the buffers of the last snapshot, which are only allocated once.
+    if (_snapshot->framebuffer.width() != _options.width || _snapshot->framebuffer.height() != _options.height) {
+        _snapshot->framebuffer = Framebuffer(_options.width, _options.height);
+    }
+    _snapshot->pixelSeconds.resize(_pixelSeconds.size());
+
+    // The tiles the pass skips do not change while it renders. _activeTiles is in the order of _tiles.
+    auto active = _activeTiles.begin();
+    for (const auto &tile : _tiles) {
+        if (active != _activeTiles.end() && active->x0 == tile.x0 && active->y0 == tile.y0) {
+            active++;
+            continue;
+        }
+        copyToCheckpoint(tile);
+    }
+}
+
+void ProgressiveRender::copyToCheckpoint(const Tile &tile) {
+    _snapshot->framebuffer.copy(_framebuffer, tile.x0, tile.y0, tile.x1, tile.y1);
+    if (_pixelSeconds.empty()) {
+        return;
+    }
+    for (auto y = tile.y0; y < tile.y1; y++) {
+        auto first = size_t(y) * _options.width + tile.x0;
+        std::copy(_pixelSeconds.begin() + first, _pixelSeconds.begin() + first + tile.width(), _snapshot->pixelSeconds.begin() + first);
+    }
+}
+
+void ProgressiveRender::copyPassToCheckpoint() {
+    _snapshot->renderHash = _renderHash;
+    _snapshot->samplesDone = _samplesDone;
+    _snapshot->passesDone = _passesDone;
+    _snapshot->totalSamples = _totalSamples;
+    _snapshot->secondsElapsed = secondsElapsed();
+    _snapshot->stats = stats();
+    _snapshot->tileSeconds = _tileSeconds;
+}
+
+void ProgressiveRender::commitCheckpoint() {
+    // Only changes between passes.
+    _snapshot->activePixels = _activePixels;
+    _checkpointWriter->commitSnapshot();
+    _snapshot = nullptr;
+    _lastCheckpointTime = std::chrono::steady_clock::now();
+}
+
+void ProgressiveRender::saveFinalCheckpoint() {
+    if (!_checkpointWriter) {
+        return;
+    }
+    if (!_snapshot) {
+        _snapshot = _checkpointWriter->beginSnapshot(true);
+        _snapshot->framebuffer = _framebuffer;
+        _snapshot->pixelSeconds = _pixelSeconds;
+    }
+    copyPassToCheckpoint();
+    commitCheckpoint();
+}
+
+void ProgressiveRender::submitPass(int sampleCount) {
+    auto firstSample = _samplesSubmitted;
+    _samplesSubmitted += sampleCount;
+    _passSampleCount = sampleCount;
+    submitTiles(firstSample, sampleCount);
+}
+
+void ProgressiveRender::submitTiles(int firstSample, int sampleCount) {
+    _scheduler.submit(_activeTiles, [this, firstSample, sampleCount](const Tile &tile) {
+        auto tileStart = std::chrono::steady_clock::now();
+        auto recordPixelTimes = !_pixelSeconds.empty();
+        auto isActive = [this](int x, int y) {
+            return _activePixels.empty() || _activePixels[size_t(y) * _options.width + x];
+        };
+
+        if (_options.engine == Engine::Wavefront) {
+            // One per worker, so its queues are only allocated for the first tile.
+            static thread_local WavefrontRenderer wavefront;
+            wavefront.renderTile(tile, firstSample, sampleCount, _activePixels, _options, _scene, _framebuffer, &_cancelled);
+        }
+        else {
+            for (auto y = tile.y0; y < tile.y1; y++) {
+                for (auto x = tile.x0; x < tile.x1; x++) {
+                    if (!isActive(x, y)) {
+                        continue;
+                    }
+                    if (_cancelled.load(std::memory_order_relaxed)) {
+                        return;
+                    }
+                    auto pixelStart = recordPixelTimes ? std::chrono::steady_clock::now() : tileStart;
+                    auto pixel = renderPixel(x, y, firstSample, sampleCount, _camera, _options, _scene);
+                    _framebuffer.add(pixel.x, pixel.y, pixel.radianceSum, pixel.statistics, pixel.featureSum);
+                    if (recordPixelTimes) {
+                        _pixelSeconds[size_t(y) * _options.width + x] +=
+                            std::chrono::duration<float>(std::chrono::steady_clock::now() - pixelStart).count();
+                    }
+                }
+            }
+        }
+
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - tileStart).count();
+        _tileSeconds[tileIndex(tile)] += seconds;
+        if (recordPixelTimes && _options.engine == Engine::Wavefront) {
+            auto activeCount = 0;
+            for (auto y = tile.y0; y < tile.y1; y++) {
+                for (auto x = tile.x0; x < tile.x1; x++) {
+                    activeCount += isActive(x, y) ? 1 : 0;
+                }
+            }
+            auto share = float(seconds / std::max(activeCount, 1));
+            for (auto y = tile.y0; y < tile.y1; y++) {
+                for (auto x = tile.x0; x < tile.x1; x++) {
+                    if (isActive(x, y)) {
+                        _pixelSeconds[size_t(y) * _options.width + x] += share;
+                    }
+                }
+            }
+        }
+    });
+}
+
+bool ProgressiveRender::update(const std::function<void(const Tile &tile)> &onTileDone) {
+    if (_finished) {
+        return false;
+    }
+
+    // Check before draining, so every tile of a finished pass has been reported
+    // before the next pass starts writing to the framebuffer again.
+    auto passDone = _scheduler.idle();
+
+    auto tile = Tile();
+    while (_scheduler.popCompleted(tile)) {
+        onTileDone(tile);
+        if (_snapshot) {
+            copyToCheckpoint(tile);
+        }
+    }
+
+    if (!passDone) {
+        return true;
+    }
+
+    _totalSamples += uint64_t(_activePixelCount) * uint64_t(_passSampleCount);
+    if (_previewStride > 1) {
+        _previewStride /= 2;
+        updatePreviewPixels();
+        submitTiles(_samplesDone, _passSampleCount);
+        return true;
+    }
+    if (_previewStride == 1) {
+        _previewStride = 0;
+        _activePixels.clear();
+        _activeTiles = _tiles;
+        _activePixelCount = size_t(_options.width) * _options.height;
+    }
+
+    _samplesDone = _samplesSubmitted;
+    _passesDone++;
+    if (_options.adaptiveThreshold > 0.0f && _samplesDone >= ADAPTIVE_MIN_SAMPLES) {
+        updateActivePixels();
+    }
+
+    auto sampleCount = nextPassSampleCount();
+    auto outOfTime = _options.timeLimit > 0 && secondsElapsed() >= _options.timeLimit;
+    if (sampleCount == 0 || outOfTime) {
+        _finished = true;
+        saveFinalCheckpoint();
+        return false;
+    }
+
+    if (_snapshot) {
+        copyPassToCheckpoint();
+    }
+    submitPass(sampleCount);
+    if (_snapshot) {
+        commitCheckpoint();
+    }
+    beginCheckpoint();
+    return true;
+}
+
+int ProgressiveRender::maxSamplesPerPixel() const {
+    return _options.adaptiveThreshold > 0.0f
+        ? _options.samplesPerPixel * ADAPTIVE_MAX_SAMPLES_FACTOR
+        : _options.samplesPerPixel;
+}
+
+int ProgressiveRender::nextPassSampleCount() const {
+    if (_activePixelCount == 0) {
+        return 0;
+    }
+    auto sampleCount = std::min(_options.samplesPerPass, maxSamplesPerPixel() - _samplesDone);
+    if (_options.adaptiveThreshold > 0.0f) {
+        // Never more than the whole image would have taken without adaptive sampling.
+        auto budget = uint64_t(_options.samplesPerPixel) * uint64_t(_options.width) * uint64_t(_options.height);
+        auto left = budget > _totalSamples ? budget - _totalSamples : 0;
+        sampleCount = int(std::min<uint64_t>(uint64_t(std::max(sampleCount, 0)), left / _activePixelCount));
+    }
+    return std::max(sampleCount, 0);
+}
+
+void ProgressiveRender::updateActivePixels() {
+    auto width = _options.width;
+    auto height = _options.height;
+    auto pixelCount = size_t(width) * height;
+    if (_activePixels.empty()) {
+        _activePixels.assign(pixelCount, 1);
+    }
+
+    auto noisy = std::vector<uint8_t>(pixelCount);
+    for (auto y = 0; y < height; y++) {
+        for (auto x = 0; x < width; x++) {
+            auto index = size_t(y) * width + x;
+            noisy[index] = _activePixels[index] &&
+                _framebuffer.statistics(x, y).relativeError() >= _options.adaptiveThreshold;
+        }
+    }
+
+    // A pixel only stops once its neighbours are converged too. Where a few samples happened to agree
+    // next to a noisy pixel, the estimate is most likely too low.
+    _activePixelCount = 0;
+    for (auto y = 0; y < height; y++) {
+        for (auto x = 0; x < width; x++) {
+            auto index = size_t(y) * width + x;
+            if (!_activePixels[index]) {
+                continue;
+            }
+            auto keep = false;
+            for (auto ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1) && !keep; ny++) {
+                for (auto nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1) && !keep; nx++) {
+                    keep = noisy[size_t(ny) * width + nx] != 0;
+                }
+            }
+            _activePixels[index] = keep;
+            _activePixelCount += keep ? 1 : 0;
+        }
+    }
+    updateActiveTiles();
+}
+
+void ProgressiveRender::updateActiveTiles() {
+    auto width = _options.width;
+    _activeTiles.clear();
+    for (const auto &tile : _tiles) {
+        auto active = false;
+        for (auto y = tile.y0; y < tile.y1 && !active; y++) {
+            for (auto x = tile.x0; x < tile.x1 && !active; x++) {
+                active = _activePixels[size_t(y) * width + x] != 0;
+            }
+        }
+        if (active) {
+            _activeTiles.push_back(tile);
+        }
+    }
+}
+
+void ProgressiveRender::updatePreviewPixels() {
+    auto width = _options.width;
+    auto height = _options.height;
+    auto stride = _previewStride;
+    _activePixels.assign(size_t(width) * height, 0);
+    _activePixelCount = 0;
+    for (auto y = 0; y < height; y += stride) {
+        for (auto x = 0; x < width; x += stride) {
+            // Those are taken by the coarser parts before.
+            if (stride < PREVIEW_STRIDE && x % (2 * stride) == 0 && y % (2 * stride) == 0) {
+                continue;
+            }
+            _activePixels[size_t(y) * width + x] = 1;
+            _activePixelCount++;
+        }
+    }
+}
+
+Radiance ProgressiveRender::displayRadiance(int x, int y) const {
+    for (auto stride = 1; stride <= PREVIEW_STRIDE; stride *= 2) {
+        auto previewX = x - x % stride;
+        auto previewY = y - y % stride;
+        if (_framebuffer.sampleCount(previewX, previewY) > 0) {
+            return _framebuffer.average(previewX, previewY);
+        }
+    }
+    return Radiance();
+}
+
+size_t ProgressiveRender::tileIndex(const Tile &tile) const {
+    // splitIntoTiles cuts the image row by row.
+    auto columns = (_options.width + TILE_SIZE - 1) / TILE_SIZE;
+    return size_t(tile.y0 / TILE_SIZE) * columns + tile.x0 / TILE_SIZE;
+}
+
+double ProgressiveRender::secondsElapsed() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime).count();
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <optional>
+
+#include "scene.h"
+#include "ray.h"
+#include "vec3.h"
+#include "options.h"
+#include "framebuffer.h"
+#include "tilescheduler.h"
+#include "sampler.h"
+#include "bsdf.h"
+#include "renderstats.h"
+#include "checkpoint.h"
+
+// Shared by the recursive and the wavefront integrator, so both render the same image.
+namespace renderconstants {
+    // What a ray leaving the scene returns.
+    constexpr float BACKGROUND_RADIANCE = 2.75f;
+    // Applied on top of the surface color at every bounce.
+    constexpr float BOUNCE_ATTENUATION = 0.8f;
+    // Paths always make this many bounces before Russian roulette may end them.
+    constexpr int RUSSIAN_ROULETTE_MIN_BOUNCES = 3;
+    // Even bright paths stop now and then, so paths bouncing between lights cannot go on forever.
+    constexpr float RUSSIAN_ROULETTE_MAX_SURVIVAL = 0.95f;
+}
+
+// A shadow ray from a surface towards the light, and what it brings if nothing blocks it.
+struct LightConnection {
+public:
+    Ray ray = {};
+    // Up to the surface of the light, anything closer blocks it.
+    float distance = 0.0f;
+    // Emitted radiance times the BSDF, the cosine and the MIS weight, over the density of the direction.
+    Radiance radiance = {};
+};
+
+// Next event estimation: samples a direction towards the light from a surface. origin is where bounces leave
+// the surface, outgoing the direction back along the path. Nothing if the light is behind the surface or the
+// surface is a perfect mirror. Takes a 2D sample, also when it returns nothing.
+std::optional<LightConnection> connectToLight(Vec3 origin, Vec3 outgoing, const Bsdf &bsdf, Sampler &sampler, const Scene &scene);
+// Weight of light that a bounce with density bouncePdf found by hitting the light, against connectToLight
+// finding the same light (multiple importance sampling, power heuristic). 1 for camera rays, their bouncePdf is 0.
+float lightHitWeight(const Ray &ray, float bouncePdf, const Scene &scene);
+// Russian roulette: once a path made bounces bounces, it ends with a probability that grows as its throughput
+// shrinks, survivors are weighted up by as much. Dark paths stop early and the image stays unbiased.
+// Takes a 1D sample, but only when it plays.
+bool survivesRussianRoulette(Radiance &throughput, int bounces, Sampler &sampler);
+// What the denoiser gets to know about the first hit of a camera ray. Nothing for a ray that left the scene.
+PixelFeatures firstHitFeatures(const Ray &ray, const std::optional<Intersection> &intersection);
+// Traces the whole path that starts with ray, iteratively, until it leaves the scene, hits a light, loses the
+// roulette or traces maxDepth + 1 rays. Every diffuse hit also connects to the light with a shadow ray.
+// features gets the first hit of the path.
+Radiance shootRay(const Ray &ray, const Scene &scene, Sampler &sampler, int maxDepth, PixelFeatures &features);
+// The scene's camera with what the options change about it, for an image of the options' size.
+Camera renderCamera(const RenderOptions &options, const Scene &scene);
+// x and y are in pixels from the center of the image, with y pointing up. camera is the renderCamera.
+// Takes the first 2D sample for the position in the pixel.
+Ray createCameraRay(float x, float y, Sampler &sampler, const Camera &camera, const RenderOptions &options);
+Radiance shootRayforPixel(float x, float y, Sampler &sampler, const Camera &camera, const RenderOptions &options,
+    const Scene &scene, PixelFeatures &features);
+
+struct PixelWork {
+public:
+    int x = -1;
+    int y = -1;
+    Radiance radianceSum = {};
+    PixelStatistics statistics = {};
+    PixelFeatures featureSum = {};
+};
+
+// Takes the samples firstSample to firstSample + sampleCount - 1 of the pixel, the sum gets added to the framebuffer.
+// Passes continue the sample sequence of the pixel where the previous pass stopped. camera is the renderCamera,
+// which is the same for every pixel of the render.
+PixelWork renderPixel(int x, int y, int firstSample, int sampleCount, const Camera &camera, const RenderOptions &options,
+    const Scene &scene);
+
+// Renders the image in passes of a few samples per pixel into the framebuffer.
+// The first pass takes a single sample, so there is something to show right away,
+// every later one takes options.samplesPerPass until options.samplesPerPixel are reached.
+//
+// With options.adaptiveThreshold, pixels (and tiles) whose relative error dropped below the threshold
+// stop taking samples. options.samplesPerPixel then is the average budget: what converged pixels
+// leave over goes to the noisy ones, up to ADAPTIVE_MAX_SAMPLES_FACTOR times as many samples each.
+// Pixels that are still active all have the same number of samples, so passes keep one sample range.
+//
+// With options.checkpointPath, the state of the render is saved there between passes every
+// options.checkpointInterval seconds, and once more when the render stops. A render resumed from
+// such a checkpoint takes the same passes and samples as one that never stopped.
+//
+// The first pass is taken coarse to fine: every PREVIEW_STRIDE-th pixel of every PREVIEW_STRIDE-th row
+// first, then the pixels in between at half the stride and so on, so the whole image shows up after
+// a fraction of the pass (see displayRadiance). Each pixel still takes exactly its first sample.
+class ProgressiveRender {
+public:
+    static const int PREVIEW_STRIDE = 8;
+
+private:
+    static const int TILE_SIZE = 32;
+    // The error estimate of fewer samples is too unreliable, a pixel that only saw the background
+    // so far would look perfectly converged.
+    static const int ADAPTIVE_MIN_SAMPLES = 16;
+    static const int ADAPTIVE_MAX_SAMPLES_FACTOR = 4;
+
+    const RenderOptions &_options;
+    const Scene &_scene;
+    TileScheduler &_scheduler;
+    Framebuffer &_framebuffer;
+    // The renderCamera of the options, worked out whenever the render starts.
+    Camera _camera = {};
+    std::vector<Tile> _tiles = {};
+    std::chrono::steady_clock::time_point _startTime = {};
+    renderstats::Totals _statsAtStart = {};
+    // Of the runs before a resumed render, so the stats and secondsElapsed cover the same time.
+    renderstats::Totals _statsBeforeStart = {};
+    // Summed over all passes. Every tile (and so every pixel) is only written by one worker at a time.
+    std::vector<double> _tileSeconds = {};
+    // Only recorded with options.heatmapPath.
+    std::vector<float> _pixelSeconds = {};
+    // Row by row, empty while every pixel is active. Only changes between passes.
+    std::vector<uint8_t> _activePixels = {};
+    std::vector<Tile> _activeTiles = {};
+    size_t _activePixelCount = 0;
+    uint64_t _totalSamples = 0;
+    int _passSampleCount = 0;
+
+    // Samples per pixel of all finished passes, and including the one being rendered.
+    int _samplesDone = 0;
+    int _samplesSubmitted = 0;
+    int _passesDone = 0;
+    bool _finished = false;
+    // Of the part of the first pass being rendered, 0 once it is done.
+    int _previewStride = 0;
+    // Read by the workers, they stop rendering their tile once it is set.
+    std::atomic<bool> _cancelled = false;
+
+    // Only with options.checkpointPath.
+    std::unique_ptr<CheckpointWriter> _checkpointWriter = {};
+    // The snapshot the current pass ends in, if one is due. Its tiles are copied in as they finish, so
+    // the workers never wait for the copy.
+    Checkpoint *_snapshot = nullptr;
+    uint64_t _renderHash = 0;
+    std::chrono::steady_clock::time_point _lastCheckpointTime = {};
+
+public:
+    // Continues the render of resumeFrom if it is given, it has to be of the same options and scene.
+    ProgressiveRender(const RenderOptions &options, const Scene &scene, TileScheduler &scheduler, Framebuffer &framebuffer,
+        const Checkpoint *resumeFrom = nullptr);
+    // Cancels the render, the workers must not be left writing to the framebuffer.
+    ~ProgressiveRender();
+
+    ProgressiveRender(const ProgressiveRender &) = delete;
+    ProgressiveRender &operator=(const ProgressiveRender &) = delete;
+
+    // Reports finished tiles and starts the next pass once the current one is complete.
+    // Returns false once the last pass is done, or the time limit ran out.
+    bool update(const std::function<void(const Tile &tile)> &onTileDone);
+    // Drops the tiles that were not started and waits for the rest to stop, which they do after the pixel
+    // (recursive engine) or the bounce (wavefront engine) they are at. The render is finished afterwards.
+    void cancel();
+    // Cancels the render and starts over with what the options say now, e.g. after the camera moved.
+    // The size of the image has to stay the same. Workers read the options while the render runs,
+    // so cancel it before changing them.
+    void restart();
+
+    int width() const { return _options.width; }
+    int height() const { return _options.height; }
+    // Of the pixels that are still active, which with adaptive sampling is the most any pixel has.
+    int samplesDone() const { return _samplesDone; }
+    double averageSamples() const { return double(_totalSamples) / (double(_options.width) * _options.height); }
+    size_t activePixelCount() const { return _activePixelCount; }
+    int passesDone() const { return _passesDone; }
+    bool finished() const { return _finished; }
+    // Of the part of the first pass being rendered, 0 once it is done.
+    int previewStride() const { return _previewStride; }
+    // What to show for a pixel: its own average once it has samples, before that the one of the pixel of
+    // the coarsest part of the first pass that covers it.
+    Radiance displayRadiance(int x, int y) const;
+    double secondsElapsed() const;
+
+    // What was counted since the render started, by this render and anything else running at the time.
+    // A resumed render includes what its checkpoint counted.
+    renderstats::Totals stats() const { return renderstats::totals() - _statsAtStart + _statsBeforeStart; }
+    // Only read these once the render is finished, workers write them while it runs.
+    const std::vector<Tile> &tiles() const { return _tiles; }
+    const std::vector<double> &tileSeconds() const { return _tileSeconds; }
+    // Row by row, empty unless options.heatmapPath is set. The wavefront engine only times
+    // whole tiles, so its pixels get an equal share of their tile's time.
+    const std::vector<float> &pixelSeconds() const { return _pixelSeconds; }
+
+private:
+    size_t tileIndex(const Tile &tile) const;
+    int maxSamplesPerPixel() const;
+    int nextPassSampleCount() const;
+    void updateActivePixels();
+    void updateActiveTiles();
+    // Masks the pixels of the current part of the first pass.
+    void updatePreviewPixels();
+    void start();
+    void resume(const Checkpoint &checkpoint);
+    // Right after a pass was submitted. Takes a snapshot for the pass to end in, unless the interval has
+    // not passed yet or the previous checkpoint is still being saved. Copies the tiles the pass skips.
+    void beginCheckpoint();
+    void copyToCheckpoint(const Tile &tile);
+    // Copies what the workers of the next pass change besides pixels. Only between passes.
+    void copyPassToCheckpoint();
+    // Copies the rest and starts saving, the next pass may be rendering already.
+    void commitCheckpoint();
+    // Once the render is done. Waits for the previous checkpoint to be saved and copies everything
+    // the pass did not.
+    void saveFinalCheckpoint();
+    void submitPass(int sampleCount);
+    // Renders the active pixels of the active tiles again, for sample firstSample and the sampleCount - 1 after it.
+    void submitTiles(int firstSample, int sampleCount);
+};
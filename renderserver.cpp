@@ -0,0 +1,538 @@
+#include "renderserver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fmt/format.h>
+
+#include "scene.h"
+#include "scenecache.h"
+#include "tcpsocket.h"
+#include "tilescheduler.h"
+#include "framebuffer.h"
+#include "renderer.h"
+#include "denoiser.h"
+#include "image.h"
+
+namespace {
+    // Bump whenever a record below or the meaning of a message changes.
+    const uint32_t PROTOCOL_VERSION = 2;
+    // Compiled scenes kept between jobs, the one unused for the longest goes first.
+    const size_t MAX_RESIDENT_SCENES = 4;
+    // Of encoded images kept, the one unused for the longest goes first.
+    const size_t MAX_CACHED_BYTES = size_t(256) << 20;
+    const int BUSY_POLL_MILLISECONDS = 5;
+    const int IDLE_POLL_MILLISECONDS = 100;
+
+    enum class MessageType : uint32_t {
+        // Client to server, a JobRecord followed by the mesh path.
+        Render,
+        // Server to client, an ImageRecord followed by the encoded image.
+        Image,
+        // Server to client, what was wrong with the job as text.
+        Error
+    };
+
+    struct JobRecord {
+    public:
+        uint32_t version = 0;
+        int32_t priority = 0;
+        int32_t width = 0;
+        int32_t height = 0;
+        int32_t samplesPerPixel = 0;
+        int32_t samplesPerPass = 0;
+        int32_t maxDepth = 0;
+        int32_t seed = 0;
+        float adaptiveThreshold = 0.0f;
+        float exposure = 0.0f;
+        uint32_t hasCameraPosition = 0;
+        float cameraPosition[3] = {};
+        uint32_t hasCameraTarget = 0;
+        float cameraTarget[3] = {};
+        // 0 for the scene camera's.
+        float fieldOfView = 0.0f;
+        uint32_t sampler = 0;
+        uint32_t engine = 0;
+        uint32_t sceneType = 0;
+        uint32_t format = 0;
+        uint32_t denoise = 0;
+    };
+
+    struct ImageRecord {
+    public:
+        // 1 if the image came from the cache.
+        uint32_t cached = 0;
+        // From the job coming in to the image going out.
+        float seconds = 0.0f;
+    };
+
+    // Nothing if the record asks for something the renderer cannot do.
+    std::optional<RenderOptions> jobOptions(const JobRecord &record, const RenderOptions &serverOptions) {
+        const auto MAX_SIZE = 16384;
+        if (record.width < 1 || record.width > MAX_SIZE || record.height < 1 || record.height > MAX_SIZE ||
+            record.samplesPerPixel < 1 || record.samplesPerPass < 1 || record.maxDepth < 0 || record.seed < 0 ||
+            !(record.adaptiveThreshold >= 0.0f) || record.sampler > uint32_t(SamplerType::Sobol) ||
+            record.engine > uint32_t(Engine::Wavefront) || record.sceneType > uint32_t(SceneType::Crowd) ||
+            record.format > uint32_t(imageio::Format::Pfm) ||
+            (record.fieldOfView != 0.0f && !(record.fieldOfView >= Camera::MIN_FIELD_OF_VIEW && record.fieldOfView <= Camera::MAX_FIELD_OF_VIEW))) {
+            return std::optional<RenderOptions>();
+        }
+        auto options = RenderOptions();
+        options.threads = serverOptions.threads;
+        options.headless = true;
+        options.width = record.width;
+        options.height = record.height;
+        options.samplesPerPixel = record.samplesPerPixel;
+        options.samplesPerPass = record.samplesPerPass;
+        options.maxDepth = record.maxDepth;
+        options.seed = record.seed;
+        options.adaptiveThreshold = record.adaptiveThreshold;
+        options.exposure = record.exposure;
+        if (record.hasCameraPosition) {
+            options.cameraPosition = Vec3(record.cameraPosition[0], record.cameraPosition[1], record.cameraPosition[2]);
+        }
+        if (record.hasCameraTarget) {
+            options.cameraTarget = Vec3(record.cameraTarget[0], record.cameraTarget[1], record.cameraTarget[2]);
+        }
+        if (record.fieldOfView != 0.0f) {
+            options.fieldOfView = record.fieldOfView;
+        }
+        options.samplerType = SamplerType(record.sampler);
+        options.engine = Engine(record.engine);
+        options.sceneType = SceneType(record.sceneType);
+        options.denoise = record.denoise != 0;
+        return options;
+    }
+
+    // Equal for jobs that come out as the same image, whatever their priority.
+    uint64_t imageHash(const JobRecord &record, const Scene &scene) {
+        auto hash = scenecache::SourceHash();
+        hash.add(PROTOCOL_VERSION).add(scene.sourceHash());
+        hash.add(record.width).add(record.height).add(record.samplesPerPixel).add(record.samplesPerPass);
+        hash.add(record.maxDepth).add(record.seed).add(record.adaptiveThreshold).add(record.exposure);
+        hash.add(record.hasCameraPosition);
+        if (record.hasCameraPosition) {
+            hash.add(record.cameraPosition[0]).add(record.cameraPosition[1]).add(record.cameraPosition[2]);
+        }
+        hash.add(record.hasCameraTarget);
+        if (record.hasCameraTarget) {
+            hash.add(record.cameraTarget[0]).add(record.cameraTarget[1]).add(record.cameraTarget[2]);
+        }
+        hash.add(record.fieldOfView);
+        hash.add(record.sampler).add(record.engine).add(record.format).add(record.denoise);
+        return hash.value();
+    }
+
+    struct Client {
+    public:
+        TcpSocket socket = {};
+        int id = 0;
+        // Has a job queued or rendering, it gets no other before that is answered.
+        bool waiting = false;
+        bool failed = false;
+    };
+
+    struct Job {
+    public:
+        int clientId = 0;
+        int priority = 0;
+        // Tells apart jobs of the same priority, the older one goes first.
+        uint64_t sequence = 0;
+        uint64_t imageHash = 0;
+        imageio::Format format = {};
+        RenderOptions options = {};
+        std::shared_ptr<const Scene> scene = {};
+        std::chrono::steady_clock::time_point received = {};
+    };
+
+    // The job being rendered. ProgressiveRender keeps references to the options, scene and framebuffer.
+    struct ActiveJob {
+    public:
+        Job job = {};
+        Framebuffer framebuffer = {};
+        ProgressiveRender render;
+
+        ActiveJob(Job queuedJob, TileScheduler &scheduler)
+            : job(std::move(queuedJob)), framebuffer(job.options.width, job.options.height),
+              render(job.options, *job.scene, scheduler, framebuffer) {}
+    };
+
+    class RenderServer {
+        struct ResidentScene {
+        public:
+            std::shared_ptr<const Scene> scene = {};
+            uint64_t lastUsed = 0;
+        };
+
+        // A job whose scene is still being loaded, it has no scene and image hash yet.
+        struct WaitingJob {
+        public:
+            Job job = {};
+            JobRecord record = {};
+        };
+
+        // Scenes are built on a thread of their own, a big one would hold up every client and the render.
+        struct SceneLoad {
+        public:
+            std::string key = {};
+            // Null if the scene cannot be loaded.
+            std::future<std::shared_ptr<const Scene>> scene = {};
+            std::vector<WaitingJob> jobs = {};
+        };
+
+        struct CachedImage {
+        public:
+            std::vector<char> bytes = {};
+            uint64_t lastUsed = 0;
+        };
+
+        const RenderOptions &_options;
+        TcpSocket _listener;
+        TileScheduler _scheduler;
+        std::vector<std::unique_ptr<Client>> _clients = {};
+        std::vector<Job> _queue = {};
+        std::unique_ptr<ActiveJob> _active = {};
+        // By the type of scene, the mesh path and the size and time of the mesh file.
+        std::map<std::string, ResidentScene> _scenes = {};
+        std::vector<SceneLoad> _loads = {};
+        std::map<uint64_t, CachedImage> _images = {};
+        size_t _cachedBytes = 0;
+        // Counts up with every job and every use of a scene or image.
+        uint64_t _clock = 0;
+        int _nextClientId = 1;
+
+    public:
+        RenderServer(const RenderOptions &options, TcpSocket listener)
+            : _options(options), _listener(std::move(listener)), _scheduler(options.threads) {}
+
+        void run() {
+            fmt::print("Serving render jobs on port {} with {} workers\n", _options.servePort, _scheduler.workerCount());
+            while (true) {
+                receiveJobs();
+                finishLoads();
+                if (_active && !_active->render.update([](const Tile &) {})) {
+                    finishActive();
+                }
+                if (!_active) {
+                    startNext();
+                }
+                _clients.erase(std::remove_if(_clients.begin(), _clients.end(),
+                    [](const std::unique_ptr<Client> &client) { return client->failed; }), _clients.end());
+                // The log usually goes to a file.
+                std::fflush(stdout);
+            }
+        }
+
+    private:
+        Client *client(int id) {
+            auto found = std::find_if(_clients.begin(), _clients.end(),
+                [id](const std::unique_ptr<Client> &client) { return client->id == id && !client->failed; });
+            return found != _clients.end() ? found->get() : nullptr;
+        }
+
+        void drop(Client &client, const char *reason) {
+            if (!client.failed) {
+                fmt::print("Client {} {}\n", client.id, reason);
+            }
+            client.failed = true;
+            // Its queued job has nobody to go to. A job that is rendering is finished, the image is cached,
+            // and so is a scene that is loading.
+            _queue.erase(std::remove_if(_queue.begin(), _queue.end(),
+                [&](const Job &job) { return job.clientId == client.id; }), _queue.end());
+            for (auto &load : _loads) {
+                load.jobs.erase(std::remove_if(load.jobs.begin(), load.jobs.end(),
+                    [&](const WaitingJob &waiting) { return waiting.job.clientId == client.id; }), load.jobs.end());
+            }
+        }
+
+        void sendError(Client &client, const std::string &text) {
+            fmt::print(stderr, "Rejected a job from client {}: {}\n", client.id, text);
+            if (!client.socket.sendMessage(uint32_t(MessageType::Error), { TcpSocket::Buffer{ text.data(), text.size() } })) {
+                drop(client, "disconnected");
+            }
+        }
+
+        void sendImage(int clientId, const std::vector<char> &bytes, bool cached, std::chrono::steady_clock::time_point received) {
+            auto target = client(clientId);
+            if (!target) {
+                return;
+            }
+            auto record = ImageRecord();
+            record.cached = cached ? 1 : 0;
+            record.seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - received).count();
+            target->waiting = false;
+            if (!target->socket.sendMessage(uint32_t(MessageType::Image),
+                    { TcpSocket::Buffer{ &record, sizeof(record) }, TcpSocket::Buffer{ bytes.data(), bytes.size() } })) {
+                drop(*target, "disconnected");
+            }
+        }
+
+        void receiveJobs() {
+            auto sockets = std::vector<TcpSocket *>{ &_listener };
+            for (auto &client : _clients) {
+                sockets.push_back(&client->socket);
+            }
+            auto timeout = _active || !_queue.empty() || !_loads.empty() ? BUSY_POLL_MILLISECONDS : IDLE_POLL_MILLISECONDS;
+            for (auto index : TcpSocket::poll(sockets, timeout)) {
+                if (index == 0) {
+                    if (auto socket = _listener.accept()) {
+                        _clients.push_back(std::make_unique<Client>());
+                        _clients.back()->socket = std::move(*socket);
+                        _clients.back()->id = _nextClientId++;
+                    }
+                    continue;
+                }
+                auto &client = *_clients[index - 1];
+                auto message = client.socket.receiveMessage();
+                if (!message) {
+                    drop(client, "disconnected");
+                    continue;
+                }
+                receiveJob(client, *message);
+            }
+        }
+
+        void receiveJob(Client &client, const TcpSocket::Message &message) {
+            auto record = JobRecord();
+            if (message.type != uint32_t(MessageType::Render) || !TcpSocket::readRecord(message.payload, record) ||
+                record.version != PROTOCOL_VERSION || client.waiting) {
+                drop(client, "speaks another protocol");
+                return;
+            }
+            auto received = std::chrono::steady_clock::now();
+            auto options = jobOptions(record, _options);
+            if (!options) {
+                sendError(client, "invalid settings");
+                return;
+            }
+            options->meshPath = std::string(message.payload.begin() + sizeof(record), message.payload.end());
+            auto key = sceneKey(options->sceneType, options->meshPath);
+            if (!key) {
+                sendError(client, fmt::format("could not load the scene with mesh '{}'", options->meshPath));
+                return;
+            }
+
+            auto job = Job();
+            job.clientId = client.id;
+            job.priority = record.priority;
+            job.sequence = ++_clock;
+            job.format = imageio::Format(record.format);
+            job.options = *options;
+            job.received = received;
+            client.waiting = true;
+
+            auto found = _scenes.find(*key);
+            if (found != _scenes.end()) {
+                found->second.lastUsed = ++_clock;
+                queue(std::move(job), record, found->second.scene);
+                return;
+            }
+            auto load = std::find_if(_loads.begin(), _loads.end(), [&](const SceneLoad &load) { return load.key == *key; });
+            if (load == _loads.end()) {
+                fmt::print("Loading the scene of a job from client {}\n", client.id);
+                _loads.push_back(SceneLoad());
+                load = _loads.end() - 1;
+                load->key = *key;
+                load->scene = std::async(std::launch::async, [type = options->sceneType, meshPath = options->meshPath]() {
+                    auto scene = std::make_shared<Scene>();
+                    return scene->initialize(type, meshPath) ? std::shared_ptr<const Scene>(std::move(scene)) : std::shared_ptr<const Scene>();
+                });
+            }
+            load->jobs.push_back(WaitingJob{ std::move(job), record });
+        }
+
+        // Tells scenes apart by the type, the mesh path and the size and time of the mesh file, so a changed
+        // mesh file is a new scene. Nothing if the mesh file cannot be read.
+        std::optional<std::string> sceneKey(SceneType type, const std::string &meshPath) {
+            auto key = fmt::format("{}|{}", int(type), meshPath);
+            if (!meshPath.empty()) {
+                auto error = std::error_code();
+                auto size = std::filesystem::file_size(meshPath, error);
+                auto modified = std::filesystem::last_write_time(meshPath, error);
+                if (error) {
+                    return std::optional<std::string>();
+                }
+                key += fmt::format("|{}|{}", size, modified.time_since_epoch().count());
+            }
+            return key;
+        }
+
+        // Hands the jobs of the scenes that are done loading on. A loaded scene is kept until
+        // MAX_RESIDENT_SCENES others were used after it.
+        void finishLoads() {
+            for (auto &load : _loads) {
+                if (load.scene.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    continue;
+                }
+                auto scene = load.scene.get();
+                if (scene) {
+                    if (_scenes.size() >= MAX_RESIDENT_SCENES) {
+                        // Jobs still hold on to the scene they were queued with.
+                        auto oldest = std::min_element(_scenes.begin(), _scenes.end(),
+                            [](const auto &a, const auto &b) { return a.second.lastUsed < b.second.lastUsed; });
+                        _scenes.erase(oldest);
+                    }
+                    _scenes[load.key] = ResidentScene{ scene, ++_clock };
+                }
+                // Answering a job may drop its client, which changes load.jobs.
+                auto jobs = std::move(load.jobs);
+                load.jobs.clear();
+                for (auto &waiting : jobs) {
+                    auto target = client(waiting.job.clientId);
+                    if (!target) {
+                        continue;
+                    }
+                    if (!scene) {
+                        target->waiting = false;
+                        sendError(*target, fmt::format("could not load the scene with mesh '{}'", waiting.job.options.meshPath));
+                        continue;
+                    }
+                    queue(std::move(waiting.job), waiting.record, scene);
+                }
+            }
+            _loads.erase(std::remove_if(_loads.begin(), _loads.end(),
+                [](const SceneLoad &load) { return !load.scene.valid(); }), _loads.end());
+        }
+
+        void queue(Job job, const JobRecord &record, std::shared_ptr<const Scene> scene) {
+            job.imageHash = imageHash(record, *scene);
+            job.scene = std::move(scene);
+            if (answerFromCache(job)) {
+                return;
+            }
+            fmt::print("Queued a job from client {} at priority {}, {} waiting\n", job.clientId, record.priority, _queue.size() + 1);
+            _queue.push_back(std::move(job));
+        }
+
+        bool answerFromCache(const Job &job) {
+            auto found = _images.find(job.imageHash);
+            if (found == _images.end()) {
+                return false;
+            }
+            found->second.lastUsed = ++_clock;
+            fmt::print("Answered a job from client {} from the cache\n", job.clientId);
+            sendImage(job.clientId, found->second.bytes, true, job.received);
+            return true;
+        }
+
+        void startNext() {
+            while (!_queue.empty()) {
+                auto next = std::min_element(_queue.begin(), _queue.end(), [](const Job &a, const Job &b) {
+                    return a.priority != b.priority ? a.priority > b.priority : a.sequence < b.sequence;
+                });
+                auto job = std::move(*next);
+                _queue.erase(next);
+                // An identical job that was queued earlier may have been rendered in the meantime.
+                if (!answerFromCache(job)) {
+                    fmt::print("Starting a job from client {}, {} waiting\n", job.clientId, _queue.size());
+                    _active = std::make_unique<ActiveJob>(std::move(job), _scheduler);
+                    return;
+                }
+            }
+        }
+
+        void finishActive() {
+            const auto &job = _active->job;
+            auto pixels = job.options.denoise ? denoiser::denoise(_active->framebuffer, _scheduler) : _active->framebuffer.averages();
+            auto bytes = imageio::encode(job.format, job.options.width, job.options.height, pixels, job.options.exposure);
+            fmt::print("Rendered a job from client {} in {:.2f} s\n", job.clientId, _active->render.secondsElapsed());
+            sendImage(job.clientId, bytes, false, job.received);
+            cache(job.imageHash, std::move(bytes));
+            _active.reset();
+        }
+
+        void cache(uint64_t hash, std::vector<char> bytes) {
+            if (bytes.size() > MAX_CACHED_BYTES) {
+                return;
+            }
+            while (_cachedBytes + bytes.size() > MAX_CACHED_BYTES) {
+                auto oldest = std::min_element(_images.begin(), _images.end(),
+                    [](const auto &a, const auto &b) { return a.second.lastUsed < b.second.lastUsed; });
+                _cachedBytes -= oldest->second.bytes.size();
+                _images.erase(oldest);
+            }
+            _cachedBytes += bytes.size();
+            _images[hash] = CachedImage{ std::move(bytes), ++_clock };
+        }
+    };
+}
+
+bool renderserver::serve(const RenderOptions &options) {
+    // Only programs on this machine can send jobs.
+    auto listener = TcpSocket::listen("127.0.0.1", options.servePort);
+    if (!listener) {
+        return false;
+    }
+    auto server = RenderServer(options, std::move(*listener));
+    server.run();
+    return true;
+}
+
+bool renderserver::submit(const RenderOptions &options) {
+    auto record = JobRecord();
+    record.version = PROTOCOL_VERSION;
+    record.priority = options.priority;
+    record.width = options.width;
+    record.height = options.height;
+    record.samplesPerPixel = options.samplesPerPixel;
+    record.samplesPerPass = options.samplesPerPass;
+    record.maxDepth = options.maxDepth;
+    record.seed = options.seed;
+    record.adaptiveThreshold = options.adaptiveThreshold;
+    record.exposure = options.exposure;
+    record.hasCameraPosition = options.cameraPosition.has_value();
+    if (options.cameraPosition) {
+        for (auto axis = 0; axis < 3; axis++) {
+            record.cameraPosition[axis] = (*options.cameraPosition)[axis];
+        }
+    }
+    record.hasCameraTarget = options.cameraTarget.has_value();
+    if (options.cameraTarget) {
+        for (auto axis = 0; axis < 3; axis++) {
+            record.cameraTarget[axis] = (*options.cameraTarget)[axis];
+        }
+    }
+    record.fieldOfView = options.fieldOfView.value_or(0.0f);
+    record.sampler = uint32_t(options.samplerType);
+    record.engine = uint32_t(options.engine);
+    record.sceneType = uint32_t(options.sceneType);
+    record.format = uint32_t(imageio::formatOf(options.outputPath).value_or(imageio::Format::Ppm));
+    record.denoise = options.denoise ? 1 : 0;
+    // The server may run somewhere else.
+    auto error = std::error_code();
+    auto meshPath = options.meshPath.empty() ? std::string() : std::filesystem::absolute(options.meshPath, error).string();
+
+    auto socket = TcpSocket::connect("127.0.0.1", options.submitPort);
+    if (!socket) {
+        return false;
+    }
+    auto message = socket->sendMessage(uint32_t(MessageType::Render),
+            { TcpSocket::Buffer{ &record, sizeof(record) }, TcpSocket::Buffer{ meshPath.data(), meshPath.size() } })
+        ? socket->receiveMessage() : std::optional<TcpSocket::Message>();
+    if (!message) {
+        fmt::print(stderr, "Lost the connection to the server\n");
+        return false;
+    }
+    if (message->type == uint32_t(MessageType::Error)) {
+        fmt::print(stderr, "The server rejected the job: {}\n", std::string(message->payload.begin(), message->payload.end()));
+        return false;
+    }
+    auto image = ImageRecord();
+    if (message->type != uint32_t(MessageType::Image) || !TcpSocket::readRecord(message->payload, image)) {
+        fmt::print(stderr, "Got an unknown message from the server\n");
+        return false;
+    }
+    auto bytes = std::vector<char>(message->payload.begin() + sizeof(image), message->payload.end());
+    fmt::print("Got {} bytes {} after {:.2f} s\n", bytes.size(), image.cached ? "from the cache" : "rendered", image.seconds);
+    if (!imageio::writeEncoded(options.outputPath, bytes)) {
+        return false;
+    }
+    fmt::print("Wrote {}\n", options.outputPath);
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "options.h"
+
+// A long running renderer for other programs on the same machine. It listens on a port of the loopback
+// interface for render jobs: a scene (type and mesh), camera, resolution, samples and the image format.
+// The answer to each is the encoded image.
+//
+// Jobs wait in a queue, the one with the highest priority (the oldest of those) is rendered next on the
+// worker pool that all jobs share. Compiled scenes stay in memory between jobs, so only the first job for a
+// scene pays for loading and building it. Finished images are kept by a hash of everything that goes
+// into them, a job that was rendered before is answered right away.
+namespace renderserver {
+    // Serves jobs on options.servePort until the process is stopped, with options.threads workers.
+    // Returns false if it cannot listen.
+    bool serve(const RenderOptions &options);
+    // Sends the render described by options to the server on options.submitPort, waits for the image and
+    // writes it to options.outputPath. Returns false if any of that fails.
+    bool submit(const RenderOptions &options);
+}
@@ -0,0 +1,189 @@
+#include "renderstats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fmt/format.h>
+
+#include "renderer.h"
+#include "image.h"
+
+namespace {
+    // Only its own thread writes a block, so a relaxed load and store is enough and avoids a locked add.
+    struct alignas(64) ThreadCounters {
+    public:
+        std::atomic<uint64_t> rays[size_t(renderstats::RayType::Count)] = {};
+        std::atomic<uint64_t> leafVisits = 0;
+        std::atomic<uint64_t> primitiveTests = 0;
+        std::atomic<uint64_t> pathLengths[renderstats::PATH_LENGTH_BUCKETS] = {};
+    };
+
+    void increment(std::atomic<uint64_t> &counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    std::mutex registryMutex;
+    // Blocks outlive their threads, so their counts stay in the totals.
+    std::vector<std::unique_ptr<ThreadCounters>> registry;
+
+    ThreadCounters &threadCounters() {
+        static thread_local ThreadCounters *counters = []() {
+            auto lock = std::lock_guard<std::mutex>(registryMutex);
+            registry.push_back(std::make_unique<ThreadCounters>());
+            return registry.back().get();
+        }();
+        return *counters;
+    }
+
+    bool writeText(const std::string &path, const std::string &text) {
+        auto file = std::fopen(path.c_str(), "wb");
+        if (!file) {
+            fmt::print(stderr, "Could not open {} for writing\n", path);
+            return false;
+        }
+        auto ok = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok) {
+            fmt::print(stderr, "Could not write {}\n", path);
+        }
+        return ok;
+    }
+
+    // Black, purple, orange, yellow, white for t from 0 to 1.
+    Color heatColor(float t) {
+        const float STOPS[][3] = {
+            { 0.0f, 0.0f, 0.0f }, { 0.45f, 0.1f, 0.55f }, { 0.95f, 0.4f, 0.1f }, { 1.0f, 0.9f, 0.2f }, { 1.0f, 1.0f, 1.0f }
+        };
+        const int LAST = 4;
+        t = std::clamp(t, 0.0f, 1.0f) * LAST;
+        auto index = std::min(int(t), LAST - 1);
+        auto fraction = t - index;
+        auto channel = [&](int c) {
+            return int(255.0f * (STOPS[index][c] + (STOPS[index + 1][c] - STOPS[index][c]) * fraction) + 0.5f);
+        };
+        return Color(channel(0), channel(1), channel(2));
+    }
+}
+
+uint64_t renderstats::Totals::totalRays() const {
+    uint64_t total = 0;
+    for (auto count : rays) {
+        total += count;
+    }
+    return total;
+}
+
+renderstats::Totals renderstats::Totals::operator-(const Totals &other) const {
+    auto difference = *this;
+    for (size_t i = 0; i < size_t(RayType::Count); i++) {
+        difference.rays[i] -= other.rays[i];
+    }
+    difference.leafVisits -= other.leafVisits;
+    difference.primitiveTests -= other.primitiveTests;
+    for (auto i = 0; i < PATH_LENGTH_BUCKETS; i++) {
+        difference.pathLengths[i] -= other.pathLengths[i];
+    }
+    return difference;
+}
+
+renderstats::Totals renderstats::Totals::operator+(const Totals &other) const {
+    auto sum = *this;
+    for (size_t i = 0; i < size_t(RayType::Count); i++) {
+        sum.rays[i] += other.rays[i];
+    }
+    sum.leafVisits += other.leafVisits;
+    sum.primitiveTests += other.primitiveTests;
+    for (auto i = 0; i < PATH_LENGTH_BUCKETS; i++) {
+        sum.pathLengths[i] += other.pathLengths[i];
+    }
+    return sum;
+}
+
+void renderstats::countRays(RayType type, uint64_t count) {
+    increment(threadCounters().rays[size_t(type)], count);
+}
+
+void renderstats::countTraversal(uint32_t leafVisits, uint32_t primitiveTests) {
+    auto &counters = threadCounters();
+    increment(counters.leafVisits, leafVisits);
+    increment(counters.primitiveTests, primitiveTests);
+}
+
+void renderstats::countPath(int length) {
+    increment(threadCounters().pathLengths[std::clamp(length, 0, PATH_LENGTH_BUCKETS - 1)], 1);
+}
+
+renderstats::Totals renderstats::totals() {
+    auto totals = Totals();
+    auto lock = std::lock_guard<std::mutex>(registryMutex);
+    for (const auto &counters : registry) {
+        for (size_t i = 0; i < size_t(RayType::Count); i++) {
+            totals.rays[i] += counters->rays[i].load(std::memory_order_relaxed);
+        }
+        totals.leafVisits += counters->leafVisits.load(std::memory_order_relaxed);
+        totals.primitiveTests += counters->primitiveTests.load(std::memory_order_relaxed);
+        for (auto i = 0; i < PATH_LENGTH_BUCKETS; i++) {
+            totals.pathLengths[i] += counters->pathLengths[i].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+bool renderstats::writeReport(const std::string &path, const ProgressiveRender &render) {
+    auto stats = render.stats();
+    auto seconds = render.secondsElapsed();
+    auto rays = stats.totalRays();
+    auto perRay = [&](uint64_t count) { return rays > 0 ? double(count) / double(rays) : 0.0; };
+
+    auto json = std::string("{\n");
+    json += fmt::format("  \"seconds\": {:.4f},\n", seconds);
+    json += fmt::format("  \"samplesPerPixel\": {},\n", render.samplesDone());
+    json += fmt::format("  \"averageSamplesPerPixel\": {:.4f},\n", render.averageSamples());
+    json += fmt::format("  \"passes\": {},\n", render.passesDone());
+    json += fmt::format("  \"rays\": {{ \"total\": {}, \"camera\": {}, \"bounce\": {}, \"shadow\": {} }},\n", rays,
+        stats.rayCount(RayType::Camera), stats.rayCount(RayType::Bounce), stats.rayCount(RayType::Shadow));
+    json += fmt::format("  \"mraysPerSecond\": {:.4f},\n", seconds > 0.0 ? rays / seconds / 1'000'000.0 : 0.0);
+    json += fmt::format("  \"leafVisitsPerRay\": {:.4f},\n", perRay(stats.leafVisits));
+    json += fmt::format("  \"primitiveTestsPerRay\": {:.4f},\n", perRay(stats.primitiveTests));
+
+    json += "  \"pathLengths\": [";
+    for (auto i = 0; i < PATH_LENGTH_BUCKETS; i++) {
+        json += fmt::format("{}{}", i > 0 ? ", " : "", stats.pathLengths[i]);
+    }
+    json += "],\n";
+
+    const auto &tiles = render.tiles();
+    const auto &tileSeconds = render.tileSeconds();
+    json += "  \"tiles\": [\n";
+    for (size_t i = 0; i < tiles.size(); i++) {
+        json += fmt::format("    {{ \"x0\": {}, \"y0\": {}, \"x1\": {}, \"y1\": {}, \"seconds\": {:.6f} }}{}\n",
+            tiles[i].x0, tiles[i].y0, tiles[i].x1, tiles[i].y1, tileSeconds[i], i + 1 < tiles.size() ? "," : "");
+    }
+    json += "  ]\n}\n";
+
+    return writeText(path, json);
+}
+
+bool renderstats::writeHeatmap(const std::string &path, const ProgressiveRender &render) {
+    const auto &costs = render.pixelSeconds();
+    if (costs.empty()) {
+        fmt::print(stderr, "The render did not record pixel times\n");
+        return false;
+    }
+
+    // Scale to the 99th percentile, a handful of outliers would turn everything else black.
+    auto sorted = costs;
+    auto percentile = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+    std::nth_element(sorted.begin(), percentile, sorted.end());
+    auto scale = *percentile > 0.0f ? 1.0f / *percentile : 0.0f;
+
+    auto pixels = std::vector<Color>();
+    pixels.reserve(costs.size());
+    for (auto cost : costs) {
+        pixels.push_back(heatColor(cost * scale));
+    }
+    return imageio::writePpm(path, render.width(), render.height(), pixels);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+class ProgressiveRender;
+
+// Counters for the hot path. Every thread counts into its own cache line sized block without
+// any synchronization beyond relaxed atomics it alone writes, and totals() adds the blocks up
+// whenever someone asks.
+namespace renderstats {
+    enum class RayType {
+        Camera,
+        Bounce,
+        Shadow,
+        Count
+    };
+
+    // Paths with more segments than this end up in the last bucket.
+    const int PATH_LENGTH_BUCKETS = 32;
+
+    struct Totals {
+    public:
+        uint64_t rays[size_t(RayType::Count)] = {};
+        // BVH leaves visited and primitives tested, by all closest hit and occlusion queries.
+        uint64_t leafVisits = 0;
+        uint64_t primitiveTests = 0;
+        // Number of paths by the number of rays they traced.
+        uint64_t pathLengths[PATH_LENGTH_BUCKETS] = {};
+
+        uint64_t totalRays() const;
+        uint64_t rayCount(RayType type) const { return rays[size_t(type)]; }
+        // What was counted between other and this.
+        Totals operator-(const Totals &other) const;
+        Totals operator+(const Totals &other) const;
+    };
+
+    // The first call on a thread registers its counters, which allocates once.
+    void countRays(RayType type, uint64_t count = 1);
+    void countTraversal(uint32_t leafVisits, uint32_t primitiveTests);
+    void countPath(int length);
+
+    // Sum over all threads, including those that have exited.
+    Totals totals();
+
+    // Rays, intersection tests per ray, the path length histogram and the tile times of the render as JSON.
+    bool writeReport(const std::string &path, const ProgressiveRender &render);
+    // Time spent per pixel as a false color .ppm, black for cheap and white for the most expensive.
+    bool writeHeatmap(const std::string &path, const ProgressiveRender &render);
+}
@@ -0,0 +1,84 @@
+#include "sampler.h"
+
+namespace {
+    float toFloat(uint32_t value) {
+        return (value >> 8) * (1.0f / 16777216.0f);
+    }
+
+    uint32_t reverseBits(uint32_t value) {
+        value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+        value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+        value = ((value >> 4) & 0x0F0F0F0Fu) | ((value & 0x0F0F0F0Fu) << 4);
+        value = ((value >> 8) & 0x00FF00FFu) | ((value & 0x00FF00FFu) << 8);
+        return (value >> 16) | (value << 16);
+    }
+
+    // Only ever flips a bit depending on the bits below it, which is an Owen scramble in reversed bit order.
+    uint32_t laineKarrasPermutation(uint32_t value, uint32_t seed) {
+        value += seed;
+        value ^= value * 0x6c50b47cu;
+        value ^= value * 0xb82f1e52u;
+        value ^= value * 0xc7afe638u;
+        value ^= value * 0x8d22f6e6u;
+        return value;
+    }
+
+    uint32_t nestedUniformScramble(uint32_t value, uint32_t seed) {
+        return reverseBits(laineKarrasPermutation(reverseBits(value), seed));
+    }
+
+    // The first Sobol dimension is the van der Corput sequence.
+    uint32_t sobolDimension0(uint32_t index) {
+        return reverseBits(index);
+    }
+
+    uint32_t sobolDimension1(uint32_t index) {
+        uint32_t result = 0;
+        for (uint32_t direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1) {
+            if (index & 1) {
+                result ^= direction;
+            }
+        }
+        return result;
+    }
+}
+
+uint32_t samplerutils::hash(uint32_t value) {
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+uint32_t samplerutils::hashCombine(uint32_t seed, uint32_t value) {
+    return seed ^ (hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+void RandomSampler::startSample(int x, int y, uint32_t sampleIndex) {
+    auto pixelSeed = samplerutils::hashCombine(samplerutils::hashCombine(_seed, uint32_t(x)), uint32_t(y));
+    _generator = Pcg32(pixelSeed, sampleIndex);
+}
+
+void SobolSampler::startSample(int x, int y, uint32_t sampleIndex) {
+    _pixelSeed = samplerutils::hashCombine(samplerutils::hashCombine(_seed, uint32_t(x)), uint32_t(y));
+    _sampleIndex = sampleIndex;
+    _dimension = 0;
+}
+
+float SobolSampler::next1D() {
+    auto seed = samplerutils::hashCombine(_pixelSeed, _dimension++);
+    auto index = nestedUniformScramble(_sampleIndex, seed);
+    return toFloat(nestedUniformScramble(sobolDimension0(index), samplerutils::hash(seed)));
+}
+
+std::pair<float, float> SobolSampler::next2D() {
+    auto seed = samplerutils::hashCombine(_pixelSeed, _dimension);
+    _dimension += 2;
+
+    auto index = nestedUniformScramble(_sampleIndex, seed);
+    auto x = nestedUniformScramble(sobolDimension0(index), samplerutils::hashCombine(seed, 0));
+    auto y = nestedUniformScramble(sobolDimension1(index), samplerutils::hashCombine(seed, 1));
+    return { toFloat(x), toFloat(y) };
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include "pcg32.h"
+
+enum class SamplerType {
+    Random,
+    Sobol
+};
+
+// Hands out the sample values of one path at a time. startSample() selects the pixel and the sample index,
+// after that every call returns the next dimension. The values only depend on the pixel, the sample index,
+// the dimension and the seed, so renders are reproducible no matter which thread takes which tile.
+class Sampler {
+public:
+    Sampler() = default;
+    virtual ~Sampler() = default;
+
+    virtual void startSample(int x, int y, uint32_t sampleIndex) = 0;
+    // Uniform in [0, 1).
+    virtual float next1D() = 0;
+    // Two dimensions that belong together, like a point in the pixel or a direction.
+    // Low discrepancy samplers stratify these jointly.
+    virtual std::pair<float, float> next2D() = 0;
+};
+
+// Independent uniform samples from a PCG32 seeded per pixel sample.
+class RandomSampler final : public Sampler {
+    uint32_t _seed = 0;
+    Pcg32 _generator = {};
+
+public:
+    explicit RandomSampler(uint32_t seed)
+        : _seed(seed) {}
+
+    void startSample(int x, int y, uint32_t sampleIndex) override;
+    float next1D() override { return _generator.nextFloat(); }
+    std::pair<float, float> next2D() override {
+        auto first = _generator.nextFloat();
+        return { first, _generator.nextFloat() };
+    }
+};
+
+// The first two dimensions of the Sobol sequence, Owen scrambled, with the sample order shuffled
+// independently for every pair of dimensions (Burley, "Practical Hash-based Owen Scrambling", 2020).
+// Every 2D pair is a (0, 2) sequence per pixel: any power of two number of samples is perfectly stratified.
+class SobolSampler final : public Sampler {
+    uint32_t _seed = 0;
+    uint32_t _pixelSeed = 0;
+    uint32_t _sampleIndex = 0;
+    uint32_t _dimension = 0;
+
+public:
+    explicit SobolSampler(uint32_t seed)
+        : _seed(seed) {}
+
+    void startSample(int x, int y, uint32_t sampleIndex) override;
+    float next1D() override;
+    std::pair<float, float> next2D() override;
+};
+
+namespace samplerutils {
+    // Integer hash with good avalanche, for deriving seeds.
+    uint32_t hash(uint32_t value);
+    uint32_t hashCombine(uint32_t seed, uint32_t value);
+}
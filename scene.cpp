@@ -1,9 +1,84 @@
 #include "scene.h"
 
 #include <algorithm>
+#include <limits>
+#include <cmath>
+#include <chrono>
+#include <filesystem>
+#include <fmt/format.h>
 
 #include "sphere.h"
 #include "triangle.h"
+#include "mesh.h"
+#include "instance.h"
+#include "pcg32.h"
+#include "meshio.h"
+#include "scenecache.h"
+
+namespace {
+    // Where a mesh from a file goes: scaled to this size and stood on the floor in the middle of the box.
+    const float MESH_SIZE = 30.0f;
+    const float MESH_FLOOR = -40.0f;
+    const float MESH_DISTANCE = 50.0f;
+
+    std::unique_ptr<SceneObject> placeMesh(std::shared_ptr<const MeshData> mesh) {
+        auto bounds = mesh->bounds();
+        auto extent = bounds.extent();
+        auto scale = MESH_SIZE / std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f));
+        auto center = bounds.centroid();
+        auto offset = Vec3(-center.x * scale, MESH_FLOOR - bounds.min().y * scale, MESH_DISTANCE - center.z * scale);
+        return std::make_unique<Mesh>(std::move(mesh), offset, scale, Material::gray());
+    }
+
+    void hashPrimitives(scenecache::SourceHash &hash, const PrimitiveList &primitives) {
+        auto addVector = [&](Vec3 vector) { hash.add(vector.x).add(vector.y).add(vector.z); };
+        hash.add(uint64_t(primitives.spheres.size()));
+        for (const auto &sphere : primitives.spheres) {
+            addVector(sphere.center);
+            hash.add(sphere.radius).add(sphere.materialIndex);
+        }
+        hash.add(uint64_t(primitives.triangles.size()));
+        for (const auto &triangle : primitives.triangles) {
+            addVector(triangle.vertex0);
+            addVector(triangle.vertex1);
+            addVector(triangle.vertex2);
+            hash.add(triangle.materialIndex);
+        }
+        hash.add(uint64_t(primitives.geometries.size()));
+        for (const auto &geometry : primitives.geometries) {
+            hash.add(uint64_t(geometry.spheres.size()));
+            for (const auto &sphere : geometry.spheres) {
+                addVector(sphere.center);
+                hash.add(sphere.radius).add(sphere.materialIndex);
+            }
+            hash.add(uint64_t(geometry.triangles.size()));
+            for (const auto &triangle : geometry.triangles) {
+                addVector(triangle.vertex0);
+                addVector(triangle.vertex1);
+                addVector(triangle.vertex2);
+                hash.add(triangle.materialIndex);
+            }
+        }
+        hash.add(uint64_t(primitives.instances.size()));
+        for (const auto &instance : primitives.instances) {
+            addVector(instance.transform.translation);
+            hash.add(instance.transform.scale).add(instance.transform.yaw);
+            hash.add(instance.geometry).add(instance.materialIndex);
+        }
+        hash.add(uint64_t(primitives.materials.size()));
+        for (const auto &material : primitives.materials) {
+            addVector(material.color());
+            addVector(material.emittingColor().value_or(Radiance()));
+            hash.add(material.emittingColor().has_value());
+            hash.add(material.reflectionPercent().value_or(-1.0f));
+            hash.add(material.roughness());
+        }
+    }
+
+    double secondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
 
 std::vector<std::unique_ptr<SceneObject>> createRectangleSurface(Vec3 origin, Vec3 dir1, Vec3 dir2, Material material) {
     Vec3 v1 = origin;
@@ -17,17 +92,71 @@ std::vector<std::unique_ptr<SceneObject>> createRectangleSurface(Vec3 origin, Ve
     return vec;
 }
 
-void Scene::initialize() {
-    _camera = Camera(Vec3(0.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f));
+std::vector<std::unique_ptr<SceneObject>> createTessellatedSphere(Vec3 center, float radius, int rings, int segments, Material material) {
+    const float PI = 3.14159265358979f;
+
+    auto pointOnSphere = [&](int ring, int segment) {
+        auto theta = PI * ring / rings;
+        auto phi = 2.0f * PI * segment / segments;
+        return center + Vec3(
+            std::sin(theta) * std::cos(phi),
+            std::cos(theta),
+            std::sin(theta) * std::sin(phi)
+        ) * radius;
+    };
 
-    auto whiteEmittingColor = Material::white().setEmittingColor(Color(255, 255, 255));
+    // Wind the triangle so edge1 x edge2 points away from the center, like the walls point inwards.
+    auto addTriangle = [&](std::vector<std::unique_ptr<SceneObject>> &vec, Vec3 v0, Vec3 v1, Vec3 v2) {
+        auto normal = (v1 - v0).cross(v2 - v0);
+        if (normal.dot(v0 - center) < 0.0f) {
+            std::swap(v1, v2);
+        }
+        vec.push_back(std::make_unique<Triangle>(v0, v1, v2, material));
+    };
+
+    auto vec = std::vector<std::unique_ptr<SceneObject>>();
+    vec.reserve(2 * rings * segments);
+    for (auto ring = 0; ring < rings; ring++) {
+        for (auto segment = 0; segment < segments; segment++) {
+            auto v1 = pointOnSphere(ring, segment);
+            auto v2 = pointOnSphere(ring, segment + 1);
+            auto v3 = pointOnSphere(ring + 1, segment);
+            auto v4 = pointOnSphere(ring + 1, segment + 1);
+
+            // The rings at the poles collapse to a point, so only one triangle there.
+            if (ring != 0) {
+                addTriangle(vec, v1, v2, v3);
+            }
+            if (ring != rings - 1) {
+                addTriangle(vec, v2, v4, v3);
+            }
+        }
+    }
+    return vec;
+}
+
+void Scene::createObjects(SceneType type) {
+    _objects.clear();
+    _animations.clear();
+    _animationsMovable = false;
+    auto animate = [&](size_t firstObject, size_t objectCount, Vec3 pivot, std::vector<Keyframe> keyframes) {
+        auto animated = AnimatedObjects();
+        animated.firstObject = firstObject;
+        animated.objectCount = objectCount;
+        animated.pivot = pivot;
+        animated.animation = Animation(std::move(keyframes));
+        _animations.push_back(std::move(animated));
+    };
+    _camera = Camera(Vec3(0.0f, 0.0f, 0.0f), Vec3(0.0f, 0.0f, 1.0f), Camera::DEFAULT_FIELD_OF_VIEW);
+
+    auto whiteEmittingColor = Material::white().setEmittingColor(Radiance(10.0f, 10.0f, 10.0f));
     _light = std::make_unique<Sphere>(Vec3(0.0f, 30.0f, 10.0f), 5.0, whiteEmittingColor);
 
     _objects.push_back(
         std::make_unique<Sphere>(Vec3(5.0f, -3.0f, 50.0f), 5.0, Material::red().setReflectingPercent(0.1f))
     );
     _objects.push_back(
-        std::make_unique<Sphere>(Vec3(-5.0f, 5.0f, 30.0f), 5.0, Material::green().setReflectingPercent(0.2f))
+        std::make_unique<Sphere>(Vec3(-5.0f, 5.0f, 30.0f), 5.0, Material::green().setReflectingPercent(0.2f).setRoughness(0.3f))
     );
     _objects.push_back(
         std::make_unique<Sphere>(Vec3(15.0f, 15.0f, 60.0f), 5.0, Material::blue().setReflectingPercent(1.0f))
@@ -36,6 +165,19 @@ void Scene::initialize() {
         std::make_unique<Sphere>(Vec3(-15.0f, -15.0f, 60.0f), 5.0, Material::pink())
     );
 
+    // The red sphere bounces twice, the green one drifts to the left and grows, over two seconds.
+    animate(0, 1, Vec3(5.0f, -3.0f, 50.0f), {
+        { 0.0f, Transform{ Vec3(5.0f, -3.0f, 50.0f) } },
+        { 0.5f, Transform{ Vec3(5.0f, 12.0f, 50.0f) } },
+        { 1.0f, Transform{ Vec3(5.0f, -3.0f, 50.0f) } },
+        { 1.5f, Transform{ Vec3(5.0f, 12.0f, 50.0f) } },
+        { 2.0f, Transform{ Vec3(5.0f, -3.0f, 50.0f) } },
+    });
+    animate(1, 1, Vec3(-5.0f, 5.0f, 30.0f), {
+        { 0.0f, Transform{ Vec3(-5.0f, 5.0f, 30.0f) } },
+        { 2.0f, Transform{ Vec3(-20.0f, 5.0f, 45.0f), 1.5f } },
+    });
+
 
     auto boundaryColor = Material::white();
     // Floor
@@ -114,53 +256,168 @@ void Scene::initialize() {
     //_objects.push_back(
     //    std::make_unique<Sphere>(Vec3(0.0f, 0.0f, 30.0f), 5.0, Material::green())
     //);
+
+    if (type == SceneType::HighPolygon) {
+        // Three instances of one sphere with 2 * 160 * 192 triangles, lying on the floor.
+        auto sphere = std::make_shared<SharedGeometry>();
+        sphere->objects = createTessellatedSphere(Vec3(0.0f, 0.0f, 0.0f), 10.0f, 160, 192, Material::gray());
+        auto meshSpheres = {
+            std::make_pair(Vec3(-22.0f, -30.0f, 90.0f), Material::gray()),
+            std::make_pair(Vec3(0.0f, -30.0f, 110.0f), Material::pink()),
+            std::make_pair(Vec3(22.0f, -30.0f, 90.0f), Material::white()),
+        };
+        for (const auto &[center, material] : meshSpheres) {
+            _objects.push_back(std::make_unique<Instance>(sphere, Transform{ center }, material));
+
+            // The one at the back comes forward between the others, turning as it goes.
+            if (center.z > 100.0f) {
+                animate(_objects.size() - 1, 1, center, {
+                    { 0.0f, Transform{ center } },
+                    { 2.0f, Transform{ Vec3(0.0f, -30.0f, 70.0f), 1.0f, -4.0f } },
+                });
+            }
+        }
+    }
+
+    if (type == SceneType::Crowd) {
+        // CROWD_SIZE x CROWD_SIZE spheres of 2 * 48 * 64 triangles standing on the floor, all instances of
+        // one. Sizes, turns and colors vary, the same way every time.
+        const int CROWD_SIZE = 24;
+        const float SPACING = 3.2f;
+        auto sphere = std::make_shared<SharedGeometry>();
+        sphere->objects = createTessellatedSphere(Vec3(0.0f, 1.0f, 0.0f), 1.0f, 48, 64, Material::white());
+        auto materials = std::vector<Material>{ Material::red(), Material::green(), Material::blue(), Material::pink(),
+            Material::white(), Material::green().setReflectingPercent(0.5f).setRoughness(0.2f) };
+        auto random = Pcg32(CROWD_SIZE);
+        for (auto row = 0; row < CROWD_SIZE; row++) {
+            for (auto column = 0; column < CROWD_SIZE; column++) {
+                auto position = Vec3((column - (CROWD_SIZE - 1) * 0.5f) * SPACING, -40.0f, 30.0f + row * SPACING);
+                auto scale = 1.0f + 0.6f * random.nextFloat();
+                auto yaw = 6.2831853f * random.nextFloat();
+                const auto &material = materials[random.nextUint() % materials.size()];
+                _objects.push_back(std::make_unique<Instance>(sphere, Transform{ position, scale, yaw }, material));
+            }
+        }
+    }
 }
 
-std::optional<Intersection> Scene::firstIntersection(const Ray &ray) const {
-    auto intersections = std::vector<Intersection>();
-    // Make this reasonable sized, so we don't hit as many array resizings.
-    intersections.reserve(16);
+bool Scene::initialize(SceneType type, const std::string &meshPath, const std::string &cachePath) {
+    createObjects(type);
 
+    // The light is traced like any other object, it is only kept apart for its position.
+    auto primitives = PrimitiveList();
+    _light->appendTo(primitives);
+    auto firstSpheres = std::vector<uint32_t>();
+    auto firstTriangles = std::vector<uint32_t>();
+    auto firstInstances = std::vector<uint32_t>();
     for (const auto &object : _objects) {
-        auto intersection = object->intersect(ray);
-        if (intersection) {
-            intersections.push_back(*intersection);
+        firstSpheres.push_back(uint32_t(primitives.spheres.size()));
+        firstTriangles.push_back(uint32_t(primitives.triangles.size()));
+        firstInstances.push_back(uint32_t(primitives.instances.size()));
+        object->appendTo(primitives);
+    }
+    firstSpheres.push_back(uint32_t(primitives.spheres.size()));
+    firstTriangles.push_back(uint32_t(primitives.triangles.size()));
+    firstInstances.push_back(uint32_t(primitives.instances.size()));
+    for (auto &animated : _animations) {
+        auto first = animated.firstObject;
+        auto end = animated.firstObject + animated.objectCount;
+        animated.primitives = CompiledScene::PrimitiveGroup{ firstSpheres[first], firstSpheres[end] - firstSpheres[first],
+            firstTriangles[first], firstTriangles[end] - firstTriangles[first],
+            firstInstances[first], firstInstances[end] - firstInstances[first] };
+    }
+
+    // Everything the compiled scene depends on. A mesh is identified by its file, so a cache hit
+    // does not have to read it.
+    auto sourceHash = scenecache::SourceHash();
+    sourceHash.add(scenecache::VERSION).add(uint32_t(type));
+    hashPrimitives(sourceHash, primitives);
+    if (!meshPath.empty()) {
+        auto error = std::error_code();
+        auto size = std::filesystem::file_size(meshPath, error);
+        auto modified = std::filesystem::last_write_time(meshPath, error);
+        if (error) {
+            fmt::print(stderr, "Could not open {}\n", meshPath);
+            return false;
         }
+        sourceHash.add(meshPath).add(uint64_t(size)).add(int64_t(modified.time_since_epoch().count()));
+        sourceHash.add(MESH_SIZE).add(MESH_FLOOR).add(MESH_DISTANCE);
     }
+    _sourceHash = sourceHash.value();
 
-    // TODO: Is light just another scene object?
-    auto lightIntersection = _light->intersect(ray);
-    if (lightIntersection) {
-        intersections.push_back(*lightIntersection);
+    if (!cachePath.empty() && _compiledScene.loadCache(cachePath, sourceHash.value())) {
+        fmt::print("Mapped the compiled scene from {}\n", cachePath);
+        return true;
     }
 
-    if (intersections.empty()) {
-        return std::optional<Intersection>();
+    if (!meshPath.empty()) {
+        auto loadStart = std::chrono::steady_clock::now();
+        auto mesh = meshio::load(meshPath);
+        if (!mesh) {
+            return false;
+        }
+        fmt::print("Loaded {} vertices and {} triangles in {:.2f} s\n", mesh->vertexCount(), mesh->triangleCount(),
+            secondsSince(loadStart));
+        if (mesh->triangleCount() > 0) {
+            _objects.push_back(placeMesh(std::make_shared<const MeshData>(std::move(*mesh))));
+            _objects.back()->appendTo(primitives);
+        }
     }
 
-    return *std::min_element(intersections.begin(), intersections.end(), [&](const Intersection &a, const Intersection &b) {
-        return a.distance() < b.distance();
-    });
+    auto buildStart = std::chrono::steady_clock::now();
+    _compiledScene.build(primitives);
+    fmt::print("Compiled {} spheres and {} triangles in {:.2f} s\n", _compiledScene.sphereCount(), _compiledScene.triangleCount(),
+        secondsSince(buildStart));
+    if (_compiledScene.instanceCount() > 0) {
+        fmt::print("{} instances of {} geometries place {} triangles\n", _compiledScene.instanceCount(),
+            _compiledScene.geometryCount(), _compiledScene.placedTriangleCount());
+    }
+
+    if (!cachePath.empty() && _compiledScene.saveCache(cachePath, sourceHash.value())) {
+        fmt::print("Wrote the compiled scene to {}\n", cachePath);
+    }
+    return true;
 }
 
-bool Scene::hitsLight(const Ray &ray) const {
-    std::vector<Intersection> intersections;
-    for (const auto &object : _objects) {
-        auto intersection = object->intersect(ray);
-        if (intersection) {
-            intersections.push_back(*intersection);
-        }
+bool Scene::initializeFromCache(SceneType type, const std::string &cachePath, uint64_t sourceHash) {
+    createObjects(type);
+    _sourceHash = sourceHash;
+    if (!_compiledScene.loadCache(cachePath, sourceHash)) {
+        fmt::print(stderr, "Could not map the compiled scene from {}\n", cachePath);
+        return false;
     }
+    return true;
+}
 
-    // TODO: Is light just another scene object?
-    auto lightIntersection = _light->intersect(ray);
+std::optional<CompiledScene::MotionUpdate> Scene::setTime(float time) {
+    if (!_animationsMovable) {
+        for (auto &animated : _animations) {
+            auto group = _compiledScene.addMovingGroup(animated.primitives, animated.pivot);
+            if (!group) {
+                fmt::print(stderr, "A scene mapped from a cache cannot be animated\n");
+                return std::optional<CompiledScene::MotionUpdate>();
+            }
+            animated.movingGroup = *group;
+        }
+        _animationsMovable = true;
+    }
 
-    if (!lightIntersection) {
-        return false;
+    for (const auto &animated : _animations) {
+        _compiledScene.moveGroup(animated.movingGroup, animated.animation.at(time));
     }
+    return _compiledScene.updateMotion();
+}
 
-    // Are all other intersections distances bigger?
-    return std::all_of(intersections.begin(), intersections.end(), [&](const Intersection &i) {
-        return i.distance() > lightIntersection->distance();
-    });
+std::optional<Intersection> Scene::closestHit(const Ray &ray, float tMax) const {
+    return _compiledScene.closestHit(ray, tMax);
+}
+
+bool Scene::occluded(const Ray &ray, float tMax) const {
+    return _compiledScene.occluded(ray, tMax);
+}
+
+bool Scene::hitsLight(const Ray &ray) const {
+    // The light is the only emitting object, so the ray reaches it if nothing else is hit first.
+    auto hit = intersect(ray);
+    return hit.hit() && resolve(ray, hit).material().emittingColor().has_value();
 }
@@ -3,23 +3,97 @@
 #include <optional>
 #include <vector>
 #include <memory>
+#include <limits>
+#include <string>
+#include <cstdint>
 
 #include "intersection.h"
 #include "ray.h"
 #include "camera.h"
 #include "sphere.h"
 #include "sceneobject.h"
+#include "compiledscene.h"
+#include "animation.h"
+
+enum class SceneType {
+    CornellBox,
+    // The cornell box plus a few finely tessellated spheres, >100k triangles.
+    HighPolygon,
+    // The cornell box with a crowd of instances of one tessellated sphere, millions of triangles placed
+    // from a few thousand stored.
+    Crowd
+};
 
 class Scene {
+    // Objects [firstObject, firstObject + objectCount) move together. Their geometry as created is
+    // placed by a transform whose translation is pivot, animation places it over time.
+    struct AnimatedObjects {
+    public:
+        size_t firstObject = 0;
+        size_t objectCount = 0;
+        Vec3 pivot = {};
+        Animation animation = {};
+        // Their primitives in what the compiled scene is built from.
+        CompiledScene::PrimitiveGroup primitives = {};
+        // Of the compiled scene, once setTime made it movable.
+        size_t movingGroup = 0;
+    };
+
     Camera _camera = {};
     std::vector<std::unique_ptr<SceneObject>> _objects = {};
     std::unique_ptr<Sphere> _light = {};
+    // What rays are actually traced against, built from _objects and the light.
+    CompiledScene _compiledScene = {};
+    // Identifies everything the compiled scene was made from, see scenecache::SourceHash.
+    uint64_t _sourceHash = 0;
+    std::vector<AnimatedObjects> _animations = {};
+    bool _animationsMovable = false;
 
 public:
     Camera camera() const { return _camera; }
     Vec3 light() const { return _light->center(); }
+    // The only emitting object, sampled directly for next event estimation.
+    const Sphere &lightSphere() const { return *_light; }
+
+    size_t objectCount() const { return _objects.size(); }
+    const CompiledScene &compiledScene() const { return _compiledScene; }
+    uint64_t sourceHash() const { return _sourceHash; }
+
+    // A mesh file (.obj or .ply), if given, is scaled to fit and stood on the floor in the middle of the box.
+    // With a cache path the compiled scene is mapped from there if it was written for the same scene,
+    // without loading the mesh or building anything, and written there otherwise.
+    // Returns false if the mesh cannot be loaded.
+    bool initialize(SceneType type = SceneType::CornellBox, const std::string &meshPath = {}, const std::string &cachePath = {});
+    // Makes the same scene as another process did: the objects of type are created again, the compiled scene
+    // (with any mesh in it) is mapped from the cache that process wrote with sourceHash.
+    // Returns false if the cache cannot be used.
+    bool initializeFromCache(SceneType type, const std::string &cachePath, uint64_t sourceHash);
 
-    void initialize();
-    std::optional<Intersection> firstIntersection(const Ray &ray) const;
+    // Moves the animated objects to where they are time seconds into the animation. Until the first call
+    // the scene stays as it was created. Rendering must not run meanwhile. Returns nothing if the compiled
+    // scene was mapped from a cache and cannot be moved. The scene objects themselves stay where they were
+    // created, only what rays are traced against moves.
+    std::optional<CompiledScene::MotionUpdate> setTime(float time);
+
+    // The closest hit as a small record, and the position, normal and material for it.
+    // Shading only needs to resolve the one hit it actually uses.
+    HitRecord intersect(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const {
+        return _compiledScene.intersect(ray, tMax);
+    }
+    Intersection resolve(const Ray &ray, const HitRecord &hit) const { return _compiledScene.resolve(ray, hit); }
+
+    // Nearest hit closer than tMax. The running nearest distance is kept on the stack and culls
+    // everything behind it, nothing touches the heap.
+    std::optional<Intersection> closestHit(const Ray &ray, float tMax = std::numeric_limits<float>::infinity()) const;
+    // Is there anything, the light included, closer than tMax along the ray?
+    // Returns at the first blocker, without working out which one is closest, and does not allocate either.
+    bool occluded(const Ray &ray, float tMax) const;
+
+    std::optional<Intersection> firstIntersection(const Ray &ray) const { return closestHit(ray); }
+    // Does the ray reach the light without hitting anything on the way?
     bool hitsLight(const Ray &ray) const;
+
+private:
+    // Camera, light and the objects of the scene type, without any mesh.
+    void createObjects(SceneType type);
 };
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Layout of the compiled scene cache. The file is a header followed by sections, each a plain array
+// of one CompiledScene array at a 32 byte aligned offset from the start of the file. There are no
+// pointers in it, so it can be mapped anywhere and traced as it is.
+namespace scenecache {
+    // Bump whenever the layout of the file, or of anything stored in it (like BvhNode), changes.
+    const uint32_t VERSION = 3;
+    const char MAGIC[8] = { 'P', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+    const size_t SECTION_ALIGNMENT = 32;
+
+    enum class Section : uint32_t {
+        SphereCenterX,
+        SphereCenterY,
+        SphereCenterZ,
+        SphereRadius,
+        SphereMaterialIndex,
+        TriangleVertex0X,
+        TriangleVertex0Y,
+        TriangleVertex0Z,
+        TriangleEdge1X,
+        TriangleEdge1Y,
+        TriangleEdge1Z,
+        TriangleEdge2X,
+        TriangleEdge2Y,
+        TriangleEdge2Z,
+        TriangleMaterialIndex,
+        BvhNodes,
+        Materials,
+        // The nodes of all geometries back to back, see GeometryRecord.
+        GeometryNodes,
+        Geometries,
+        Instances,
+        Count
+    };
+
+    struct SectionEntry {
+    public:
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+    struct Header {
+    public:
+        char magic[8] = {};
+        uint32_t version = 0;
+        // Tells caches written on a machine with other byte order or padding apart.
+        uint32_t headerSize = 0;
+        // Hash of everything the scene was compiled from, see SourceHash.
+        uint64_t sourceHash = 0;
+        SectionEntry sections[size_t(Section::Count)] = {};
+    };
+
+    // Materials are few and are copied out, Material itself holds optionals and SIMD vectors.
+    struct MaterialRecord {
+    public:
+        float color[3] = {};
+        float emittingColor[3] = {};
+        float reflectionPercent = 0.0f;
+        float roughness = 0.0f;
+        uint32_t flags = 0;
+    };
+    const uint32_t MATERIAL_EMITS = 1;
+    const uint32_t MATERIAL_REFLECTS = 2;
+
+    struct GeometryRecord {
+    public:
+        uint64_t firstNode = 0;
+        uint64_t nodeCount = 0;
+        uint32_t firstSphere = 0;
+        uint32_t sphereCount = 0;
+        uint32_t firstTriangle = 0;
+        uint32_t triangleCount = 0;
+    };
+
+    // Copied out like the materials, the compiled scene keeps more of the transform than it stores.
+    struct InstanceRecord {
+    public:
+        float translation[3] = {};
+        float scale = 1.0f;
+        float yaw = 0.0f;
+        uint32_t geometry = 0;
+        uint32_t materialIndex = 0;
+    };
+
+    // FNV-1a over everything a scene is made from. Equal hashes mean the cache can be used.
+    class SourceHash {
+        uint64_t _value = 0xcbf29ce484222325ULL;
+
+    public:
+        SourceHash &add(const void *data, size_t size) {
+            auto bytes = static_cast<const unsigned char *>(data);
+            for (size_t i = 0; i < size; i++) {
+                _value = (_value ^ bytes[i]) * 0x100000001b3ULL;
+            }
+            return *this;
+        }
+        template<class T>
+        SourceHash &add(const T &value) { return add(&value, sizeof(T)); }
+        SourceHash &add(const std::string &text) { return add(uint64_t(text.size())).add(text.data(), text.size()); }
+
+        uint64_t value() const { return _value; }
+    };
+}
@@ -4,10 +4,19 @@
 
 #include "intersection.h"
 #include "ray.h"
+#include "boundingbox.h"
+#include "primitives.h"
 
 class SceneObject {
 public:
     SceneObject() = default;
     virtual ~SceneObject() = default;
-    virtual std::optional<Intersection> intersect(const Ray &ray) const = 0;
+    // The hit closest to the ray origin, if it is closer than tMax.
+    // Hits farther away are rejected before their position, normal and material are worked out.
+    virtual std::optional<Intersection> intersect(const Ray &ray, float tMax) const = 0;
+    // Only the distance test, for shadow rays: is there a hit closer than tMax?
+    virtual bool occludes(const Ray &ray, float tMax) const = 0;
+    virtual BoundingBox boundingBox() const = 0;
+    // Adds the object's geometry to what gets compiled for tracing, see CompiledScene.
+    virtual void appendTo(PrimitiveList &primitives) const = 0;
 };
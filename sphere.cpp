@@ -2,7 +2,7 @@
 
 #include <cmath>
 
-std::optional<Intersection> Sphere::intersect(const Ray &ray) const {
+std::optional<float> Sphere::hitDistance(const Ray &ray) const {
     auto oc = ray.origin() - _center;
     auto a = ray.direction().dot(ray.direction());
     auto b = 2.0 * oc.dot(ray.direction());
@@ -10,24 +10,84 @@ std::optional<Intersection> Sphere::intersect(const Ray &ray) const {
     auto discriminant = b * b - 4 * a * c;
 
     if (discriminant < 0) {
-        return std::optional<Intersection>();
+        return std::optional<float>();
     }
 
-    float distance = (-b - std::sqrtf(discriminant)) / (2.0f * a);
+    float distance = (-b - std::sqrt(discriminant)) / (2.0f * a);
 
     // We do not go backwards along the ray.
     if (distance < 0.0f) {
+        return std::optional<float>();
+    }
+    return distance;
+}
+
+std::optional<LightSample> Sphere::sampleDirection(Vec3 position, float u1, float u2) const {
+    auto toCenter = _center - position;
+    auto distanceSquared = toCenter.dot(toCenter);
+    auto radiusSquared = _radius * _radius;
+    if (distanceSquared <= radiusSquared) {
+        return std::optional<LightSample>();
+    }
+
+    auto centerDistance = std::sqrt(distanceSquared);
+    auto sinMaxSquared = radiusSquared / distanceSquared;
+    auto cosMax = std::sqrt(1.0f - sinMaxSquared);
+    auto direction = vectorutils::createVectorInCone(toCenter / centerDistance, cosMax, u1, u2);
+
+    // Where the direction enters the sphere, from its angle to the center.
+    auto cosTheta = direction.dot(toCenter) / centerDistance;
+    auto sinThetaSquared = std::max(0.0f, 1.0f - cosTheta * cosTheta);
+    auto distance = centerDistance * cosTheta - std::sqrt(std::max(0.0f, radiusSquared - distanceSquared * sinThetaSquared));
+
+    auto sample = LightSample();
+    sample.direction = direction;
+    sample.distance = std::max(distance, 0.0f);
+    sample.pdf = directionPdf(position);
+    return sample;
+}
+
+float Sphere::directionPdf(Vec3 position) const {
+    auto toCenter = _center - position;
+    auto distanceSquared = toCenter.dot(toCenter);
+    auto radiusSquared = _radius * _radius;
+    if (distanceSquared <= radiusSquared) {
+        return 0.0f;
+    }
+    // 1 - cosMax without the cancellation of small, far away lights.
+    auto sinMaxSquared = radiusSquared / distanceSquared;
+    auto oneMinusCosMax = sinMaxSquared / (1.0f + std::sqrt(1.0f - sinMaxSquared));
+    return 1.0f / (2.0f * vectorutils::PI * oneMinusCosMax);
+}
+
+std::optional<Intersection> Sphere::intersect(const Ray &ray, float tMax) const {
+    auto distance = hitDistance(ray);
+    if (!distance || *distance >= tMax) {
         return std::optional<Intersection>();
     }
 
-    Vec3 hit = ray.origin() + ray.direction() * distance;
+    Vec3 hit = ray.origin() + ray.direction() * *distance;
     // The normal is just a vector from the origin to the hit
     Vec3 normal = (hit - _center).normalize();
 
     return Intersection(
         hit,
         normal,
-        distance,
+        *distance,
         _material
     );
 }
+
+bool Sphere::occludes(const Ray &ray, float tMax) const {
+    auto distance = hitDistance(ray);
+    return distance && *distance < tMax;
+}
+
+void Sphere::appendTo(PrimitiveList &primitives) const {
+    primitives.spheres.push_back(SpherePrimitive{ _center, _radius, primitives.addMaterial(_material) });
+}
+
+BoundingBox Sphere::boundingBox() const {
+    auto radius = Vec3(_radius, _radius, _radius);
+    return BoundingBox(_center - radius, _center + radius);
+}
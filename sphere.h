@@ -6,7 +6,17 @@
 #include "vec3.h"
 #include "material.h"
 
-class Sphere : public SceneObject {
+// A direction from a point towards a light, as sampled for direct lighting.
+struct LightSample {
+public:
+    Vec3 direction = {};
+    // From the point to the surface of the light along direction.
+    float distance = 0.0f;
+    // Probability density per solid angle.
+    float pdf = 0.0f;
+};
+
+class Sphere final : public SceneObject {
 private:
     Vec3 _center = {};
     float _radius = {};
@@ -16,7 +26,23 @@ public:
         : _center(center), _radius(radius), _material(material) {}
 
     Vec3 center() const { return _center; }
+    float radius() const { return _radius; }
+    const Material &material() const { return _material; }
+
+    // Uniform over the cone of directions in which the sphere is seen from position, which wastes no
+    // samples on the back side. Nothing if position is inside the sphere.
+    std::optional<LightSample> sampleDirection(Vec3 position, float u1, float u2) const;
+    // Density of sampleDirection for any direction from position that hits the sphere.
+    float directionPdf(Vec3 position) const;
+
+private:
+    std::optional<float> hitDistance(const Ray &ray) const;
+
+public:
 
     // Inherited via SceneObject
-    std::optional<Intersection> intersect(const Ray &ray) const override;
+    std::optional<Intersection> intersect(const Ray &ray, float tMax) const override;
+    bool occludes(const Ray &ray, float tMax) const override;
+    BoundingBox boundingBox() const override;
+    void appendTo(PrimitiveList &primitives) const override;
 };
@@ -0,0 +1,318 @@
+#include "tcpsocket.h"
+
+#include <utility>
+#include <algorithm>
+#include <climits>
+#include <fmt/format.h>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <winsock2.h>
+# include <ws2tcpip.h>
+# ifdef _MSC_VER
+#  pragma comment(lib, "Ws2_32.lib")
+# endif
+#else
+# include <netdb.h>
+# include <poll.h>
+# include <unistd.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+# include <sys/socket.h>
+# include <sys/time.h>
+#endif
+
+namespace {
+#ifdef _WIN32
+    using Handle = SOCKET;
+    const Handle NO_SOCKET = INVALID_SOCKET;
+
+    void closeHandle(Handle handle) { closesocket(handle); }
+    int lastError() { return WSAGetLastError(); }
+
+    // Winsock has to be started once per process before the first call.
+    bool startNetworking() {
+        static const auto started = []() {
+            auto data = WSADATA();
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        return started;
+    }
+#else
+    using Handle = int;
+    const Handle NO_SOCKET = -1;
+
+    void closeHandle(Handle handle) { ::close(handle); }
+    int lastError() { return errno; }
+    bool startNetworking() { return true; }
+#endif
+
+    // Payloads are at most a compiled scene, anything larger is a damaged or foreign stream.
+    const uint64_t MAX_MESSAGE_SIZE = uint64_t(1) << 36;
+
+    struct MessageHeader {
+    public:
+        uint32_t type = 0;
+        uint32_t reserved = 0;
+        uint64_t size = 0;
+    };
+    static_assert(sizeof(MessageHeader) == TcpSocket::MESSAGE_HEADER_SIZE, "The header is sent as it is in memory");
+
+    // Tasks are small messages that are waited for, they must not sit in Nagle's buffer.
+    void disableNagle(Handle handle) {
+        int enabled = 1;
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&enabled), sizeof(enabled));
+    }
+
+    // Keepalive probes after 10 seconds without traffic, where the interval can be set, and sends
+    // that cannot go on for 30 seconds fail. The system defaults wait for hours.
+    void detectDeadPeers(Handle handle) {
+        int enabled = 1;
+        setsockopt(handle, SOL_SOCKET, SO_KEEPALIVE, reinterpret_cast<const char *>(&enabled), sizeof(enabled));
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        int idleSeconds = 10;
+        int intervalSeconds = 5;
+        int probes = 3;
+        setsockopt(handle, IPPROTO_TCP, TCP_KEEPIDLE, reinterpret_cast<const char *>(&idleSeconds), sizeof(idleSeconds));
+        setsockopt(handle, IPPROTO_TCP, TCP_KEEPINTVL, reinterpret_cast<const char *>(&intervalSeconds), sizeof(intervalSeconds));
+        setsockopt(handle, IPPROTO_TCP, TCP_KEEPCNT, reinterpret_cast<const char *>(&probes), sizeof(probes));
+#endif
+#ifdef _WIN32
+        DWORD sendTimeout = 30'000;
+#else
+        auto sendTimeout = timeval{ 30, 0 };
+#endif
+        setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&sendTimeout), sizeof(sendTimeout));
+    }
+
+    // Calls open with every address the host resolves to until it returns a socket.
+    template<class Open>
+    std::optional<Handle> openFirst(const std::string &host, int port, bool passive, Open open) {
+        if (!startNetworking()) {
+            fmt::print(stderr, "Could not start networking\n");
+            return std::optional<Handle>();
+        }
+        auto hints = addrinfo();
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = passive ? AI_PASSIVE : 0;
+        addrinfo *addresses = nullptr;
+        auto service = std::to_string(port);
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &addresses) != 0) {
+            fmt::print(stderr, "Could not resolve {}\n", host);
+            return std::optional<Handle>();
+        }
+        auto result = std::optional<Handle>();
+        for (auto address = addresses; address && !result; address = address->ai_next) {
+            auto handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (handle == NO_SOCKET) {
+                continue;
+            }
+            if (open(handle, *address)) {
+                result = handle;
+            }
+            else {
+                closeHandle(handle);
+            }
+        }
+        freeaddrinfo(addresses);
+        return result;
+    }
+}
+
+TcpSocket::~TcpSocket() {
+    close();
+}
+
+TcpSocket::TcpSocket(TcpSocket &&other) noexcept {
+    *this = std::move(other);
+}
+
+TcpSocket &TcpSocket::operator=(TcpSocket &&other) noexcept {
+    if (this != &other) {
+        close();
+        _handle = std::exchange(other._handle, NO_SOCKET);
+    }
+    return *this;
+}
+
+std::optional<TcpSocket> TcpSocket::listen(const std::string &host, int port) {
+    auto handle = openFirst(host, port, true, [](Handle handle, const addrinfo &address) {
+        // A restarted coordinator can take over its port right away.
+        int enabled = 1;
+        setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&enabled), sizeof(enabled));
+        return ::bind(handle, address.ai_addr, int(address.ai_addrlen)) == 0 && ::listen(handle, SOMAXCONN) == 0;
+    });
+    if (!handle) {
+        fmt::print(stderr, "Could not listen on port {} (error {})\n", port, lastError());
+        return std::optional<TcpSocket>();
+    }
+    auto socket = TcpSocket();
+    socket._handle = *handle;
+    return socket;
+}
+
+std::optional<TcpSocket> TcpSocket::connect(const std::string &host, int port) {
+    auto handle = openFirst(host, port, false, [](Handle handle, const addrinfo &address) {
+        return ::connect(handle, address.ai_addr, int(address.ai_addrlen)) == 0;
+    });
+    if (!handle) {
+        fmt::print(stderr, "Could not connect to {}:{} (error {})\n", host, port, lastError());
+        return std::optional<TcpSocket>();
+    }
+    disableNagle(*handle);
+    detectDeadPeers(*handle);
+    auto socket = TcpSocket();
+    socket._handle = *handle;
+    return socket;
+}
+
+std::optional<TcpSocket> TcpSocket::accept() {
+    auto handle = ::accept(_handle, nullptr, nullptr);
+    if (handle == NO_SOCKET) {
+        fmt::print(stderr, "Could not accept a connection (error {})\n", lastError());
+        return std::optional<TcpSocket>();
+    }
+    disableNagle(handle);
+    detectDeadPeers(handle);
+    auto socket = TcpSocket();
+    socket._handle = handle;
+    return socket;
+}
+
+bool TcpSocket::valid() const {
+    return _handle != NO_SOCKET;
+}
+
+int TcpSocket::localPort() const {
+    auto address = sockaddr_storage();
+    socklen_t size = sizeof(address);
+    if (getsockname(_handle, reinterpret_cast<sockaddr *>(&address), &size) != 0) {
+        return 0;
+    }
+    if (address.ss_family == AF_INET6) {
+        return ntohs(reinterpret_cast<const sockaddr_in6 &>(address).sin6_port);
+    }
+    return ntohs(reinterpret_cast<const sockaddr_in &>(address).sin_port);
+}
+
+bool TcpSocket::send(const void *data, size_t size) {
+#ifdef MSG_NOSIGNAL
+    // A peer that went away is reported as an error, not as SIGPIPE.
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    auto bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        auto chunk = int(std::min<size_t>(size, INT_MAX));
+        auto sent = ::send(_handle, bytes, chunk, flags);
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= size_t(sent);
+    }
+    return true;
+}
+
+bool TcpSocket::receive(void *data, size_t size) {
+    auto bytes = static_cast<char *>(data);
+    while (size > 0) {
+        auto chunk = int(std::min<size_t>(size, INT_MAX));
+        auto received = ::recv(_handle, bytes, chunk, 0);
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= size_t(received);
+    }
+    return true;
+}
+
+bool TcpSocket::sendMessage(uint32_t type, std::initializer_list<Buffer> payload) {
+    auto header = MessageHeader();
+    header.type = type;
+    for (const auto &part : payload) {
+        header.size += part.size;
+    }
+    if (!send(&header, sizeof(header))) {
+        return false;
+    }
+    for (const auto &part : payload) {
+        if (!send(part.data, part.size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<TcpSocket::Message> TcpSocket::receiveMessage() {
+    auto header = MessageHeader();
+    if (!receive(&header, sizeof(header)) || header.size > MAX_MESSAGE_SIZE) {
+        return std::optional<Message>();
+    }
+    auto message = Message();
+    message.type = header.type;
+    message.payload.resize(size_t(header.size));
+    if (!receive(message.payload.data(), message.payload.size())) {
+        return std::optional<Message>();
+    }
+    return message;
+}
+
+bool TcpSocket::receivePart(PartialMessage &partial) {
+    auto headerMissing = partial.received < MESSAGE_HEADER_SIZE;
+    auto target = headerMissing
+        ? partial.header + partial.received
+        : partial.message.payload.data() + (partial.received - MESSAGE_HEADER_SIZE);
+    auto size = headerMissing
+        ? MESSAGE_HEADER_SIZE - partial.received
+        : partial.message.payload.size() - (partial.received - MESSAGE_HEADER_SIZE);
+    if (size > 0) {
+        auto received = ::recv(_handle, target, int(std::min<size_t>(size, INT_MAX)), 0);
+        if (received <= 0) {
+            return false;
+        }
+        partial.received += size_t(received);
+    }
+
+    if (headerMissing && partial.received == MESSAGE_HEADER_SIZE) {
+        auto header = MessageHeader();
+        std::memcpy(&header, partial.header, sizeof(header));
+        if (header.size > MAX_MESSAGE_SIZE) {
+            return false;
+        }
+        partial.message.type = header.type;
+        partial.message.payload.resize(size_t(header.size));
+    }
+    return true;
+}
+
+std::vector<size_t> TcpSocket::poll(const std::vector<TcpSocket *> &sockets, int timeoutMilliseconds) {
+    auto descriptors = std::vector<pollfd>(sockets.size());
+    for (size_t i = 0; i < sockets.size(); i++) {
+        descriptors[i].fd = sockets[i]->_handle;
+        descriptors[i].events = POLLIN;
+    }
+#ifdef _WIN32
+    auto ready = WSAPoll(descriptors.data(), ULONG(descriptors.size()), timeoutMilliseconds);
+#else
+    auto ready = ::poll(descriptors.data(), nfds_t(descriptors.size()), timeoutMilliseconds);
+#endif
+    auto readable = std::vector<size_t>();
+    for (size_t i = 0; i < descriptors.size() && ready > 0; i++) {
+        if (descriptors[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            readable.push_back(i);
+        }
+    }
+    return readable;
+}
+
+void TcpSocket::close() {
+    if (_handle != NO_SOCKET) {
+        closeHandle(_handle);
+    }
+    _handle = NO_SOCKET;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+// A connected or listening TCP socket, closed when it goes away. Everything blocks, poll() tells which
+// sockets have something to read. Failures print the problem and return false or nothing.
+// Connections send keepalive probes and give up on a send that makes no progress, so a peer that
+// vanished without closing the connection shows up as a failure after a while.
+//
+// On top of the byte stream it sends messages: a type and a payload whose size is sent up front.
+// Numbers go over the wire as they are in memory, so all machines involved need the same byte order.
+class TcpSocket {
+public:
+    struct Message {
+    public:
+        uint32_t type = 0;
+        std::vector<char> payload = {};
+    };
+
+    static const size_t MESSAGE_HEADER_SIZE = 16;
+
+    // A message received as its bytes come in, see receivePart.
+    struct PartialMessage {
+    public:
+        char header[MESSAGE_HEADER_SIZE] = {};
+        // Bytes of the header and then the payload.
+        size_t received = 0;
+        // Its payload has the full size once the header is in.
+        Message message = {};
+
+        bool complete() const { return received >= MESSAGE_HEADER_SIZE && received - MESSAGE_HEADER_SIZE == message.payload.size(); }
+    };
+
+    // Part of a message payload, the parts are sent back to back.
+    struct Buffer {
+    public:
+        const void *data = nullptr;
+        size_t size = 0;
+    };
+
+private:
+#ifdef _WIN32
+    uintptr_t _handle = ~uintptr_t(0);
+#else
+    int _handle = -1;
+#endif
+
+public:
+    TcpSocket() = default;
+    ~TcpSocket();
+    TcpSocket(TcpSocket &&other) noexcept;
+    TcpSocket &operator=(TcpSocket &&other) noexcept;
+    TcpSocket(const TcpSocket &) = delete;
+    TcpSocket &operator=(const TcpSocket &) = delete;
+
+    // Empty host for all interfaces, port 0 for any free one (see localPort).
+    static std::optional<TcpSocket> listen(const std::string &host, int port);
+    static std::optional<TcpSocket> connect(const std::string &host, int port);
+    // Waits for the next connection to a listening socket.
+    std::optional<TcpSocket> accept();
+
+    bool valid() const;
+    int localPort() const;
+
+    bool send(const void *data, size_t size);
+    // Fills all of data, false if the connection closes before.
+    bool receive(void *data, size_t size);
+
+    bool sendMessage(uint32_t type, std::initializer_list<Buffer> payload = {});
+    std::optional<Message> receiveMessage();
+    // Adds what arrived to partial with a single read, which does not block on a socket poll() reported.
+    // A peer that stops halfway through a message so cannot stall the receiver. False if the connection
+    // closed or the message is damaged. Take the message once it is complete and start over with a new one.
+    bool receivePart(PartialMessage &partial);
+
+    // A message whose payload is one plain struct.
+    template<class Record>
+    bool sendRecord(uint32_t type, const Record &record) {
+        return sendMessage(type, { Buffer{ &record, sizeof(record) } });
+    }
+    // Copies the plain struct at offset out of a payload, false if the payload is too short for it.
+    template<class Record>
+    static bool readRecord(const std::vector<char> &payload, Record &record, size_t offset = 0) {
+        if (payload.size() < offset + sizeof(record)) {
+            return false;
+        }
+        std::memcpy(&record, payload.data() + offset, sizeof(record));
+        return true;
+    }
+
+    // Indices of the sockets that can be read (or accepted) from without blocking, after waiting at most
+    // timeoutMilliseconds for any of them. Closed connections count as readable, receiving tells them apart.
+    static std::vector<size_t> poll(const std::vector<TcpSocket *> &sockets, int timeoutMilliseconds);
+
+private:
+    void close();
+};
@@ -0,0 +1,130 @@
+#include "tilescheduler.h"
+
+#include <algorithm>
+
+namespace {
+    const size_t COMPLETION_QUEUE_CAPACITY = 1 << 14;
+}
+
+std::vector<Tile> tileutils::splitIntoTiles(Tile area, int tileSize) {
+    auto tiles = std::vector<Tile>();
+    for (auto y = area.y0; y < area.y1; y += tileSize) {
+        for (auto x = area.x0; x < area.x1; x += tileSize) {
+            tiles.push_back(Tile{ x, y, std::min(x + tileSize, area.x1), std::min(y + tileSize, area.y1) });
+        }
+    }
+    return tiles;
+}
+
+TileScheduler::TileScheduler(int workerCount)
+    : _completed(COMPLETION_QUEUE_CAPACITY) {
+    if (workerCount <= 0) {
+        workerCount = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+
+    for (auto i = 0; i < workerCount; i++) {
+        _queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (auto i = 0; i < workerCount; i++) {
+        _workers.emplace_back(&TileScheduler::workerLoop, this, i);
+    }
+}
+
+TileScheduler::~TileScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+        _stop = true;
+    }
+    _wakeCondition.notify_all();
+    for (auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+void TileScheduler::submit(const std::vector<Tile> &tiles, TileFunction renderTile) {
+    if (tiles.empty()) {
+        return;
+    }
+
+    auto function = std::make_shared<const TileFunction>(std::move(renderTile));
+    auto workerCount = _queues.size();
+    _pendingTiles += int(tiles.size());
+
+    for (size_t worker = 0; worker < workerCount; worker++) {
+        auto begin = tiles.size() * worker / workerCount;
+        auto end = tiles.size() * (worker + 1) / workerCount;
+
+        std::lock_guard<std::mutex> lock(_queues[worker]->mutex);
+        for (auto i = begin; i < end; i++) {
+            _queues[worker]->items.push_back(WorkItem{ tiles[i], function });
+        }
+        _queuedTiles += int(end - begin);
+    }
+
+    // A worker that just saw no queued tiles holds the mutex until it waits, so it cannot miss the notification.
+    {
+        std::lock_guard<std::mutex> lock(_wakeMutex);
+    }
+    _wakeCondition.notify_all();
+}
+
+void TileScheduler::cancelQueued() {
+    for (auto &queue : _queues) {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        auto dropped = int(queue->items.size());
+        _queuedTiles -= dropped;
+        _pendingTiles -= dropped;
+        queue->items.clear();
+    }
+}
+
+bool TileScheduler::takeWork(int workerIndex, WorkItem &item) {
+    // Own queue first, from the front.
+    {
+        auto &queue = *_queues[workerIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.items.empty()) {
+            item = std::move(queue.items.front());
+            queue.items.pop_front();
+            _queuedTiles--;
+            return true;
+        }
+    }
+
+    // Then steal from the back of the others, starting at the next worker so thieves spread out.
+    auto workerCount = int(_queues.size());
+    for (auto offset = 1; offset < workerCount; offset++) {
+        auto &queue = *_queues[(workerIndex + offset) % workerCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.items.empty()) {
+            item = std::move(queue.items.back());
+            queue.items.pop_back();
+            _queuedTiles--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TileScheduler::workerLoop(int workerIndex) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_wakeMutex);
+            _wakeCondition.wait(lock, [&] { return _stop || _queuedTiles > 0; });
+            if (_stop) {
+                return;
+            }
+        }
+
+        WorkItem item = {};
+        while (!_stop && takeWork(workerIndex, item)) {
+            (*item.renderTile)(item.tile);
+            item.renderTile.reset();
+
+            while (!_completed.tryPush(item.tile) && !_stop) {
+                std::this_thread::yield();
+            }
+            _pendingTiles--;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include "concurrentqueue.h"
+
+// A rectangle of pixels, [x0, x1) x [y0, y1) in screen space.
+struct Tile {
+public:
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+};
+
+namespace tileutils {
+    // Cuts the rectangle into tiles of at most tileSize x tileSize pixels, row by row.
+    std::vector<Tile> splitIntoTiles(Tile area, int tileSize);
+}
+
+// Fixed pool of worker threads rendering tiles. Every worker owns a queue of tiles and takes from its front,
+// workers that run out steal from the back of the others' queues.
+// Finished tiles are reported through a lock-free queue that the display thread drains with popCompleted().
+class TileScheduler {
+public:
+    using TileFunction = std::function<void(const Tile &tile)>;
+
+private:
+    struct WorkItem {
+    public:
+        Tile tile = {};
+        std::shared_ptr<const TileFunction> renderTile = {};
+    };
+
+    struct alignas(64) WorkerQueue {
+    public:
+        std::mutex mutex;
+        std::deque<WorkItem> items;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> _queues = {};
+    std::vector<std::thread> _workers = {};
+    ConcurrentQueue<Tile> _completed;
+
+    std::mutex _wakeMutex;
+    std::condition_variable _wakeCondition;
+    // Tiles sitting in a queue, not yet taken by a worker. Only changes together with a queue, under its mutex.
+    std::atomic<int> _queuedTiles = 0;
+    // Tiles submitted but not rendered yet.
+    std::atomic<int> _pendingTiles = 0;
+    std::atomic<bool> _stop = false;
+
+public:
+    // A worker count of 0 uses one worker per hardware thread.
+    explicit TileScheduler(int workerCount = 0);
+    ~TileScheduler();
+
+    TileScheduler(const TileScheduler &) = delete;
+    TileScheduler &operator=(const TileScheduler &) = delete;
+
+    int workerCount() const { return int(_workers.size()); }
+
+    // Hands out the tiles to the workers in contiguous runs, so neighbouring tiles start on the same thread.
+    void submit(const std::vector<Tile> &tiles, TileFunction renderTile);
+
+    // Lock-free, returns false if no tile finished since the last call.
+    // Workers block when the completion queue is full, so whoever submits has to drain it.
+    bool popCompleted(Tile &tile) { return _completed.tryPop(tile); }
+
+    // True if every submitted tile has been rendered.
+    bool idle() const { return _pendingTiles.load() == 0; }
+
+    // Drops the tiles no worker has started yet. The ones being rendered still finish and are reported,
+    // idle() tells when they are done.
+    void cancelQueued();
+
+private:
+    void workerLoop(int workerIndex);
+    bool takeWork(int workerIndex, WorkItem &item);
+};
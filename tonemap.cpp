@@ -0,0 +1,44 @@
+#include "tonemap.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace {
+    // Krzysztof Narkowicz's fit of the ACES reference rendering transform.
+    Radiance acesFilmic(Radiance x) {
+        const float a = 2.51f;
+        const float b = 0.03f;
+        const float c = 2.43f;
+        const float d = 0.59f;
+        const float e = 0.14f;
+        auto mapped = (x * (x * a + b)) / (x * (x * c + d) + e);
+        return _mm_min_ps(_mm_max_ps(mapped.mmvalue, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    }
+
+    int encodeSrgb(float linear) {
+        auto encoded = linear <= 0.0031308f
+            ? 12.92f * linear
+            : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+        return std::clamp(int(encoded * 255.0f + 0.5f), 0, 255);
+    }
+}
+
+Color tonemap::toDisplayColor(Radiance radiance, float exposure) {
+    auto mapped = acesFilmic(radiance * std::exp2(exposure));
+    return Color(
+        encodeSrgb(mapped.x),
+        encodeSrgb(mapped.y),
+        encodeSrgb(mapped.z)
+    );
+}
+
+std::vector<Color> tonemap::toDisplayImage(const Framebuffer &framebuffer, float exposure) {
+    auto pixels = std::vector<Color>();
+    pixels.reserve(size_t(framebuffer.width()) * framebuffer.height());
+    for (auto y = 0; y < framebuffer.height(); y++) {
+        for (auto x = 0; x < framebuffer.width(); x++) {
+            pixels.push_back(toDisplayColor(framebuffer.average(x, y), exposure));
+        }
+    }
+    return pixels;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+
+#include "vec3.h"
+#include "framebuffer.h"
+
+// Turns linear radiance into 8 bit display colors. This is the only place where radiance gets quantized.
+namespace tonemap {
+    // Scales by 2^exposure, compresses highlights with a filmic (ACES) curve and encodes as sRGB.
+    Color toDisplayColor(Radiance radiance, float exposure);
+
+    // Row by row, top to bottom.
+    std::vector<Color> toDisplayImage(const Framebuffer &framebuffer, float exposure);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cmath>
+
+#include "vec3.h"
+#include "boundingbox.h"
+
+// Places an object: scaled uniformly, turned about the y axis and then moved. Spheres stay spheres
+// under it, so moving one only changes its center and radius.
+struct Transform {
+public:
+    Vec3 translation = {};
+    float scale = 1.0f;
+    // Radians, turning +z towards +x.
+    float yaw = 0.0f;
+
+    Vec3 applyToVector(Vec3 vector) const {
+        auto cosYaw = std::cos(yaw);
+        auto sinYaw = std::sin(yaw);
+        return Vec3(cosYaw * vector.x + sinYaw * vector.z, vector.y, cosYaw * vector.z - sinYaw * vector.x) * scale;
+    }
+    Vec3 applyToPoint(Vec3 point) const { return applyToVector(point) + translation; }
+    Vec3 applyInverseToVector(Vec3 vector) const {
+        auto cosYaw = std::cos(yaw);
+        auto sinYaw = std::sin(yaw);
+        return Vec3(cosYaw * vector.x - sinYaw * vector.z, vector.y, cosYaw * vector.z + sinYaw * vector.x) / scale;
+    }
+    Vec3 applyInverseToPoint(Vec3 point) const { return applyInverseToVector(point - translation); }
+
+    // The box around the corners of box, once they are placed.
+    BoundingBox applyToBox(const BoundingBox &box) const {
+        auto placed = BoundingBox();
+        for (auto corner = 0; corner < 8; corner++) {
+            placed = placed.expand(applyToPoint(Vec3(
+                corner & 1 ? box.max().x : box.min().x,
+                corner & 2 ? box.max().y : box.min().y,
+                corner & 4 ? box.max().z : box.min().z)));
+        }
+        return placed;
+    }
+
+    bool operator==(const Transform &other) const {
+        return translation == other.translation && scale == other.scale && yaw == other.yaw;
+    }
+    bool operator!=(const Transform &other) const { return !(*this == other); }
+
+    // Places with inner first and then with outer. Turning only about y keeps that a Transform.
+    static Transform combine(const Transform &outer, const Transform &inner) {
+        return Transform{ outer.applyToPoint(inner.translation), outer.scale * inner.scale, outer.yaw + inner.yaw };
+    }
+
+    // Every part on its own, linear from a at 0 to b at 1.
+    static Transform interpolate(const Transform &a, const Transform &b, float t) {
+        return Transform{ a.translation + (b.translation - a.translation) * t, a.scale + (b.scale - a.scale) * t,
+            a.yaw + (b.yaw - a.yaw) * t };
+    }
+};
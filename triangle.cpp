@@ -2,7 +2,7 @@
 
 #include <limits>
 
-std::optional<Intersection> Triangle::intersect(const Ray &ray) const {
+std::optional<float> Triangle::hitDistance(const Ray &ray) const {
     const float EPSILON = std::numeric_limits<float>::epsilon();
 
     Vec3 edge1 = _vertex1 - _vertex0;
@@ -12,32 +12,55 @@ std::optional<Intersection> Triangle::intersect(const Ray &ray) const {
     float a = edge1.dot(h);
 
     if (a > -EPSILON && a < EPSILON)
-        return std::optional<Intersection>();    // This ray is parallel to this triangle.
+        return std::optional<float>();    // This ray is parallel to this triangle.
 
     float f = 1.0 / a;
     Vec3 s = ray.origin() - _vertex0;
     float u = f * s.dot(h);
     if (u < 0.0 || u > 1.0)
-        return std::optional<Intersection>();
+        return std::optional<float>();
 
     Vec3 q = s.cross(edge1);
     float v = f * ray.direction().dot(q);
     if (v < 0.0 || u + v > 1.0)
-        return std::optional<Intersection>();
+        return std::optional<float>();
 
     // At this stage we can compute t to find out where the intersection point is on the line.
     float t = f * edge2.dot(q);
     if (t > EPSILON && t < 1 / EPSILON) // ray intersection
-    {
-        auto intersectionPosition = ray.origin() + ray.direction() * t;
-        auto intersection = Intersection(
-            intersectionPosition,
-            edge1.cross(edge2),
-            t,
-            _material
-        );
-        return intersection;
-    }
+        return t;
     else // This means that there is a line intersection but not a ray intersection.
-        return std::optional<Intersection>();    // This ray is parallel to this triangle.
+        return std::optional<float>();
+}
+
+std::optional<Intersection> Triangle::intersect(const Ray &ray, float tMax) const {
+    auto t = hitDistance(ray);
+    if (!t || *t >= tMax) {
+        return std::optional<Intersection>();
+    }
+
+    auto intersectionPosition = ray.origin() + ray.direction() * *t;
+    auto intersection = Intersection(
+        intersectionPosition,
+        (_vertex1 - _vertex0).cross(_vertex2 - _vertex0),
+        *t,
+        _material
+    );
+    return intersection;
+}
+
+bool Triangle::occludes(const Ray &ray, float tMax) const {
+    auto t = hitDistance(ray);
+    return t && *t < tMax;
+}
+
+BoundingBox Triangle::boundingBox() const {
+    return BoundingBox()
+        .expand(_vertex0)
+        .expand(_vertex1)
+        .expand(_vertex2);
+}
+
+void Triangle::appendTo(PrimitiveList &primitives) const {
+    primitives.triangles.push_back(TrianglePrimitive{ _vertex0, _vertex1, _vertex2, primitives.addMaterial(_material) });
 }
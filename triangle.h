@@ -2,7 +2,7 @@
 
 #include "sceneobject.h"
 
-class Triangle : public SceneObject {
+class Triangle final : public SceneObject {
     Vec3 _vertex0 = {};
     Vec3 _vertex1 = {};
     Vec3 _vertex2 = {};
@@ -13,6 +13,14 @@ public:
         : _vertex0(vertex0), _vertex1(vertex1), _vertex2(vertex2), _material(material) {}
     ~Triangle() = default;
 
+private:
+    std::optional<float> hitDistance(const Ray &ray) const;
+
+public:
+
     // Inherited via SceneObject
-    virtual std::optional<Intersection> intersect(const Ray &ray) const override;
+    virtual std::optional<Intersection> intersect(const Ray &ray, float tMax) const override;
+    virtual bool occludes(const Ray &ray, float tMax) const override;
+    virtual BoundingBox boundingBox() const override;
+    virtual void appendTo(PrimitiveList &primitives) const override;
 };
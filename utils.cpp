@@ -2,9 +2,9 @@
 
 #include <random>
 
+#include "pcg32.h"
+
 float utils::randomFloat(float low, float high) {
-    static thread_local std::random_device rd;
-    static thread_local std::mt19937 gen(rd());
-    std::uniform_real_distribution<> dis(low, high);
-    return dis(gen);
+    static thread_local Pcg32 generator(std::random_device{}());
+    return low + generator.nextFloat() * (high - low);
 }
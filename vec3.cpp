@@ -8,24 +8,34 @@ Vec3 vectorutils::randomVector(float low, float high) {
     );
 }
 
-Vec3 vectorutils::createRandomVectorInHemisphere(Vec3 other) {
-    other = other.normalize();
-    auto randomVec = randomVector(-1.0f, 1.0f).normalize();
-
-    // Check if the two vectors are > 90 degree apart
-    if (other.dot(randomVec) <= 0) {
-        randomVec = randomVec * -1.0f;
-    }
+void vectorutils::createOrthonormalBasis(Vec3 normal, Vec3 &tangent, Vec3 &bitangent) {
+    auto sign = std::copysign(1.0f, normal[2]);
+    auto a = -1.0f / (sign + normal[2]);
+    auto b = normal[0] * normal[1] * a;
+    tangent = Vec3(1.0f + sign * normal[0] * normal[0] * a, sign * b, -sign * normal[0]);
+    bitangent = Vec3(b, sign + normal[1] * normal[1] * a, -normal[1]);
+}
 
-    assert(other.dot(randomVec) >= 0);
+Vec3 vectorutils::createCosineWeightedVectorInHemisphere(Vec3 normal, float u1, float u2) {
+    normal = normal.normalize();
+    auto tangent = Vec3();
+    auto bitangent = Vec3();
+    createOrthonormalBasis(normal, tangent, bitangent);
 
-    return randomVec;
+    // Uniform on the disk, projected up onto the hemisphere (Malley's method).
+    auto radius = std::sqrt(u1);
+    auto phi = 2.0f * PI * u2;
+    auto height = std::sqrt(std::max(0.0f, 1.0f - u1));
+    return (tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) + normal * height).normalize();
 }
 
-Color colorutils::multiplyColors(Color a, Color b) {
-    return Color(
-        a.x() * b.x(),
-        a.y() * b.y(),
-        a.z() * b.z()
-    ) / 255;
+Vec3 vectorutils::createVectorInCone(Vec3 axis, float cosMax, float u1, float u2) {
+    auto tangent = Vec3();
+    auto bitangent = Vec3();
+    createOrthonormalBasis(axis, tangent, bitangent);
+
+    auto cosTheta = 1.0f - u1 * (1.0f - cosMax);
+    auto sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    auto phi = 2.0f * PI * u2;
+    return (tangent * (sinTheta * std::cos(phi)) + bitangent * (sinTheta * std::sin(phi)) + axis * cosTheta).normalize();
 }
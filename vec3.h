@@ -2,6 +2,7 @@
 
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 
 #include "utils.h"
 #include "vec3_simd.h"
@@ -98,13 +99,22 @@ public:
 
 // using Vec3 = Vec3T<float>;
 using Vec3 = SimdVector3;
+// Linear, high dynamic range radiance. All light transport is done with it,
+// it only becomes a Color when it gets displayed or written, see tonemap.h.
+using Radiance = SimdVector3;
+// 8 bit display color.
 using Color = Vec3T<int>;
 
 namespace vectorutils {
+    constexpr float PI = 3.14159265358979f;
+
     Vec3 randomVector(float low, float high);
-    Vec3 createRandomVectorInHemisphere(Vec3 other);
+    // Two unit vectors that make an orthonormal basis with the unit vector normal (Duff et al. 2017).
+    void createOrthonormalBasis(Vec3 normal, Vec3 &tangent, Vec3 &bitangent);
+    // Maps two uniform numbers in [0, 1) to a direction on the side of the hemisphere normal points to,
+    // distributed with the cosine to normal. The density per solid angle is cos / pi.
+    Vec3 createCosineWeightedVectorInHemisphere(Vec3 normal, float u1, float u2);
+    // Maps two uniform numbers in [0, 1) to a direction at most acos(cosMax) away from the unit vector axis,
+    // uniformly over the solid angle of that cone.
+    Vec3 createVectorInCone(Vec3 axis, float cosMax, float u1, float u2);
 }
-
-namespace colorutils {
-    Color multiplyColors(Color a, Color b);
-}
\ No newline at end of file
@@ -31,7 +31,7 @@ void free_simd(void *v);
 ** 3D floating-point precission mathematical vector class.
 */
 #ifdef __GNUC__
-class __attribute__((aligned(16))) Vector3
+class __attribute__((aligned(16))) SimdVector3
 #else
 _MM_ALIGN16 class SimdVector3
 #endif
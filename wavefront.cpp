@@ -0,0 +1,222 @@
+#include "wavefront.h"
+
+#include <algorithm>
+
+#include "renderer.h"
+
+void PathQueue::reserve(size_t capacity) {
+    for (auto *values : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ,
+                          &throughputR, &throughputG, &throughputB, &bouncePdf }) {
+        values->resize(std::max(values->size(), capacity));
+    }
+    pathIndex.resize(std::max(pathIndex.size(), capacity));
+}
+
+void PathQueue::push(const Ray &ray, Radiance throughput, float pdf, uint32_t path) {
+    auto origin = ray.origin();
+    auto direction = ray.direction();
+    originX[size] = origin[0];
+    originY[size] = origin[1];
+    originZ[size] = origin[2];
+    directionX[size] = direction[0];
+    directionY[size] = direction[1];
+    directionZ[size] = direction[2];
+    throughputR[size] = throughput[0];
+    throughputG[size] = throughput[1];
+    throughputB[size] = throughput[2];
+    bouncePdf[size] = pdf;
+    pathIndex[size] = path;
+    size++;
+}
+
+void ShadowQueue::reserve(size_t capacity) {
+    for (auto *values : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ, &distance,
+                          &radianceR, &radianceG, &radianceB }) {
+        values->resize(std::max(values->size(), capacity));
+    }
+    pathIndex.resize(std::max(pathIndex.size(), capacity));
+}
+
+void ShadowQueue::push(const LightConnection &connection, Radiance throughput, uint32_t path) {
+    auto origin = connection.ray.origin();
+    auto direction = connection.ray.direction();
+    auto radiance = throughput * connection.radiance;
+    originX[size] = origin[0];
+    originY[size] = origin[1];
+    originZ[size] = origin[2];
+    directionX[size] = direction[0];
+    directionY[size] = direction[1];
+    directionZ[size] = direction[2];
+    distance[size] = connection.distance;
+    radianceR[size] = radiance[0];
+    radianceG[size] = radiance[1];
+    radianceB[size] = radiance[2];
+    pathIndex[size] = path;
+    size++;
+}
+
+Sampler &WavefrontRenderer::sampler(uint32_t path, SamplerType type) {
+    if (type == SamplerType::Random) {
+        return _randomSamplers[path];
+    }
+    return _sobolSamplers[path];
+}
+
+void WavefrontRenderer::renderTile(const Tile &tile, int firstSample, int sampleCount, const std::vector<uint8_t> &activePixels,
+    const RenderOptions &options, const Scene &scene, Framebuffer &framebuffer, const std::atomic<bool> *cancelled) {
+    auto pixelCount = size_t(tile.width()) * tile.height();
+    auto pathCount = pixelCount * sampleCount;
+
+    _paths.reserve(pathCount);
+    _nextPaths.reserve(pathCount);
+    _shadowRays.reserve(pathCount);
+    if (_hits.size() < pathCount) {
+        _hits.resize(pathCount);
+    }
+    auto seed = uint32_t(options.seed);
+    if (options.samplerType == SamplerType::Random) {
+        _randomSamplers.assign(pathCount, RandomSampler(seed));
+    }
+    else {
+        _sobolSamplers.assign(pathCount, SobolSampler(seed));
+    }
+    _sampleRadiance.assign(pathCount, Radiance());
+    _sampleFeatures.assign(pathCount, PixelFeatures());
+
+    generateCameraRays(tile, firstSample, sampleCount, activePixels, options, scene);
+    for (auto depth = 0; _paths.size > 0; depth++) {
+        extend(depth, scene);
+        shadeAndGenerate(depth, options, scene);
+        connect(scene);
+        std::swap(_paths, _nextPaths);
+        if (cancelled && cancelled->load(std::memory_order_relaxed)) {
+            return;
+        }
+    }
+
+    // In sample order, like renderPixel.
+    for (auto y = tile.y0; y < tile.y1; y++) {
+        for (auto x = tile.x0; x < tile.x1; x++) {
+            if (!activePixels.empty() && !activePixels[size_t(y) * options.width + x]) {
+                continue;
+            }
+            auto firstPath = (size_t(y - tile.y0) * tile.width() + (x - tile.x0)) * sampleCount;
+            auto sum = Radiance();
+            auto statistics = PixelStatistics();
+            auto featureSum = PixelFeatures();
+            for (auto i = 0; i < sampleCount; i++) {
+                sum += _sampleRadiance[firstPath + i];
+                statistics.add(_sampleRadiance[firstPath + i]);
+                featureSum += _sampleFeatures[firstPath + i];
+            }
+            framebuffer.add(x, y, sum, statistics, featureSum);
+        }
+    }
+}
+
+void WavefrontRenderer::generateCameraRays(const Tile &tile, int firstSample, int sampleCount,
+    const std::vector<uint8_t> &activePixels, const RenderOptions &options, const Scene &scene) {
+    _paths.clear();
+    auto camera = renderCamera(options, scene);
+    for (auto y = tile.y0; y < tile.y1; y++) {
+        for (auto x = tile.x0; x < tile.x1; x++) {
+            if (!activePixels.empty() && !activePixels[size_t(y) * options.width + x]) {
+                continue;
+            }
+            // Same screen space as renderPixel.
+            auto moved_x = x - (options.width / 2);
+            auto moved_y = (options.height / 2) - y;
+
+            // Paths of skipped pixels stay unused, so a path's index still tells its pixel and sample.
+            auto firstPath = uint32_t((size_t(y - tile.y0) * tile.width() + (x - tile.x0)) * sampleCount);
+            for (auto i = 0; i < sampleCount; i++) {
+                auto path = firstPath + uint32_t(i);
+                auto &pathSampler = sampler(path, options.samplerType);
+                pathSampler.startSample(x, y, uint32_t(firstSample + i));
+
+                auto ray = createCameraRay(float(moved_x), float(moved_y), pathSampler, camera, options);
+                _paths.push(ray, Radiance(1.0f, 1.0f, 1.0f), 0.0f, path);
+            }
+        }
+    }
+}
+
+void WavefrontRenderer::extend(int depth, const Scene &scene) {
+    renderstats::countRays(depth == 0 ? renderstats::RayType::Camera : renderstats::RayType::Bounce, _paths.size);
+    for (size_t i = 0; i < _paths.size; i++) {
+        _hits[i] = scene.intersect(_paths.ray(i));
+    }
+}
+
+void WavefrontRenderer::shadeAndGenerate(int depth, const RenderOptions &options, const Scene &scene) {
+    const auto BACKGROUND = Radiance(1.0f, 1.0f, 1.0f) * renderconstants::BACKGROUND_RADIANCE;
+
+    _nextPaths.clear();
+    _shadowRays.clear();
+    for (size_t i = 0; i < _paths.size; i++) {
+        auto path = _paths.pathIndex[i];
+        auto &pathRadiance = _sampleRadiance[path];
+        auto throughput = _paths.throughput(i);
+
+        if (!_hits[i].hit()) {
+            if (depth == 0) {
+                _sampleFeatures[path] = firstHitFeatures(_paths.ray(i), std::optional<Intersection>());
+            }
+            pathRadiance += throughput * BACKGROUND;
+            renderstats::countPath(depth + 1);
+            continue;
+        }
+
+        auto ray = _paths.ray(i);
+        auto intersection = scene.resolve(ray, _hits[i]);
+        if (depth == 0) {
+            _sampleFeatures[path] = firstHitFeatures(ray, intersection);
+        }
+        const auto &material = intersection.material();
+        auto emittingColor = material.emittingColor();
+        if (emittingColor) {
+            pathRadiance += throughput * emittingColor.value() * lightHitWeight(ray, _paths.bouncePdf[i], scene);
+            renderstats::countPath(depth + 1);
+            continue;
+        }
+
+        if (depth + 1 > options.maxDepth) {
+            renderstats::countPath(depth + 1);
+            continue;
+        }
+
+        auto normal = intersection.surfaceNormal();
+        if (normal.dot(ray.direction()) > 0.0f) {
+            normal = -normal;
+        }
+        auto origin = intersection.position() + normal * 0.5f;
+        auto outgoing = -ray.direction();
+        auto bsdf = Bsdf(material, normal);
+        auto &pathSampler = sampler(path, options.samplerType);
+        auto connection = connectToLight(origin, outgoing, bsdf, pathSampler, scene);
+        if (connection) {
+            _shadowRays.push(*connection, throughput, path);
+        }
+
+        auto bounce = bsdf.sample(outgoing, pathSampler);
+        if (!bounce) {
+            renderstats::countPath(depth + 1);
+            continue;
+        }
+        throughput = throughput * bounce->weight;
+        if (!survivesRussianRoulette(throughput, depth + 1, pathSampler)) {
+            renderstats::countPath(depth + 1);
+            continue;
+        }
+        _nextPaths.push(Ray(origin, bounce->direction), throughput, bounce->pdf, path);
+    }
+}
+
+void WavefrontRenderer::connect(const Scene &scene) {
+    renderstats::countRays(renderstats::RayType::Shadow, _shadowRays.size);
+    for (size_t i = 0; i < _shadowRays.size; i++) {
+        if (!scene.occluded(_shadowRays.ray(i), _shadowRays.distance[i])) {
+            _sampleRadiance[_shadowRays.pathIndex[i]] += _shadowRays.radiance(i);
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+#include "scene.h"
+#include "ray.h"
+#include "vec3.h"
+#include "hitrecord.h"
+#include "options.h"
+#include "framebuffer.h"
+#include "tilescheduler.h"
+#include "sampler.h"
+#include "renderer.h"
+
+// Paths of one wave in structure-of-arrays layout. Every stage streams through a few of the arrays.
+struct PathQueue {
+public:
+    std::vector<float> originX = {};
+    std::vector<float> originY = {};
+    std::vector<float> originZ = {};
+    std::vector<float> directionX = {};
+    std::vector<float> directionY = {};
+    std::vector<float> directionZ = {};
+    // Product of the attenuation of all bounces so far.
+    std::vector<float> throughputR = {};
+    std::vector<float> throughputG = {};
+    std::vector<float> throughputB = {};
+    // Density of the direction of the last bounce, 0 for camera rays. Weighs the light the ray may hit.
+    std::vector<float> bouncePdf = {};
+    // Index of the path in the wave, which is also its sampler and pixel * samples + sample.
+    std::vector<uint32_t> pathIndex = {};
+    size_t size = 0;
+
+    // Keeps the capacity, so the queue stops allocating once it has seen the largest wave.
+    void clear() { size = 0; }
+    void reserve(size_t capacity);
+    void push(const Ray &ray, Radiance throughput, float pdf, uint32_t path);
+
+    Ray ray(size_t i) const {
+        return Ray(Vec3(originX[i], originY[i], originZ[i]), Vec3(directionX[i], directionY[i], directionZ[i]));
+    }
+    Radiance throughput(size_t i) const { return Radiance(throughputR[i], throughputG[i], throughputB[i]); }
+};
+
+// Shadow rays towards the light, in the same layout. At most one per path and bounce.
+struct ShadowQueue {
+public:
+    std::vector<float> originX = {};
+    std::vector<float> originY = {};
+    std::vector<float> originZ = {};
+    std::vector<float> directionX = {};
+    std::vector<float> directionY = {};
+    std::vector<float> directionZ = {};
+    std::vector<float> distance = {};
+    // What the path gets if nothing is in the way, the throughput is already applied.
+    std::vector<float> radianceR = {};
+    std::vector<float> radianceG = {};
+    std::vector<float> radianceB = {};
+    std::vector<uint32_t> pathIndex = {};
+    size_t size = 0;
+
+    void clear() { size = 0; }
+    void reserve(size_t capacity);
+    void push(const LightConnection &connection, Radiance throughput, uint32_t path);
+
+    Ray ray(size_t i) const {
+        return Ray(Vec3(originX[i], originY[i], originZ[i]), Vec3(directionX[i], directionY[i], directionZ[i]));
+    }
+    Radiance radiance(size_t i) const { return Radiance(radianceR[i], radianceG[i], radianceB[i]); }
+};
+
+// Breadth-first alternative to shootRay. All samples of a tile start as one wave of paths, which then
+// goes through the stages once per bounce:
+//  - extend: find the closest hit of every path,
+//  - shade: add what paths that hit the background or a light carry to their pixel and drop them,
+//    queue a shadow ray towards the light for the rest,
+//  - generate: bounce the rest into the next queue, which compacts out the terminated paths,
+//  - connect: test all shadow rays and add the light of the unblocked ones.
+// Every stage runs over the whole wave before the next one starts, so the same code and the same
+// scene data stay hot, and the stages are the place to sort rays or shade with SIMD.
+// Consumes the samplers in the same order as the recursive integrator, so both render the same image.
+class WavefrontRenderer {
+    PathQueue _paths = {};
+    PathQueue _nextPaths = {};
+    ShadowQueue _shadowRays = {};
+    std::vector<HitRecord> _hits = {};
+    std::vector<RandomSampler> _randomSamplers = {};
+    std::vector<SobolSampler> _sobolSamplers = {};
+    // What every path brought back, kept per sample for the pixel statistics.
+    std::vector<Radiance> _sampleRadiance = {};
+    std::vector<PixelFeatures> _sampleFeatures = {};
+
+public:
+    // Adds samples firstSample to firstSample + sampleCount - 1 of every pixel of the tile to the framebuffer.
+    // activePixels masks the whole image row by row, pixels that are 0 in it are skipped. Empty for all of them.
+    // Once cancelled is set, the paths are dropped after the bounce they are at and nothing is added.
+    void renderTile(const Tile &tile, int firstSample, int sampleCount, const std::vector<uint8_t> &activePixels,
+        const RenderOptions &options, const Scene &scene, Framebuffer &framebuffer, const std::atomic<bool> *cancelled = nullptr);
+
+private:
+    Sampler &sampler(uint32_t path, SamplerType type);
+    void generateCameraRays(const Tile &tile, int firstSample, int sampleCount, const std::vector<uint8_t> &activePixels,
+        const RenderOptions &options, const Scene &scene);
+    void extend(int depth, const Scene &scene);
+    void shadeAndGenerate(int depth, const RenderOptions &options, const Scene &scene);
+    void connect(const Scene &scene);
+};